@@ -0,0 +1,88 @@
+// Runtime and concordance of the segmentation engines on simulated profiles.
+//
+// usage: segment_bench [markers] [change points] [seed] [coarse bin] [refine window]
+//
+// Concordance is reported against cbs::segment as the fraction of CBS
+// breakpoints matched by the other engine within 3 markers, and the fraction
+// of the other engine's breakpoints matched by CBS.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "cbs/CBS.hpp"
+#include "cbs/pelt.hpp"
+
+static std::vector<int> breakpoints(const cbs::SegmentationResult& seg) {
+	std::vector<int> out;
+	int e = 0;
+	for (size_t i = 0; i + 1 < seg.lengths.size(); ++i) out.push_back(e += seg.lengths[i]);
+	return out;
+}
+
+static double matched(const std::vector<int>& from, const std::vector<int>& to, int tol) {
+	if (from.empty()) return 1.0;
+	std::set<int> s(to.begin(), to.end());
+	size_t hits = 0;
+	for (int b : from) {
+		auto it = s.lower_bound(b - tol);
+		if (it != s.end() && *it <= b + tol) ++hits;
+	}
+	return static_cast<double>(hits) / from.size();
+}
+
+template <typename F>
+static cbs::SegmentationResult timed(const char* name, F f, double& seconds) {
+	const auto t0 = std::chrono::steady_clock::now();
+	cbs::SegmentationResult seg = f();
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	std::printf("%-8s %10.3f s %6zu segments\n", name, seconds, seg.lengths.size());
+	return seg;
+}
+
+int main(int argc, const char* argv[]) {
+	const int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+	const int ncpt = argc > 2 ? std::atoi(argv[2]) : 40;
+	const unsigned seed = argc > 3 ? std::atoi(argv[3]) : 1;
+	const int bin = argc > 4 ? std::atoi(argv[4]) : 10;
+	const int window = argc > 5 ? std::atoi(argv[5]) : 2 * bin;
+
+	std::mt19937_64 gen(seed);
+	std::normal_distribution<double> noise(0.0, 0.25);
+	std::normal_distribution<double> level(0.0, 0.5);
+	std::uniform_int_distribution<int> pos(1, n - 1);
+	std::set<int> cpts;
+	while (static_cast<int>(cpts.size()) < ncpt) cpts.insert(pos(gen));
+	std::vector<double> x(n);
+	double mu = 0.0;
+	for (int i = 0; i < n; ++i) {
+		if (cpts.count(i)) mu = level(gen);
+		x[i] = mu + noise(gen);
+	}
+
+	const int nperm = 200;
+	std::vector<int> sbdry((nperm + 1) * (nperm + 2) / 2 + 2, nperm + 1);
+	std::mt19937_64 rng(1);
+	const double beta = 2.0 * std::log(static_cast<double>(n)) * cbs::diff_variance(x);
+
+	double tcbs, tmulti, tpelt, tbinseg;
+	const auto cbsseg = timed("cbs", [&] { return cbs::segment(x, false, 0.01, nperm, false, 2, 25, 200, 0.05, sbdry, 1e-6, rng); }, tcbs);
+	std::mt19937_64 mrng(1);
+	const auto multiseg = timed("multires", [&] { return cbs::segment_multires(x, bin, window, 0.01, nperm, false, 2, 25, 200, 0.05, sbdry, 1e-6, mrng); }, tmulti);
+	const auto peltseg = timed("pelt", [&] { return cbs::segment_pelt(x, beta, 2); }, tpelt);
+	const auto binsegseg = timed("binseg", [&] { return cbs::segment_binseg(x, beta, 2); }, tbinseg);
+
+	const std::vector<int> truth(cpts.begin(), cpts.end());
+	const auto bc = breakpoints(cbsseg), bm = breakpoints(multiseg), bp = breakpoints(peltseg), bb = breakpoints(binsegseg);
+	std::printf("\nconcordance     vs cbs (recall/precision)   vs truth (recall/precision)\n");
+	std::printf("cbs             %6.3f / %6.3f             %6.3f / %6.3f\n", 1.0, 1.0, matched(truth, bc, 3), matched(bc, truth, 3));
+	std::printf("multires        %6.3f / %6.3f             %6.3f / %6.3f\n", matched(bc, bm, 3), matched(bm, bc, 3), matched(truth, bm, 3), matched(bm, truth, 3));
+	std::printf("pelt            %6.3f / %6.3f             %6.3f / %6.3f\n", matched(bc, bp, 3), matched(bp, bc, 3), matched(truth, bp, 3), matched(bp, truth, 3));
+	std::printf("binseg          %6.3f / %6.3f             %6.3f / %6.3f\n", matched(bc, bb, 3), matched(bb, bc, 3), matched(truth, bb, 3), matched(bb, truth, 3));
+	std::printf("\nspeedup over cbs: multires %.1fx, pelt %.1fx, binseg %.1fx\n", tcbs / tmulti, tcbs / tpelt, tcbs / tbinseg);
+	return 0;
+}
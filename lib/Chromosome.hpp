@@ -60,6 +60,12 @@ public:
 	size_t size() const {
 		return items.size();
 	}
+	T* data() {
+		return items.data();
+	}
+	const T* data() const {
+		return items.data();
+	}
 	iterator begin() {
 		return items.begin();
 	}
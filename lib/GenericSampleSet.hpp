@@ -53,6 +53,8 @@ public:
 	void sort() {
 		if (rep != NULL) {
 			rep->sort();
+			// sorting may detach the representation's markers
+			Base::markers = rep->markers;
 		}
 	}
 	
@@ -65,6 +67,15 @@ public:
 		}
 		return 0;
 	}
+	
+protected:
+	
+	void internMarkers() {
+		if (rep != NULL) {
+			rep->internMarkers();
+			Base::markers = rep->markers;
+		}
+	}
 };
 
 class invalid_conversion : public std::logic_error
@@ -1,16 +1,34 @@
 #include "Marker.hpp"
+#include "MarkerImage.hpp"
 #include "parse.hpp"
 
+#include <random>
+
 namespace cna {
 namespace marker {
 
 	Manager manager;
 
 	void Set::read(const std::string& fileName, const std::string& platform, bool doSort, bool named) {
+		// a sorted set is loaded from, or else stored to, the cache beside the file
+		SourceKey key;
+		if (doSort && readCache(fileName, cacheOptions(named), *this, key)) return;
+		
 		std::ifstream file(fileName.c_str(), std::ios::in);
 		if (!file.is_open()) throw std::runtime_error("Failed to open marker input file '" + fileName + "'.");
 		read(file, platform, doSort, named);
 		file.close();
+		if (doSort) writeCache(fileName, key, *this);
+	}
+	
+	std::uint64_t Set::cacheOptions(bool named) const {
+		std::uint64_t h = 14695981039346656037UL;
+		const std::uint64_t fields[4] = {named ? 1UL : 0UL, static_cast<unsigned char>(io.delim), io.nSkippedLines, io.headerLine};
+		for (size_t i = 0; i < 4; ++i) {
+			h ^= fields[i];
+			h *= 1099511628211UL;
+		}
+		return h;
 	}
 	
 	void Set::read(std::ifstream& file, const std::string&, bool doSort, bool named) {
@@ -100,7 +118,8 @@ namespace marker {
 		GenomeMarkers::iterator it;
 		GenomeMarkers::const_iterator end = set.end();
 		for (it = set.begin(); it != end; ++it) {
-			std::sort(it->begin(), it->end(), &Marker::pcompare);
+			// markers at the same position keep their order
+			std::stable_sort(it->begin(), it->end(), &Marker::pcompare);
 		}
 	}
 	
@@ -214,6 +233,113 @@ namespace marker {
 		unsortedChromIndex = 0;
 	}
 
+	std::uint64_t Set::computeFingerprint() const {
+		// FNV-1a over the marker table
+		std::uint64_t h = 14695981039346656037UL;
+		auto mix = [&h](const void* data, size_t size) {
+			const unsigned char* p = static_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < size; ++i) {
+				h ^= p[i];
+				h *= 1099511628211UL;
+			}
+		};
+		const size_t nchroms = set.size();
+		mix(&nchroms, sizeof(nchroms));
+		mix(&unsortedChromIndex, sizeof(unsortedChromIndex));
+		mix(&namedMarkers, sizeof(namedMarkers));
+		for (GenomeMarkers::const_iterator it = set.begin(); it != set.end(); ++it) {
+			const size_t n = it->size();
+			mix(&n, sizeof(n));
+			for (ChromosomeMarkers::const_iterator m = it->begin(); m != it->end(); ++m) {
+				const size_t len = (*m)->name.size();
+				mix(&len, sizeof(len));
+				mix((*m)->name.data(), len);
+				mix(&(*m)->chromosome, sizeof((*m)->chromosome));
+				mix(&(*m)->pos, sizeof((*m)->pos));
+			}
+		}
+		return h;
+	}
+	
+	bool Set::sameMarkers(const Set& other) const {
+		if (set.size() != other.set.size() || unsortedChromIndex != other.unsortedChromIndex || namedMarkers != other.namedMarkers) {
+			return false;
+		}
+		for (size_t i = 0; i < set.size(); ++i) {
+			if (set[i].size() != other.set[i].size()) return false;
+			for (size_t j = 0; j < set[i].size(); ++j) {
+				const Marker& a = *set[i][j];
+				const Marker& b = *other.set[i][j];
+				if (a.pos != b.pos || a.chromosome != b.chromosome || a.name != b.name) return false;
+			}
+		}
+		return true;
+	}
+
+	namespace {
+		
+		// first of the n values at a not below x (upper: above x), without
+		// branching on the comparisons
+		template <bool upper>
+		size_t branchlessBound(const position* a, size_t n, position x) {
+			if (n == 0) return 0;
+			const position* base = a;
+			while (n > 1) {
+				const size_t half = n / 2;
+				base = (upper ? base[half] <= x : base[half] < x) ? base + half : base;
+				n -= half;
+			}
+			return (base - a) + (upper ? *base <= x : *base < x);
+		}
+		
+	}
+	
+	PositionIndex::PositionIndex(const Set& set) : positions(set.size()) {
+		for (size_t c = 0; c < set.size(); ++c) {
+			const Set::ChromosomeMarkers& markers = set.at(c);
+			std::vector<position>& pos = positions[c];
+			pos.reserve(markers.size());
+			for (Set::ChromosomeMarkers::const_iterator it = markers.begin(); it != markers.end(); ++it) {
+				if (!pos.empty() && (*it)->pos < pos.back()) {
+					throw std::logic_error("Markers must be sorted to be indexed by position.");
+				}
+				pos.push_back((*it)->pos);
+			}
+		}
+	}
+	
+	size_t PositionIndex::lowerBound(chromid chromIndex, position pos) const {
+		const std::vector<position>& a = at(chromIndex);
+		return branchlessBound<false>(a.data(), a.size(), pos);
+	}
+	
+	size_t PositionIndex::upperBound(chromid chromIndex, position pos) const {
+		const std::vector<position>& a = at(chromIndex);
+		return branchlessBound<true>(a.data(), a.size(), pos);
+	}
+	
+	void PositionIndex::covering(chromid chromIndex, const position* queries, size_t n, size_t* out) const {
+		const std::vector<position>& a = at(chromIndex);
+		const size_t m = a.size();
+		// merging costs m + n steps, searching n log m
+		size_t logm = 1;
+		while ((static_cast<size_t>(1) << logm) < m) ++logm;
+		const bool search = n * logm < m;
+		// markers before i are at or before the previous query
+		size_t i = 0;
+		for (size_t k = 0; k < n; ++k) {
+			const position q = queries[k];
+			if (k > 0 && q < queries[k-1]) {
+				i = branchlessBound<true>(a.data(), m, q);
+			} else if (search) {
+				i += branchlessBound<true>(a.data() + i, m - i, q);
+			} else {
+				while (i < m && a[i] <= q) ++i;
+			}
+			out[k] = i > 0 ? i - 1 : npos;
+		}
+	}
+
 	const char Manager::alphanum[] =
 		"0123456789"
 		"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
@@ -222,30 +348,120 @@ namespace marker {
 	// length of alphanum, subtracted by 1 (to account for null character)
 	const unsigned Manager::nalphanum = 62;
 	
+	void Manager::randAlphaNum(char *s, const unsigned n) {
+		// one generator per thread, seeded apart from every other thread's
+		static std::atomic<unsigned long> streams(0);
+		thread_local std::mt19937_64 rng{std::random_device{}() ^ (streams.fetch_add(1) * 0x9E3779B97F4A7C15UL)};
+		std::uniform_int_distribution<unsigned> pick(0, nalphanum - 1);
+		for (size_t i = 0; i + 1 < n; ++i) {
+			s[i] = alphanum[pick(rng)];
+		}
+		s[n-1] = '\0';
+	}
+	
 	void Manager::newSetName(std::string& markerSetPlatform) {
 		const unsigned n = 7;
 		char randstr[n];
-		do {
+		while (true) {
 			randAlphaNum(randstr, n);
 			markerSetPlatform = randstr;
-		} while (sets.find(markerSetPlatform) != sets.end());
+			// reserve the name, so that no other caller draws it before it is created
+			Shard& sh = shard(markerSetPlatform);
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			if (sh.sets.insert(std::make_pair(markerSetPlatform, (Set*)NULL)).second) break;
+		}
 	}
 
 	Set* Manager::create(const std::string& markerSetPlatform) {
 		if (markerSetPlatform.empty()) {
 			throw std::runtime_error("Market set platform name cannot be empty");
 		}
-		Set* set;
-		iterator it = sets.find(markerSetPlatform);
-		if (it == sets.end()) {
+		Shard& sh = shard(markerSetPlatform);
+		std::lock_guard<std::mutex> lock(sh.mutex);
+		Set*& set = sh.sets[markerSetPlatform];
+		if (set == NULL) {
 			set = new Set(markerSetPlatform);
-			sets[markerSetPlatform] = set;
 		} else {
-			set = it->second;
 			set->ref();
 		}
 		return set;
 	}
 	
+	Set* Manager::intern(Set* set) {
+		if (set == NULL || set->empty()) return set;
+		const std::uint64_t fingerprint = set->computeFingerprint();
+		Set* shared = NULL;
+		std::vector<Set*> others;
+		{
+			std::lock_guard<std::mutex> lock(indexMutex);
+			if (set->interned) return set;
+			typedef std::multimap<std::uint64_t, Set*>::iterator index_iterator;
+			std::pair<index_iterator, index_iterator> range = index.equal_range(fingerprint);
+			for (index_iterator it = range.first; it != range.second && shared == NULL; ++it) {
+				// a set whose last reference is gone may be clearing; one we hold a
+				// reference to is immutable while it is interned
+				if (!it->second->tryRef()) continue;
+				if (it->second->sameMarkers(*set)) shared = it->second;
+				else others.push_back(it->second);
+			}
+			if (shared == NULL) {
+				set->fingerprint = fingerprint;
+				set->interned = true;
+				index.insert(std::make_pair(fingerprint, set));
+			}
+		}
+		// releasing a reference can take the index lock
+		for (size_t i = 0; i < others.size(); ++i) unref(others[i]);
+		if (shared == NULL) return set;
+		unref(set);
+		return shared;
+	}
+	
+	Set* Manager::detach(Set* set) {
+		if (set == NULL) return set;
+		{
+			std::lock_guard<std::mutex> lock(indexMutex);
+			// intern() cannot take a new reference while the index is locked
+			if (set->refCount.load() == 1) {
+				if (set->interned) {
+					forgetLocked(set);
+				}
+				return set;
+			}
+		}
+		std::string platform;
+		newSetName(platform);
+		Set* copy = create(platform);
+		copy->namedMarkers = set->namedMarkers;
+		copy->io = set->io;
+		copy->unsortedChromIndex = set->unsortedChromIndex;
+		copy->set.resize(set->set.size());
+		for (size_t i = 0; i < set->set.size(); ++i) {
+			copy->set[i].reserve(set->set[i].size());
+			for (Set::ChromosomeMarkers::const_iterator m = set->set[i].begin(); m != set->set[i].end(); ++m) {
+				copy->set[i].push_back(new Marker(**m));
+			}
+		}
+		unref(set);
+		return copy;
+	}
+	
+	void Manager::forget(Set* set) {
+		std::lock_guard<std::mutex> lock(indexMutex);
+		if (set->interned) forgetLocked(set);
+	}
+	
+	void Manager::forgetLocked(Set* set) {
+		typedef std::multimap<std::uint64_t, Set*>::iterator index_iterator;
+		std::pair<index_iterator, index_iterator> range = index.equal_range(set->fingerprint);
+		for (index_iterator it = range.first; it != range.second; ++it) {
+			if (it->second == set) {
+				index.erase(it);
+				break;
+			}
+		}
+		set->interned = false;
+	}
+	
 } // namespace marker
 } // namespace cna
@@ -1,7 +1,12 @@
 #ifndef cna_Marker_h
 #define cna_Marker_h
 
+#include <atomic>
+#include <cstdint>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -42,9 +47,69 @@ namespace marker {
 		}
 	};
 
+	class Set;
+	
+	// Sorted marker positions of each chromosome of a set in contiguous
+	// arrays, for finding the marker that covers a position. It is a snapshot
+	// of the set: build another after sorting, filtering or cleaning the set.
+	// Lookups do not modify the index and may run concurrently.
+	class PositionIndex
+	{
+	public:
+		// no such marker
+		static const size_t npos = static_cast<size_t>(-1);
+		
+		PositionIndex() {}
+		
+		// throws std::logic_error if the markers of a chromosome are not sorted
+		explicit PositionIndex(const Set& set);
+		
+		// number of chromosomes
+		size_t size() const {
+			return positions.size();
+		}
+		
+		// marker positions on chromosome chromIndex; empty beyond size()
+		const std::vector<position>& at(chromid chromIndex) const {
+			return chromIndex < positions.size() ? positions[chromIndex] : empty;
+		}
+		
+		// index of the first marker on chromosome chromIndex at or after pos
+		size_t lowerBound(chromid chromIndex, position pos) const;
+		
+		// index of the first marker on chromosome chromIndex after pos
+		size_t upperBound(chromid chromIndex, position pos) const;
+		
+		// index of the marker covering pos, i.e. the last marker at or before
+		// it, or npos if pos precedes every marker on the chromosome
+		size_t covering(chromid chromIndex, position pos) const {
+			const size_t i = upperBound(chromIndex, pos);
+			return i > 0 ? i - 1 : npos;
+		}
+		
+		// covering() of each of the n positions at queries, in out. Ascending
+		// queries are answered in one merge with the markers, or by searching
+		// ahead of the previous answer when they are sparse; a query below the
+		// previous one is searched on its own.
+		void covering(chromid chromIndex, const position* queries, size_t n, size_t* out) const;
+		
+		std::vector<size_t> covering(chromid chromIndex, const std::vector<position>& queries) const {
+			std::vector<size_t> out(queries.size());
+			covering(chromIndex, queries.data(), queries.size(), out.data());
+			return out;
+		}
+		
+	private:
+		
+		std::vector< std::vector<position> > positions;
+		std::vector<position> empty;
+		
+	};
+	
 	class Set
 	{
 		friend class Manager;
+		friend class Image;
 		typedef boost::unordered_set<std::string> uset;
 	public:
 		typedef std::vector<Marker*> ChromosomeMarkers;
@@ -55,7 +120,8 @@ namespace marker {
 		
 		Set(const std::string& markerSetPlatform)
 		: platform(markerSetPlatform), namedMarkers(true),
-		  set(cna::nChromosomes), unsortedChromIndex(0), refCount(1) {
+		  set(cna::nChromosomes), unsortedChromIndex(0), refCount(1),
+		  interned(false), fingerprint(0) {
 		}
 		
 		~Set() {
@@ -65,6 +131,9 @@ namespace marker {
 		ChromosomeMarkers& at(chromid i) {
 			return set[i];
 		}
+		const ChromosomeMarkers& at(chromid i) const {
+			return set[i];
+		}
 		ChromosomeMarkers& operator[](chromid i) {
 			return set[i];
 		}
@@ -101,6 +170,8 @@ namespace marker {
 			this->io = io;
 		}
 		
+		// Sorted sets are cached in <fileName>.cnamrk, which later reads of the
+		// unchanged file load instead of parsing (see MarkerImage.hpp).
 		void read(const std::string& fileName, const std::string& platform, bool doSort=true, bool named=false);
 		void read(std::ifstream& file, const std::string& platform, bool doSort=true, bool named=false);
 		
@@ -113,6 +184,11 @@ namespace marker {
 		
 		bool empty();
 		
+		// position index of the markers as they are now; see PositionIndex
+		PositionIndex positionIndex() const {
+			return PositionIndex(*this);
+		}
+		
 		// Remove flagged markers from chromosome vectors and delete the owned Marker objects.
 		void clean();
 		
@@ -134,24 +210,39 @@ namespace marker {
 		// Owned marker storage, partitioned by chromosome.
 		GenomeMarkers set;
 		size_t unsortedChromIndex;
-		size_t refCount;
+		std::atomic<size_t> refCount;
+		// registered with the manager for sharing by content, and then immutable
+		bool interned;
+		std::uint64_t fingerprint;
 		
 		IOProperties io;
 		
 		// construct hash containing all marker names found in markerNames
 		void hashMarkers(const std::vector<std::string>& markerNames, uset& hash);
 		
+		// hash of the options a marker file is parsed with, for its cache
+		std::uint64_t cacheOptions(bool named) const;
+		
 		// construct hash containing all marker names found in ref
 		void hashMarkers(const Set& ref, uset& hash);
 		
 		void filter(const uset& refMarkersHash);
 		
 		void ref() {
-			++refCount;
+			refCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		
+		// take a reference unless the last one has already been released
+		bool tryRef() {
+			size_t n = refCount.load(std::memory_order_relaxed);
+			while (n != 0) {
+				if (refCount.compare_exchange_weak(n, n + 1, std::memory_order_acq_rel)) return true;
+			}
+			return false;
 		}
 		
 		bool unref() {
-			if (--refCount < 1) {
+			if (refCount.fetch_sub(1, std::memory_order_acq_rel) <= 1) {
 				clear();
 				return true;
 			}
@@ -160,24 +251,53 @@ namespace marker {
 		
 		void clear();
 		
+		// hash of the marker table: names, chromosomes and positions in order
+		std::uint64_t computeFingerprint() const;
+		
+		bool sameMarkers(const Set& other) const;
+		
 	};
 
 	/* singleton */
 	// Manage marker sets
+	// Safe to share between threads: sets are spread by name over shards that
+	// are locked independently, reference counts are atomic, and newSetName
+	// reserves each name it draws so that concurrent callers never share one.
+	// Sets read from different files with identical marker tables are shared
+	// through intern(); a holder that needs to modify a shared set detaches a
+	// private copy first.
 	class Manager
 	{
 	private:
 		typedef std::map<std::string, Set*>::iterator iterator;
-		std::map<std::string, Set*> sets;
+		struct Shard {
+			std::mutex mutex;
+			// a NULL entry is a name reserved by newSetName
+			std::map<std::string, Set*> sets;
+		};
+		static const size_t nshards = 16;
+		Shard shards[nshards];
+		// interned sets by fingerprint; a set is removed before it is deleted
+		std::mutex indexMutex;
+		std::multimap<std::uint64_t, Set*> index;
+		
+		void forget(Set* set);
+		void forgetLocked(Set* set);
 		static const char alphanum[];
 		static const unsigned nalphanum;
+		
+		Shard& shard(const std::string& markerSetPlatform) {
+			return shards[std::hash<std::string>()(markerSetPlatform) % nshards];
+		}
 	public:
 		Manager() {}
 		~Manager() {
-			iterator it;
-			const iterator end = sets.end();
-			for (it = sets.begin(); it != end; ++it) {
-				delete it->second;
+			for (size_t i = 0; i < nshards; ++i) {
+				iterator it;
+				const iterator end = shards[i].sets.end();
+				for (it = shards[i].sets.begin(); it != end; ++it) {
+					delete it->second;
+				}
 			}
 		}
 		
@@ -185,10 +305,25 @@ namespace marker {
 		
 		Set* create(const std::string& markerSetPlatform);
 		
+		// Set to use in place of set, which the caller holds a reference to: a
+		// registered set with identical markers, set being released, or else
+		// set itself, registered for later sets to share. Empty sets are not
+		// shared.
+		Set* intern(Set* set);
+		
+		// Set to use in place of set before modifying its markers: set itself
+		// if the caller holds the only reference, else a copy under a new name,
+		// set being released.
+		Set* detach(Set* set);
+		
+		// Referenced set of the given platform, or NULL if there is none
 		Set* operator[](const std::string& markerSetPlatform) {
-			Set* set = sets[markerSetPlatform];
-			set->ref();
-			return set;
+			Shard& sh = shard(markerSetPlatform);
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			iterator it = sh.sets.find(markerSetPlatform);
+			if (it == sh.sets.end() || it->second == NULL) return NULL;
+			it->second->ref();
+			return it->second;
 		}
 		
 		void ref(Set* set) {
@@ -198,8 +333,10 @@ namespace marker {
 		}
 		
 		void ref(const std::string& markerSetPlatform) {
-			iterator it = sets.find(markerSetPlatform);
-			if (it != sets.end()) {
+			Shard& sh = shard(markerSetPlatform);
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			iterator it = sh.sets.find(markerSetPlatform);
+			if (it != sh.sets.end() && it->second != NULL) {
 				it->second->ref();
 			}
 		}
@@ -211,21 +348,24 @@ namespace marker {
 		}
 		
 		void unref(const std::string& markerSetPlatform) {
-			iterator it = sets.find(markerSetPlatform);
-			if (it != sets.end() && it->second->unref()) {
-				delete (it->second);
-				sets.erase(it);
+			Set* dead = NULL;
+			{
+				Shard& sh = shard(markerSetPlatform);
+				std::lock_guard<std::mutex> lock(sh.mutex);
+				iterator it = sh.sets.find(markerSetPlatform);
+				if (it != sh.sets.end() && it->second != NULL && it->second->unref()) {
+					dead = it->second;
+					sh.sets.erase(it);
+				}
 			}
+			if (dead != NULL) forget(dead);
+			delete dead;
 		}
 		
 	private:
 		
-		void randAlphaNum(char *s, const unsigned n) {
-			for (size_t i = 0; i < n-1; ++i) {
-				s[i] = alphanum[std::rand() % (nalphanum)];
-			}
-			s[n] = '\0';
-		}
+		// n - 1 random characters and a terminating null in s[0, n)
+		void randAlphaNum(char *s, const unsigned n);
 		
 	};
 	extern Manager manager;
@@ -0,0 +1,280 @@
+#include "MarkerImage.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cna {
+namespace marker {
+
+namespace {
+
+	const char imageMagic[8] = {'C', 'N', 'A', 'M', 'R', 'K', '0', '1'};
+
+	struct ImageHeader {
+		char magic[8];
+		std::uint32_t ready;
+		std::uint32_t named;
+		std::uint64_t nchroms;
+		std::uint64_t nmarkers;
+		std::uint64_t nameBytes;
+		std::uint64_t checksum;
+	};
+
+	size_t align8(size_t n) {
+		return (n + 7) & ~static_cast<size_t>(7);
+	}
+
+	// byte offsets of the arrays following the header
+	struct ImageLayout {
+		size_t counts, offsets, positions, chromosomes, names, total;
+
+		ImageLayout(std::uint64_t nchroms, std::uint64_t nmarkers, std::uint64_t nameBytes) {
+			counts = sizeof(ImageHeader);
+			offsets = counts + 8 * nchroms;
+			positions = offsets + 8 * (nmarkers + 1);
+			chromosomes = positions + 8 * nmarkers;
+			names = align8(chromosomes + 4 * nmarkers);
+			total = align8(names + nameBytes);
+		}
+	};
+
+	// FNV-1a over the 8-byte words of [data, data + size), size a multiple of 8
+	std::uint64_t checksum(const char* data, size_t size, std::uint64_t h = 14695981039346656037UL) {
+		for (size_t i = 0; i < size; i += 8) {
+			std::uint64_t w;
+			std::memcpy(&w, data + i, 8);
+			h ^= w;
+			h *= 1099511628211UL;
+		}
+		return h;
+	}
+
+	const char cacheMagic[8] = {'C', 'N', 'A', 'M', 'K', 'C', '0', '1'};
+
+	// header of a cache file, followed by the image
+	struct CacheHeader {
+		char magic[8];
+		SourceKey key;
+	};
+
+	std::string cacheName(const std::string& fileName) {
+		return fileName + ".cnamrk";
+	}
+
+	// size and modification time of fileName in key; false if it cannot be stat'ed
+	bool statSource(const std::string& fileName, SourceKey& key) {
+		struct stat st;
+		if (stat(fileName.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+		key.size = static_cast<std::uint64_t>(st.st_size);
+		key.mtime = static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1000000000UL + static_cast<std::uint64_t>(st.st_mtim.tv_nsec);
+		return true;
+	}
+
+	// checksum of the content of fileName, zero-padded to whole words
+	bool hashSource(const std::string& fileName, std::uint64_t& hash) {
+		const int fd = open(fileName.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		std::vector<char> buffer(1 << 20);
+		std::uint64_t h = 14695981039346656037UL;
+		bool ok = true;
+		while (true) {
+			const ssize_t n = ::read(fd, buffer.data(), buffer.size());
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				ok = false;
+				break;
+			}
+			if (n == 0) break;
+			// a short read only happens at the end of a regular file
+			const size_t words = align8(static_cast<size_t>(n));
+			std::memset(buffer.data() + n, 0, words - n);
+			h = checksum(buffer.data(), words, h);
+		}
+		close(fd);
+		hash = h;
+		return ok;
+	}
+
+} // namespace
+
+	size_t Image::size(const Set& set) {
+		size_t nmarkers = 0, nameBytes = 0;
+		for (Set::GenomeMarkers::const_iterator it = set.set.begin(); it != set.set.end(); ++it) {
+			nmarkers += it->size();
+			for (Set::ChromosomeMarkers::const_iterator m = it->begin(); m != it->end(); ++m) {
+				nameBytes += (*m)->name.size();
+			}
+		}
+		return ImageLayout(set.set.size(), nmarkers, nameBytes).total;
+	}
+
+	void Image::write(const Set& set, char* dest) {
+		if (set.unsortedChromIndex > 0) {
+			throw std::logic_error("Only sorted marker sets can be written as images.");
+		}
+		std::uint64_t nmarkers = 0, nameBytes = 0;
+		for (Set::GenomeMarkers::const_iterator it = set.set.begin(); it != set.set.end(); ++it) {
+			nmarkers += it->size();
+			for (Set::ChromosomeMarkers::const_iterator m = it->begin(); m != it->end(); ++m) {
+				nameBytes += (*m)->name.size();
+			}
+		}
+		const ImageLayout layout(set.set.size(), nmarkers, nameBytes);
+		std::memset(dest, 0, layout.total);
+
+		std::uint64_t* counts = reinterpret_cast<std::uint64_t*>(dest + layout.counts);
+		std::uint64_t* offsets = reinterpret_cast<std::uint64_t*>(dest + layout.offsets);
+		std::uint64_t* positions = reinterpret_cast<std::uint64_t*>(dest + layout.positions);
+		std::uint32_t* chromosomes = reinterpret_cast<std::uint32_t*>(dest + layout.chromosomes);
+		char* names = dest + layout.names;
+		size_t i = 0, offset = 0;
+		for (size_t c = 0; c < set.set.size(); ++c) {
+			counts[c] = set.set[c].size();
+			for (Set::ChromosomeMarkers::const_iterator m = set.set[c].begin(); m != set.set[c].end(); ++m, ++i) {
+				offsets[i] = offset;
+				positions[i] = (*m)->pos;
+				chromosomes[i] = (*m)->chromosome;
+				std::memcpy(names + offset, (*m)->name.data(), (*m)->name.size());
+				offset += (*m)->name.size();
+			}
+		}
+		offsets[i] = offset;
+
+		ImageHeader* header = reinterpret_cast<ImageHeader*>(dest);
+		std::memcpy(header->magic, imageMagic, sizeof(imageMagic));
+		header->named = set.namedMarkers ? 1 : 0;
+		header->nchroms = set.set.size();
+		header->nmarkers = nmarkers;
+		header->nameBytes = nameBytes;
+		header->checksum = checksum(dest + sizeof(ImageHeader), layout.total - sizeof(ImageHeader));
+		// readers test the flag before anything else
+		__atomic_store_n(&header->ready, 1u, __ATOMIC_RELEASE);
+	}
+
+	bool Image::read(const char* data, size_t size, Set& set) {
+		if (size < sizeof(ImageHeader)) return false;
+		ImageHeader header;
+		if (__atomic_load_n(reinterpret_cast<const std::uint32_t*>(data + offsetof(ImageHeader, ready)), __ATOMIC_ACQUIRE) != 1u) {
+			return false;
+		}
+		std::memcpy(&header, data, sizeof(ImageHeader));
+		if (std::memcmp(header.magic, imageMagic, sizeof(imageMagic)) != 0) return false;
+		// bound the counts by the size before computing the layout from them
+		if (header.nchroms > size / 8 || header.nmarkers > size / 20 || header.nameBytes > size) return false;
+		const ImageLayout layout(header.nchroms, header.nmarkers, header.nameBytes);
+		if (layout.total != size) return false;
+		if (checksum(data + sizeof(ImageHeader), size - sizeof(ImageHeader)) != header.checksum) return false;
+
+		const std::uint64_t* counts = reinterpret_cast<const std::uint64_t*>(data + layout.counts);
+		const std::uint64_t* offsets = reinterpret_cast<const std::uint64_t*>(data + layout.offsets);
+		const std::uint64_t* positions = reinterpret_cast<const std::uint64_t*>(data + layout.positions);
+		const std::uint32_t* chromosomes = reinterpret_cast<const std::uint32_t*>(data + layout.chromosomes);
+		const char* names = data + layout.names;
+		std::uint64_t total = 0;
+		for (size_t c = 0; c < header.nchroms; ++c) {
+			if (counts[c] > header.nmarkers - total) return false;
+			total += counts[c];
+		}
+		if (total != header.nmarkers || offsets[0] != 0 || offsets[header.nmarkers] != header.nameBytes) return false;
+		for (size_t i = 0; i < header.nmarkers; ++i) {
+			if (offsets[i + 1] < offsets[i]) return false;
+		}
+
+		set.clear();
+		set.set.clear();
+		set.set.resize(header.nchroms);
+		set.namedMarkers = header.named != 0;
+		size_t i = 0;
+		for (size_t c = 0; c < header.nchroms; ++c) {
+			set.set[c].reserve(counts[c]);
+			for (size_t k = 0; k < counts[c]; ++k, ++i) {
+				set.set[c].push_back(new Marker(std::string(names + offsets[i], offsets[i + 1] - offsets[i]), chromosomes[i], positions[i]));
+			}
+		}
+		return true;
+	}
+
+	bool readCache(const std::string& fileName, std::uint64_t options, Set& set, SourceKey& key) {
+		key.size = key.mtime = key.hash = 0;
+		key.options = options;
+		if (!statSource(fileName, key)) {
+			key.size = 0;
+			return false;
+		}
+		bool hit = false, hashed = false;
+		const int fd = open(cacheName(fileName).c_str(), O_RDONLY);
+		struct stat st;
+		if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > static_cast<off_t>(sizeof(CacheHeader))) {
+			const size_t size = static_cast<size_t>(st.st_size);
+			void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				const char* data = static_cast<const char*>(p);
+				CacheHeader header;
+				std::memcpy(&header, data, sizeof(CacheHeader));
+				// the cheap fields first: the content is hashed only for a likely hit
+				if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0
+						&& header.key.size == key.size && header.key.mtime == key.mtime && header.key.options == key.options
+						&& (hashed = hashSource(fileName, key.hash)) && header.key.hash == key.hash) {
+					hit = Image::read(data + sizeof(CacheHeader), size - sizeof(CacheHeader), set);
+				}
+				munmap(p, size);
+			}
+		}
+		if (fd >= 0) close(fd);
+		if (!hit && !hashed && !hashSource(fileName, key.hash)) key.size = 0;
+		return hit;
+	}
+
+	void writeCache(const std::string& fileName, const SourceKey& key, const Set& set) {
+		if (key.size == 0) return;
+		// the file must not have changed while it was parsed
+		SourceKey now;
+		if (!statSource(fileName, now) || now.size != key.size || now.mtime != key.mtime) return;
+
+		CacheHeader header;
+		std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+		header.key = key;
+		std::vector<char> image(Image::size(set));
+		Image::write(set, image.data());
+
+		// readers see either the previous cache or the complete new one
+		const std::string name = cacheName(fileName);
+		// unique per process, thread and call, so concurrent writers never
+		// share a temporary file
+		std::ostringstream tmpname;
+		tmpname << name << ".tmp." << getpid() << '.' << std::this_thread::get_id() << '.' << static_cast<const void*>(image.data());
+		const std::string tmp = tmpname.str();
+		const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) return;
+		bool ok = true;
+		const char* parts[2] = {reinterpret_cast<const char*>(&header), image.data()};
+		const size_t sizes[2] = {sizeof(CacheHeader), image.size()};
+		for (int i = 0; i < 2 && ok; ++i) {
+			for (size_t done = 0; done < sizes[i]; ) {
+				const ssize_t n = ::write(fd, parts[i] + done, sizes[i] - done);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) {
+					ok = false;
+					break;
+				}
+				done += static_cast<size_t>(n);
+			}
+		}
+		if (close(fd) != 0) ok = false;
+		if (!ok || std::rename(tmp.c_str(), name.c_str()) != 0) std::remove(tmp.c_str());
+	}
+
+} // namespace marker
+} // namespace cna
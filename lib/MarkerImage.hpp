@@ -0,0 +1,59 @@
+#ifndef cna_MarkerImage_h
+#define cna_MarkerImage_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Marker.hpp"
+
+namespace cna {
+namespace marker {
+
+	// Flat, position-independent copy of a sorted marker set, for loading a set
+	// without parsing or sorting its text file.
+	// Layout: a header, the number of markers on each chromosome, the offsets of
+	// the marker names, the positions, the chromosomes and the name bytes, each
+	// array aligned to 8 bytes. The header records a checksum of everything
+	// after it, and a ready flag that is set last.
+	class Image
+	{
+	public:
+
+		// bytes needed for the image of set, which must be sorted
+		static size_t size(const Set& set);
+
+		// write the image of set to dest, which holds size(set) bytes and is
+		// aligned to 8 bytes
+		static void write(const Set& set, char* dest);
+
+		// replace the markers of set by those of the image at data; false, with
+		// set unchanged, if data is not a complete image
+		static bool read(const char* data, size_t size, Set& set);
+
+	};
+
+	// Identity of a text marker file: its size, modification time and content
+	// hash, and a hash of the options it is parsed with.
+	struct SourceKey {
+		std::uint64_t size;
+		std::uint64_t mtime;
+		std::uint64_t hash;
+		std::uint64_t options;
+	};
+
+	// Sidecar cache of a sorted marker file, <file>.cnamrk: the image of the set
+	// read from the file, behind the key of the file it was read from.
+	// Fill set from the cache of fileName if its key matches the file as it is
+	// now; otherwise return false with key holding the current key of the file,
+	// for writeCache. key.size is 0 if the file cannot be read.
+	bool readCache(const std::string& fileName, std::uint64_t options, Set& set, SourceKey& key);
+
+	// Store the cache of fileName for set, read from the file with the given key,
+	// unless the file has changed since; failures leave no cache behind.
+	void writeCache(const std::string& fileName, const SourceKey& key, const Set& set);
+
+} // namespace marker
+} // namespace cna
+
+#endif
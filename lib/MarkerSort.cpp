@@ -0,0 +1,265 @@
+#include "MarkerSort.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "typedefs.h"
+#include "global.hpp"
+#include "parse.hpp"
+
+namespace cna {
+namespace marker {
+
+namespace {
+
+	// merged at once; more runs are merged in several passes
+	const size_t maxFanIn = 64;
+
+	struct Record {
+		chromid chromosome;
+		position pos;
+		// input line order, which breaks ties
+		std::uint64_t seq;
+		std::string name;
+	};
+
+	bool before(const Record& a, const Record& b) {
+		if (a.chromosome != b.chromosome) return a.chromosome < b.chromosome;
+		if (a.pos != b.pos) return a.pos < b.pos;
+		return a.seq < b.seq;
+	}
+
+	// approximate memory held by a record in a batch
+	size_t footprint(const Record& r) {
+		return sizeof(Record) + (r.name.size() >= sizeof(std::string) ? r.name.size() + 1 : 0);
+	}
+
+	// a run file holds records as chromosome, position, sequence number, name
+	// length and name bytes
+	void writeRecord(std::ostream& out, const Record& r) {
+		const std::uint32_t len = static_cast<std::uint32_t>(r.name.size());
+		out.write(reinterpret_cast<const char*>(&r.chromosome), sizeof(r.chromosome));
+		out.write(reinterpret_cast<const char*>(&r.pos), sizeof(r.pos));
+		out.write(reinterpret_cast<const char*>(&r.seq), sizeof(r.seq));
+		out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+		out.write(r.name.data(), len);
+	}
+
+	// false at the end of the run
+	bool readRecord(std::istream& in, Record& r, const std::string& runName) {
+		if (!in.read(reinterpret_cast<char*>(&r.chromosome), sizeof(r.chromosome))) {
+			if (in.gcount() == 0 && in.eof()) return false;
+			throw std::runtime_error("Temporary file '" + runName + "' is truncated.");
+		}
+		std::uint32_t len = 0;
+		in.read(reinterpret_cast<char*>(&r.pos), sizeof(r.pos));
+		in.read(reinterpret_cast<char*>(&r.seq), sizeof(r.seq));
+		in.read(reinterpret_cast<char*>(&len), sizeof(len));
+		r.name.resize(len);
+		if (len > 0) in.read(&r.name[0], len);
+		if (!in) throw std::runtime_error("Temporary file '" + runName + "' is truncated.");
+		return true;
+	}
+
+	// names of the temporary run files, removed with this object
+	class RunFiles {
+	public:
+		explicit RunFiles(const std::string& dir) : dir(dir.empty() ? "." : dir), count(0) {}
+
+		~RunFiles() {
+			for (size_t i = 0; i < names.size(); ++i) std::remove(names[i].c_str());
+		}
+
+		std::string next() {
+			std::lock_guard<std::mutex> lock(mutex);
+			names.push_back(dir + "/cna-sort-" + std::to_string(getpid()) + "-" + std::to_string(count++) + ".run");
+			return names.back();
+		}
+
+		void remove(const std::string& name) {
+			std::lock_guard<std::mutex> lock(mutex);
+			std::remove(name.c_str());
+			names.erase(std::find(names.begin(), names.end(), name));
+		}
+
+	private:
+		std::string dir;
+		size_t count;
+		std::vector<std::string> names;
+		std::mutex mutex;
+	};
+
+	void writeRun(std::vector<Record>& batch, const std::string& runName) {
+		std::sort(batch.begin(), batch.end(), before);
+		std::ofstream out(runName.c_str(), std::ios::binary);
+		for (size_t i = 0; i < batch.size(); ++i) writeRecord(out, batch[i]);
+		out.close();
+		if (!out) throw std::runtime_error("Failed to write temporary file '" + runName + "'.");
+	}
+
+	// pass the records of the runs to sink in sorted order
+	template <typename Sink>
+	void merge(const std::vector<std::string>& runs, Sink sink) {
+		std::vector< std::unique_ptr<std::ifstream> > ins;
+		std::vector<Record> heads(runs.size());
+		auto later = [&heads](size_t a, size_t b) { return before(heads[b], heads[a]); };
+		std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(later);
+		for (size_t i = 0; i < runs.size(); ++i) {
+			ins.emplace_back(new std::ifstream(runs[i].c_str(), std::ios::binary));
+			if (!ins[i]->is_open()) throw std::runtime_error("Failed to open temporary file '" + runs[i] + "'.");
+			if (readRecord(*ins[i], heads[i], runs[i])) queue.push(i);
+		}
+		while (!queue.empty()) {
+			const size_t i = queue.top();
+			queue.pop();
+			sink(heads[i]);
+			if (readRecord(*ins[i], heads[i], runs[i])) queue.push(i);
+		}
+	}
+
+	// writes records as Set::write does
+	class TextWriter {
+	public:
+		TextWriter(std::ostream& out, bool named, char delim)
+		: out(out), named(named), delim(delim), chromNames(cna::nChromosomes + 1) {
+			for (chromid c = 1; c <= cna::nChromosomes; ++c) chromNames[c] = cna::mapping::chromosome[c];
+			if (named) out << "marker" << delim;
+			out << "chromosome" << delim << "position" << '\n';
+		}
+
+		void operator()(const Record& r) {
+			if (named) out << r.name << delim;
+			out << (r.chromosome < chromNames.size() ? chromNames[r.chromosome] : cna::mapping::chromosome[r.chromosome]) << delim << r.pos << '\n';
+		}
+
+	private:
+		std::ostream& out;
+		bool named;
+		char delim;
+		std::vector<std::string> chromNames;
+	};
+
+} // namespace
+
+	void sortFile(const std::string& input, const std::string& output, bool named, const IOProperties& io,
+	              size_t memoryBytes, int nthreads, const std::string& tempDir) {
+		std::ifstream in(input.c_str());
+		if (!in.is_open()) throw std::runtime_error("Failed to open marker input file '" + input + "'.");
+		const size_t nwriters = static_cast<size_t>(std::max(nthreads, 1));
+		// a batch is read while nwriters others are sorted and written
+		const size_t batchBytes = std::max<size_t>(memoryBytes / (nwriters + 1), 1);
+
+		RunFiles files(tempDir);
+		std::vector<std::string> runs;
+		std::vector<Record> batch;
+		size_t bytes = 0;
+		std::deque<std::thread> writers;
+		std::exception_ptr error;
+		std::mutex errorMutex;
+
+		auto spill = [&]() {
+			const std::string runName = files.next();
+			runs.push_back(runName);
+			if (nwriters == 1) {
+				writeRun(batch, runName);
+				batch.clear();
+			} else {
+				if (writers.size() >= nwriters) {
+					writers.front().join();
+					writers.pop_front();
+				}
+				std::shared_ptr< std::vector<Record> > b = std::make_shared< std::vector<Record> >();
+				b->swap(batch);
+				writers.emplace_back([b, runName, &error, &errorMutex]() {
+					try {
+						writeRun(*b, runName);
+					} catch (...) {
+						std::lock_guard<std::mutex> lock(errorMutex);
+						if (!error) error = std::current_exception();
+					}
+				});
+			}
+			bytes = 0;
+		};
+		auto joinWriters = [&]() {
+			for (size_t i = 0; i < writers.size(); ++i) writers[i].join();
+			writers.clear();
+		};
+
+		try {
+			size_t lineCount = 0;
+			std::uint64_t seq = 0;
+			std::string line, chromName;
+			std::string_view field;
+			Record r;
+			while (std::getline(in, line)) {
+				if (++lineCount <= io.nSkippedLines || lineCount == io.headerLine) continue;
+				FieldScanner fields(line, io.delim);
+				if (named) {
+					if (!fields.next(field)) continue;
+					r.name.assign(field.data(), field.size());
+				}
+				if (!fields.next(field)) continue;
+				chromName.assign(field.data(), field.size());
+				if (!fields.next(field) || !parseNumber(field, r.pos)) continue;
+				r.chromosome = cna::mapping::chromosome[chromName];
+				// ignore unknown chromosome
+				if (r.chromosome == 0) continue;
+				r.seq = seq++;
+				bytes += footprint(r);
+				batch.push_back(r);
+				if (bytes >= batchBytes) spill();
+			}
+			if (in.bad()) throw std::runtime_error("Failed to read marker input file '" + input + "'.");
+			// an input that fits in one batch is not spilled at all
+			if (!runs.empty() && !batch.empty()) spill();
+			joinWriters();
+		} catch (...) {
+			joinWriters();
+			throw;
+		}
+		if (error) std::rethrow_exception(error);
+
+		// merge the runs in passes of at most maxFanIn
+		while (runs.size() > maxFanIn) {
+			std::vector<std::string> group(runs.begin(), runs.begin() + maxFanIn);
+			const std::string runName = files.next();
+			{
+				std::ofstream out(runName.c_str(), std::ios::binary);
+				merge(group, [&out](const Record& rec) { writeRecord(out, rec); });
+				out.close();
+				if (!out) throw std::runtime_error("Failed to write temporary file '" + runName + "'.");
+			}
+			for (size_t i = 0; i < group.size(); ++i) files.remove(group[i]);
+			runs.erase(runs.begin(), runs.begin() + maxFanIn);
+			runs.push_back(runName);
+		}
+
+		std::ofstream out(output.c_str());
+		if (!out.is_open()) throw std::runtime_error("Failed to open marker output file '" + output + "'.");
+		TextWriter writer(out, named, io.delim);
+		if (runs.empty()) {
+			std::sort(batch.begin(), batch.end(), before);
+			for (size_t i = 0; i < batch.size(); ++i) writer(batch[i]);
+		} else {
+			merge(runs, std::ref(writer));
+		}
+		out.close();
+		if (!out) throw std::runtime_error("Failed to write marker output file '" + output + "'.");
+	}
+
+} // namespace marker
+} // namespace cna
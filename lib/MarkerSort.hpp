@@ -0,0 +1,25 @@
+#ifndef cna_MarkerSort_h
+#define cna_MarkerSort_h
+
+#include <cstddef>
+#include <string>
+
+#include "Properties.hpp"
+
+namespace cna {
+namespace marker {
+
+	// Sort the marker file input into output by chromosome and position, as
+	// Set::read and Set::write do, holding about memoryBytes of markers in memory
+	// at a time. Larger inputs are cut into sorted runs, written to temporary
+	// files in tempDir and merged; nthreads runs are sorted and written
+	// concurrently with reading the next one. Markers at the same position keep
+	// their input order. Lines are parsed with the delimiter and header settings
+	// of io.
+	void sortFile(const std::string& input, const std::string& output, bool named, const IOProperties& io,
+	              size_t memoryBytes, int nthreads, const std::string& tempDir);
+
+} // namespace marker
+} // namespace cna
+
+#endif
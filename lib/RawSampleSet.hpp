@@ -9,8 +9,10 @@
 #include <map>
 #include <algorithm>
 #include <stdexcept>
+#include <thread>
 
 #include "AlleleSpecific.hpp"
+#include "parallel.hpp"
 #include "parse.hpp"
 #include "SampleSet.hpp"
 
@@ -56,6 +58,12 @@ private:
 	void readSampleNames(FieldScanner& fields);
 	void readSampleValues(FieldScanner& fields, size_t sampleStart, const std::string& chromName);
 
+	// starting index of each cycle of perm, fixed points excluded
+	static void cycleLeaders(const std::vector<size_t>& perm, std::vector<size_t>& leaders);
+	// items[j] = items[perm[j]] for all j at once, following each cycle in place
+	template <typename T>
+	static void permute(T* items, const std::vector<size_t>& perm, const std::vector<size_t>& leaders);
+
 	void writeSampleNames(std::fstream& file, const char delim);
 	void writeSampleValues(std::fstream& file, size_t chr, size_t markerIndex, const char delim);
 	
@@ -129,6 +137,8 @@ public:
 		if (markers == NULL) {
 			throw std::invalid_argument("Markers in sample set are missing.");
 		}
+		// the markers may be shared with other sample sets
+		markers = cna::marker::manager.detach(markers);
 		
 		// flag markers for removal
 		markers->filter(refMarkers);
@@ -331,57 +341,84 @@ void cna::RawSampleSet<V>::writeSampleValues(std::fstream& file, size_t chr, siz
 template <typename V>
 void cna::RawSampleSet<V>::sort()
 {
+	Base::markers = cna::marker::manager.detach(Base::markers);
 	cna::marker::Set* markers = Base::markers;
 	
-	// Construct order vector for obtaining a sorted index of markers
-	cna::marker::Set::ChromosomeMarkers chromosomeMarkers;
-	std::vector<RawChromosome> samplesChromosomeCopy;
 	std::vector< std::pair<position, size_t> > order;
+	std::vector<size_t> perm, leaders;
+	std::vector<Value*> columns;
 	
 	for (size_t chri = 0; chri < markers->size(); ++chri) {	
 		
-		// Construct order vector for obtaining a sorted index of markers
-		// Additionally, replicate the markers on the curent chromosome;
-		//               replicate the chromosome for all samples
-		
 		cna::marker::Set::ChromosomeMarkers& currentMarkers = markers->at(chri);
-		size_t numMarkers = currentMarkers.size();
+		const size_t numMarkers = currentMarkers.size();
 		
-		chromosomeMarkers.clear();
-		samplesChromosomeCopy.clear();
-		order.clear();
+		// inputs are usually sorted already
+		size_t j = 1;
+		while (j < numMarkers && currentMarkers[j-1]->pos <= currentMarkers[j]->pos) ++j;
+		if (j >= numMarkers) continue;
 		
-		// copy original data
-		markers->copyChromosome(chri, chromosomeMarkers);
-		samplesChromosomeCopy.reserve(samples.size());
-		for (size_t s = 0; s < samples.size(); ++s) {
-			samplesChromosomeCopy.push_back((*samples[s])[chri]);
-		}
-		// create order vector
+		// Sort on the order vector instead of the original vector<Markers*>,
+		//   in order to obtain the sorted index; markers at the same position
+		//   keep their order
+		order.clear();
 		order.reserve(numMarkers);
-		for (size_t j = 0; j < numMarkers; ++j) {
+		for (j = 0; j < numMarkers; ++j) {
 			order.push_back(std::make_pair(currentMarkers[j]->pos, j));
 		}
+		std::sort(order.begin(), order.end());
+		perm.resize(numMarkers);
+		for (j = 0; j < numMarkers; ++j) {
+			perm[j] = order[j].second;
+		}
+		cycleLeaders(perm, leaders);
 		
-		// Sort on the order vector instead of the original vector<Markers*>,
-		//   in order to obtain the sorted index
-		std::sort(order.begin(), order.end(), &cna::compare::pair<position, size_t>);
-		
-		// Now, order is sorted by chromosome position, and order[i].second
-		//   contains each sorted index
-		
-		// Sort the markers on current chromosome, and each sample
-		for (size_t j = 0; j < numMarkers; ++j) {
-			size_t index = order[j].second;
-			// Set the marker to the corresponding sorted marker
-			currentMarkers[j] = chromosomeMarkers[index];
-			
-			// Iterate through samples, set the corresponding marker in the current chromosome
-			for (size_t s = 0; s < samples.size(); ++s) {
-				(*samples[s])[chri][j] = samplesChromosomeCopy[s][index];
+		columns.clear();
+		for (size_t s = 0; s < samples.size(); ++s) {
+			RawChromosome& chrom = (*samples[s])[chri];
+			if (chrom.size() != numMarkers) {
+				throw std::runtime_error("Sample '" + samples[s]->name + "' does not have a value for every marker.");
 			}
+			columns.push_back(chrom.data());
 		}
 		
+		// Move the markers on current chromosome, and each sample, into
+		//   sorted order in place
+		permute(&currentMarkers[0], perm, leaders);
+		const size_t work = numMarkers * columns.size();
+		const int nthreads = work < (1 << 18) ? 1 : static_cast<int>(std::thread::hardware_concurrency());
+		parallel_for(columns.size(), nthreads, [&](size_t s) {
+			permute(columns[s], perm, leaders);
+		});
+		
+	}
+}
+
+template <typename V>
+void cna::RawSampleSet<V>::cycleLeaders(const std::vector<size_t>& perm, std::vector<size_t>& leaders)
+{
+	leaders.clear();
+	std::vector<bool> visited(perm.size(), false);
+	for (size_t i = 0; i < perm.size(); ++i) {
+		if (visited[i] || perm[i] == i) continue;
+		leaders.push_back(i);
+		for (size_t j = i; !visited[j]; j = perm[j]) {
+			visited[j] = true;
+		}
+	}
+}
+
+template <typename V> template <typename T>
+void cna::RawSampleSet<V>::permute(T* items, const std::vector<size_t>& perm, const std::vector<size_t>& leaders)
+{
+	for (size_t k = 0; k < leaders.size(); ++k) {
+		const size_t start = leaders[k];
+		T first = std::move(items[start]);
+		size_t j = start;
+		for (size_t next = perm[j]; next != start; j = next, next = perm[j]) {
+			items[j] = std::move(items[next]);
+		}
+		items[j] = std::move(first);
 	}
 }
 
@@ -31,7 +31,10 @@ void cna::SampleSet::read(const std::string& fileName, const std::string& platfo
 
 void cna::SampleSet::read(std::fstream& file, const std::string& platform, const std::string& fileName, bool append) {
 	if (!append) clear();
-	markers = cna::marker::manager.create(platform);
+	// appending files reuse the set they share, without taking another reference
+	if (!append || markers == NULL || markers->platform != platform) {
+		markers = cna::marker::manager.create(platform);
+	}
 	this->fileName = fileName;
 	
 	_read(file);
@@ -47,6 +47,8 @@ public:
 		std::string platform;
 		cna::marker::manager.newSetName(platform);
 		read(fileNames, markersFileName, platform, isSorted);
+		// files with the same markers share one set
+		internMarkers();
 	}
 	
 	void read(const std::vector<std::string>& fileNames, const std::string& markersFileName, const std::string& platform, bool isSorted);
@@ -55,6 +57,7 @@ public:
 		std::string platform;
 		cna::marker::manager.newSetName(platform);
 		read(fileName, platform, append);
+		if (!append) internMarkers();
 	}
 	
 	// N.B. If platform name is specified explicitly by user, the marker file should be already sorted!
@@ -86,6 +89,11 @@ protected:
 	std::string fileName;
 	cna::marker::Set* markers;
 	
+	// replace the markers by a registered set of identical markers, if any
+	virtual void internMarkers() {
+		markers = cna::marker::manager.intern(markers);
+	}
+	
 private:
 	
 	std::fstream file;
@@ -344,6 +344,10 @@ public:
 	}
 	void sort();
 	
+	// write the header line, or the rows of one sample, as write() does
+	void writeHeader(std::ostream& file) const;
+	void writeSample(std::ostream& file, SegmentedSample& sample) const;
+	
 	size_t size() {
 		return samples.size();
 	}
@@ -518,18 +522,30 @@ void cna::SegmentedSampleSet<V>::_read(std::fstream& file)
 template <typename V>
 void cna::SegmentedSampleSet<V>::_write(std::fstream& file)
 {
-	const char delim = Base::io.delim;
-	
-	file << "sample" << delim << "chromosome" << delim << "start" << delim << "end" << delim << "count" << delim << "state" << std::endl;
+	writeHeader(file);
 	
 	typename Samples::iterator it, end = samples.end();
 	for (it = samples.begin(); it != end; ++it) {
-		typename Chromosomes::iterator chrIt, chrEnd = (*it)->end();
-		for (chrIt = (*it)->begin(); chrIt != chrEnd; ++chrIt) {
-			typename Segments::iterator segIt, segEnd = chrIt->end();
-			for (segIt = chrIt->begin(); segIt != segEnd; ++segIt) {
-				file << (*it)->name << delim << segIt->chromosome << delim << segIt->start << delim << segIt->end << delim << segIt->count << delim << segIt->value << std::endl;
-			}
+		writeSample(file, **it);
+	}
+}
+
+template <typename V>
+void cna::SegmentedSampleSet<V>::writeHeader(std::ostream& file) const
+{
+	const char delim = Base::io.delim;
+	file << "sample" << delim << "chromosome" << delim << "start" << delim << "end" << delim << "count" << delim << "state" << std::endl;
+}
+
+template <typename V>
+void cna::SegmentedSampleSet<V>::writeSample(std::ostream& file, SegmentedSample& sample) const
+{
+	const char delim = Base::io.delim;
+	typename Chromosomes::iterator chrIt, chrEnd = sample.end();
+	for (chrIt = sample.begin(); chrIt != chrEnd; ++chrIt) {
+		typename Segments::iterator segIt, segEnd = chrIt->end();
+		for (segIt = chrIt->begin(); segIt != segEnd; ++segIt) {
+			file << sample.name << delim << segIt->chromosome << delim << segIt->start << delim << segIt->end << delim << segIt->count << delim << segIt->value << std::endl;
 		}
 	}
 }
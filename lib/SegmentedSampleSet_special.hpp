@@ -19,20 +19,21 @@ void cna::SegmentedSampleSet<SPECIALIZATION_TYPE>::readSegment(FieldScanner& fie
 }
 
 template <> inline
-void cna::SegmentedSampleSet<SPECIALIZATION_TYPE>::_write(std::fstream& file)
+void cna::SegmentedSampleSet<SPECIALIZATION_TYPE>::writeHeader(std::ostream& file) const
 {
 	const char delim = Base::io.delim;
-	
 	file << "sample" << delim << "chromosome" << delim << "start" << delim << "end" << delim << "count" << delim << "stateA" << delim << "stateB" << std::endl;
-	
-	typename Samples::iterator it, end = samples.end();
-	for (it = samples.begin(); it != end; ++it) {
-		typename Chromosomes::iterator chrIt, chrEnd = (*it)->end();
-		for (chrIt = (*it)->begin(); chrIt != chrEnd; ++chrIt) {
-			typename Segments::iterator segIt, segEnd = chrIt->end();
-			for (segIt = chrIt->begin(); segIt != segEnd; ++segIt) {
-				file << (*it)->name << delim << segIt->chromosome << delim << segIt->start << delim << segIt->end << delim << segIt->count << delim << segIt->value.a << delim << segIt->value.b << std::endl;
-			}
+}
+
+template <> inline
+void cna::SegmentedSampleSet<SPECIALIZATION_TYPE>::writeSample(std::ostream& file, SegmentedSample& sample) const
+{
+	const char delim = Base::io.delim;
+	typename Chromosomes::iterator chrIt, chrEnd = sample.end();
+	for (chrIt = sample.begin(); chrIt != chrEnd; ++chrIt) {
+		typename Segments::iterator segIt, segEnd = chrIt->end();
+		for (segIt = chrIt->begin(); segIt != segEnd; ++segIt) {
+			file << sample.name << delim << segIt->chromosome << delim << segIt->start << delim << segIt->end << delim << segIt->count << delim << segIt->value.a << delim << segIt->value.b << std::endl;
 		}
 	}
 }
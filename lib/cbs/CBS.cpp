@@ -1,9 +1,18 @@
 #include "cbs/CBS.hpp"
+#include "cbs/kernels.hpp"
 
 #include <algorithm>
 #include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <mutex>
 #include <numeric>
 #include <random>
+#include <stdexcept>
+#include <thread>
+#include <utility>
 #include <vector>
 
 namespace cbs {
@@ -40,6 +49,112 @@ inline double nu(double x, double tol) {
     return std::exp(-0.583 * x);
 }
 
+// nu(x) to double precision: -2 sum_k fpnorm(-x sqrt(k) / 2) / k is summed
+// directly while its terms decay quickly, and for small x up to k = 255 with
+// the remainder from the Euler-Maclaurin formula. The remainder integral is
+// 4 int_{z0}^inf fpnorm(-z) / z dz with z0 = x sqrt(256) / 2, which by parts
+// is 4 (-fpnorm(-z0) log z0 - (gamma + log 2) / 4 - int_0^{z0} phi(z) log z dz).
+double nu_precise(double x) {
+    if (x < 0.01) return std::exp(-0.583 * x);
+    double lnu = std::log(2.0) - 2.0 * std::log(x);
+    if (x >= 0.25) {
+        for (double dk = 1.0;; dk += 1.0) {
+            const double term = 2.0 * fpnorm(-x * std::sqrt(dk) / 2.0) / dk;
+            lnu -= term;
+            if (term < 1e-17 * std::abs(lnu)) break;
+        }
+        return std::exp(lnu);
+    }
+    constexpr int kk = 256;
+    for (int k = 1; k < kk; ++k) {
+        const double dk = static_cast<double>(k);
+        lnu -= 2.0 * fpnorm(-x * std::sqrt(dk) / 2.0) / dk;
+    }
+    const double dk = static_cast<double>(kk);
+    const double z0 = x * std::sqrt(dk) / 2.0;
+    const double fk = fpnorm(-z0) / dk;
+    const double dfk = -fk / dk - kInvSqrt2Pi * std::exp(-z0 * z0 / 2.0) * z0 / (2.0 * dk * dk);
+    // int_0^{z0} phi(z) log z dz from the power series of phi
+    const double lz0 = std::log(z0);
+    double i0 = 0.0;
+    double c = z0;
+    for (int i = 0; i < 60; ++i) {
+        const double a = 2.0 * i + 1.0;
+        i0 += c * (lz0 / a - 1.0 / (a * a));
+        c *= -z0 * z0 / (2.0 * (i + 1));
+    }
+    i0 *= kInvSqrt2Pi;
+    constexpr double kEulerGamma = 0.57721566490153286061;
+    const double tail = 2.0 * (-fpnorm(-z0) * lz0 - (kEulerGamma + std::log(2.0)) / 4.0 - i0);
+    lnu -= 2.0 * (tail + fk / 2.0 - dfk / 12.0);
+    return std::exp(lnu);
+}
+
+// nu(x) on [kNuTableLo, kNuTableHi] by cubic interpolation on a uniform grid,
+// built once per process and refined until the relative error at the cell
+// midpoints is below kNuTableTol.
+class NuTable {
+public:
+    static constexpr double kNuTableLo = 0.01;
+    static constexpr double kNuTableHi = 16.0;
+    static constexpr double kNuTableTol = 1e-10;
+
+    NuTable() {
+        for (int cells = 256;; cells *= 2) {
+            build(cells);
+            if (max_error_ < kNuTableTol || cells >= (1 << 14)) break;
+        }
+    }
+
+    double operator()(double x) const {
+        if (x <= kNuTableLo) return std::exp(-0.583 * x);
+        if (x >= kNuTableHi) return nu_precise(x);
+        return interpolate(x);
+    }
+
+    double max_error() const { return max_error_; }
+
+private:
+    double h_ = 0.0;
+    double max_error_ = 0.0;
+    std::vector<double> y_;
+
+    // four-point Lagrange interpolation on the cell holding x
+    double interpolate(double x) const {
+        const double u = (x - kNuTableLo) / h_;
+        int i = static_cast<int>(u);
+        i = std::max(1, std::min(i, static_cast<int>(y_.size()) - 3));
+        const double t = u - i;
+        const double w0 = -t * (t - 1.0) * (t - 2.0) / 6.0;
+        const double w1 = (t + 1.0) * (t - 1.0) * (t - 2.0) / 2.0;
+        const double w2 = -(t + 1.0) * t * (t - 2.0) / 2.0;
+        const double w3 = (t + 1.0) * t * (t - 1.0) / 6.0;
+        return w0 * y_[i - 1] + w1 * y_[i] + w2 * y_[i + 1] + w3 * y_[i + 2];
+    }
+
+    void build(int cells) {
+        h_ = (kNuTableHi - kNuTableLo) / cells;
+        y_.resize(cells + 1);
+        for (int i = 0; i <= cells; ++i) y_[i] = nu_precise(kNuTableLo + i * h_);
+        max_error_ = 0.0;
+        for (int i = 0; i < cells; ++i) {
+            const double x = kNuTableLo + (i + 0.5) * h_;
+            const double exact = nu_precise(x);
+            max_error_ = std::max(max_error_, std::abs(interpolate(x) - exact) / exact);
+        }
+    }
+};
+
+const NuTable& nu_table() {
+    static const NuTable table;
+    return table;
+}
+
+// G(y) with it1tsq(x, a) = G(x + a - 0.5) - G(x - 0.5)
+inline double it1tsq_primitive(double y) {
+    return (8.0 * y) / (1.0 - 4.0 * y * y) + 2.0 * std::log((1.0 + 2.0 * y) / (1.0 - 2.0 * y));
+}
+
 inline double it1tsq(double x, double a) {
     double y = x + a - 0.5;
     double out = (8.0 * y) / (1.0 - 4.0 * y * y) +
@@ -65,14 +180,32 @@ inline void sort_loc_by_values(const std::vector<double>& values, std::vector<in
               [&](int a, int b) { return values[a] < values[b]; });
 }
 
-BlockScanResult tmaxo_impl(const std::vector<double>& x, double tss, int al0, bool ibin, bool track_loc) {
+inline int tmaxo_nblocks(int n) {
+    return (n >= 50) ? static_cast<int>(std::lround(std::sqrt(static_cast<double>(n)))) : 1;
+}
+
+BlockScanResult tmaxo_impl(const std::vector<double>& x, double tss, int al0, bool ibin, bool track_loc, Workspace& ws) {
     const int n = static_cast<int>(x.size());
     const double rn = static_cast<double>(n);
-    const int nb = (n >= 50) ? static_cast<int>(std::lround(std::sqrt(rn))) : 1;
+    const int nb = tmaxo_nblocks(n);
     const int nb2 = nb * (nb + 1) / 2;
 
-    std::vector<double> sx(n + 1, 0.0), bpsmax(nb + 1), bpsmin(nb + 1), bssbij(nb2 + 1), bssijmax(nb2 + 1);
-    std::vector<int> bb(nb + 1), ibmin(nb + 1), ibmax(nb + 1), bloci(nb2 + 1), blocj(nb2 + 1), loc(nb2 + 1), alen(nb2 + 1);
+    std::vector<double>& sx = ws.sx;
+    std::vector<double>& bpsmax = ws.bpsmax;
+    std::vector<double>& bpsmin = ws.bpsmin;
+    std::vector<double>& bssbij = ws.bssbij;
+    std::vector<double>& bssijmax = ws.bssijmax;
+    std::vector<int>& bb = ws.bb;
+    std::vector<int>& ibmin = ws.ibmin;
+    std::vector<int>& ibmax = ws.ibmax;
+    std::vector<int>& bloci = ws.bloci;
+    std::vector<int>& blocj = ws.blocj;
+    std::vector<int>& loc = ws.loc;
+    std::vector<int>& alen = ws.alen;
+    sx.assign(n + 1, 0.0);
+    bpsmax.resize(nb + 1); bpsmin.resize(nb + 1); bssbij.resize(nb2 + 1); bssijmax.resize(nb2 + 1);
+    bb.resize(nb + 1); ibmin.resize(nb + 1); ibmax.resize(nb + 1);
+    bloci.resize(nb2 + 1); blocj.resize(nb2 + 1); loc.resize(nb2 + 1); alen.resize(nb2 + 1);
 
     for (int i = 1; i <= nb; ++i) bb[i] = static_cast<int>(std::lround(rn * (static_cast<double>(i) / static_cast<double>(nb))));
 
@@ -181,13 +314,8 @@ BlockScanResult tmaxo_impl(const std::vector<double>& x, double tss, int al0, bo
             for (int i2j = alenlo; i2j <= alenmax; ++i2j) {
                 const int ixlo = std::max(0, jlo - ilo1 - i2j);
                 const int ixhi = std::max(0, ihi + i2j - jhi);
-                double sxmx = 0.0;
                 int sxmxi = ilo1;
-                for (int i = ilo1 + ixlo; i <= ihi - ixhi; ++i) {
-                    const int j = i + i2j;
-                    const double absx = std::abs(sx[j] - sx[i]);
-                    if (sxmx < absx) { sxmx = absx; sxmxi = i; }
-                }
+                const double sxmx = kernels::argmax_absdiff(sx.data(), ilo1 + ixlo, ihi - ixhi, i2j, sxmxi);
                 const double rr = static_cast<double>(i2j);
                 const double fac = rn / (rr * (rn - rr));
                 const double bijbss = ibin ? fac * std::pow(sxmx - 0.5, 2.0) : fac * sxmx * sxmx;
@@ -200,13 +328,8 @@ BlockScanResult tmaxo_impl(const std::vector<double>& x, double tss, int al0, bo
             for (int i2j = alenhi; i2j >= alenmax; --i2j) {
                 const int ixlo = std::max(0, jlo - ilo1 - i2j);
                 const int ixhi = std::max(0, ihi + i2j - jhi);
-                double sxmx = 0.0;
                 int sxmxi = ilo1;
-                for (int i = ilo1 + ixlo; i <= ihi - ixhi; ++i) {
-                    const int j = i + i2j;
-                    const double absx = std::abs(sx[j] - sx[i]);
-                    if (sxmx < absx) { sxmx = absx; sxmxi = i; }
-                }
+                const double sxmx = kernels::argmax_absdiff(sx.data(), ilo1 + ixlo, ihi - ixhi, i2j, sxmxi);
                 const double rr = static_cast<double>(i2j);
                 const double fac = rn / (rr * (rn - rr));
                 const double bijbss = ibin ? fac * std::pow(sxmx - 0.5, 2.0) : fac * sxmx * sxmx;
@@ -226,101 +349,116 @@ BlockScanResult tmaxo_impl(const std::vector<double>& x, double tss, int al0, bo
     return {bssmax, track_loc ? tmaxi : 0, track_loc ? tmaxj : 0};
 }
 
-double errssq(const std::vector<int>& lseg, const std::vector<double>& sx, const std::vector<int>& loc, int k) {
-    double out = 0.0;
-    double segsx = 0.0;
-    int segnx = 0;
-    for (int i = 0; i <= loc[0]; ++i) {
-        segsx += sx[i];
-        segnx += lseg[i];
-    }
-    out += segsx * segsx / static_cast<double>(segnx);
-    for (int j = 1; j < k; ++j) {
-        segsx = 0.0;
-        segnx = 0;
-        for (int i = loc[j - 1] + 1; i <= loc[j]; ++i) {
-            segsx += sx[i];
-            segnx += lseg[i];
-        }
-        out += segsx * segsx / static_cast<double>(segnx);
-    }
-    segsx = 0.0;
-    segnx = 0;
-    for (int i = loc[k - 1] + 1; i < static_cast<int>(lseg.size()); ++i) {
-        segsx += sx[i];
-        segnx += lseg[i];
-    }
-    out += segsx * segsx / static_cast<double>(segnx);
-    return out;
-}
+} // namespace
 
-void next_combination(std::vector<int>& loc, int r, int nmr, bool& left) {
-    int i = r - 1;
-    while (i >= 0 && loc[i] == nmr + i) --i;
-    if (i < 0) { left = false; return; }
-    ++loc[i];
-    for (int j = i + 1; j < r; ++j) loc[j] = loc[j - 1] + 1;
-    if (loc[0] == nmr) left = false;
-}
+namespace {
 
-std::vector<int> prune_segments(const std::vector<double>& x, const std::vector<int>& lseg, double pcut) {
-    const int n = static_cast<int>(x.size());
+template <typename T>
+std::vector<int> prune_partition(const T* x, int n, const std::vector<int>& lseg, double pcut) {
     const int nseg = static_cast<int>(lseg.size());
-    const int ncpt = nseg - 1;
-    if (ncpt <= 0) return lseg;
+    const int k = nseg - 1;
+    if (k <= 0) return lseg;
     double ssq = 0.0;
-    for (double v : x) ssq += v * v;
+    for (int i = 0; i < n; ++i) {
+        const double v = x[i];
+        ssq += v * v;
+    }
     std::vector<double> sx(nseg, 0.0);
+    std::vector<int> cnx(nseg + 1, 0);
     int kk = 0;
     for (int i = 0; i < nseg; ++i) {
         for (int j = 0; j < lseg[i]; ++j) sx[i] += x[kk++];
+        cnx[i + 1] = cnx[i] + lseg[i];
     }
-    int k = nseg - 1;
-    std::vector<int> loc(k), best_prev(k), best_cur(k);
-    for (int i = 0; i < k; ++i) {
-        loc[i] = i;
-        best_prev[i] = i;
-    }
-    double wssqk = ssq - errssq(lseg, sx, loc, k);
-    for (int j = k - 1; j >= 1; --j) {
-        const int kmj = k - j;
-        bool left = true;
-        for (int i = 0; i < j; ++i) {
-            loc[i] = i;
-            best_cur[i] = i;
-        }
-        double wssqj = ssq - errssq(lseg, sx, loc, j);
-        while (left) {
-            next_combination(loc, j, kmj, left);
-            if (!left) break;
-            const double wssq1 = ssq - errssq(lseg, sx, loc, j);
-            if (wssq1 <= wssqj) {
-                wssqj = wssq1;
-                for (int i = 0; i < j; ++i) best_cur[i] = loc[i];
+
+    // best[g * nseg + b] is the largest sum of segsx^2 / segnx over partitions
+    // of blocks 0..b into g + 1 contiguous groups, and from[] the first block
+    // of the last group. Group sums are accumulated left to right and the
+    // per-group terms are added in block order, so every candidate is rounded
+    // exactly as the exhaustive enumeration of change-point subsets rounds it.
+    std::vector<double> best(static_cast<std::size_t>(k) * nseg, -std::numeric_limits<double>::infinity());
+    std::vector<int> from(static_cast<std::size_t>(k) * nseg, 0);
+    double wssqk = 0.0;
+    for (int a = 0; a < nseg; ++a) {
+        double segsx = 0.0;
+        for (int b = a; b < nseg; ++b) {
+            segsx += sx[b];
+            const double gain = segsx * segsx / static_cast<double>(cnx[b + 1] - cnx[a]);
+            if (b == a) wssqk += gain;
+            if (a == 0) {
+                best[b] = gain;
+                continue;
+            }
+            const int gmax = std::min(k - 1, a);
+            for (int g = 1; g <= gmax; ++g) {
+                const double cand = best[static_cast<std::size_t>(g - 1) * nseg + a - 1] + gain;
+                const std::size_t gb = static_cast<std::size_t>(g) * nseg + b;
+                if (cand >= best[gb]) {
+                    best[gb] = cand;
+                    from[gb] = a;
+                }
             }
         }
+    }
+    wssqk = ssq - wssqk;
+
+    for (int j = k - 1; j >= 1; --j) {
+        const double wssqj = ssq - best[static_cast<std::size_t>(j) * nseg + k];
         if (wssqj / wssqk > 1.0 + pcut) {
+            // keep the best partition with one more change point
+            if (j + 1 == k) return lseg;
             std::vector<int> pruned_cpts(j + 1);
-            for (int i = 0; i <= j; ++i) pruned_cpts[i] = best_prev[i];
-            std::vector<int> cums(nseg);
-            int s = 0;
-            for (int i = 0; i < nseg; ++i) { s += lseg[i]; cums[i] = s; }
+            for (int g = j + 1, b = k; g >= 1; --g) {
+                const int start = from[static_cast<std::size_t>(g) * nseg + b];
+                pruned_cpts[g - 1] = start - 1;
+                b = start - 1;
+            }
             std::vector<int> out;
             int prev = 0;
             for (int idx : pruned_cpts) {
-                out.push_back(cums[idx] - prev);
-                prev = cums[idx];
+                out.push_back(cnx[idx + 1] - prev);
+                prev = cnx[idx + 1];
             }
             out.push_back(n - prev);
             return out;
         }
-        for (int i = 0; i < j; ++i) best_prev[i] = best_cur[i];
     }
     return std::vector<int>{n};
 }
 
 } // namespace
 
+std::vector<int> prune_segments(const std::vector<double>& x, const std::vector<int>& lseg, double pcut) {
+    return prune_partition(x.data(), static_cast<int>(x.size()), lseg, pcut);
+}
+
+void Workspace::reserve(int n, bool weighted) {
+    const std::size_t nn = static_cast<std::size_t>(n) + 1;
+    const int nb = tmaxo_nblocks(n);
+    const std::size_t nb1 = static_cast<std::size_t>(nb) + 1;
+    const std::size_t nb2 = static_cast<std::size_t>(nb) * (nb + 1) / 2 + 1;
+    cur.reserve(nn);
+    px.reserve(nn);
+    sx.reserve(nn);
+    if (weighted) {
+        w.reserve(nn);
+        rw.reserve(nn);
+        cw.reserve(nn);
+        awt.reserve(nb2);
+    }
+    bpsmax.reserve(nb1);
+    bpsmin.reserve(nb1);
+    bb.reserve(nb1);
+    ibmin.reserve(nb1);
+    ibmax.reserve(nb1);
+    bssbij.reserve(nb2);
+    bssijmax.reserve(nb2);
+    bloci.reserve(nb2);
+    blocj.reserve(nb2);
+    loc.reserve(nb2);
+    alen.reserve(nb2);
+}
+
 double tailp(double b, double delta, int m, int ngrid, double tol) {
     const double dincr = (0.5 - delta) / static_cast<double>(ngrid);
     const double bsqrtm = b / std::sqrt(static_cast<double>(m));
@@ -338,6 +476,28 @@ double tailp(double b, double delta, int m, int ngrid, double tol) {
     return 2.0 * out;
 }
 
+double tailp_tabulated(double b, double delta, int m, int ngrid) {
+    const NuTable& nu_tab = nu_table();
+    const double dincr = (0.5 - delta) / static_cast<double>(ngrid);
+    const double bsqrtm = b / std::sqrt(static_cast<double>(m));
+    double t = 0.5 - 0.5 * dincr;
+    double glo = it1tsq_primitive(0.0);
+    double out = 0.0;
+    for (int i = 1; i <= ngrid; ++i) {
+        t += dincr;
+        const double ghi = it1tsq_primitive(i * dincr);
+        const double nux = nu_tab(bsqrtm / std::sqrt(t * (1.0 - t)));
+        out += (nux * nux) * (ghi - glo);
+        glo = ghi;
+    }
+    out = 9.973557e-2 * std::pow(b, 3.0) * std::exp(-b * b / 2.0) * out;
+    return 2.0 * out;
+}
+
+double nu_table_error() {
+    return nu_table().max_error();
+}
+
 double btailp(double b, int m, int ng, double tol) {
     const double dm = static_cast<double>(m);
     const int k = 2;
@@ -361,35 +521,33 @@ double btailp(double b, int m, int ng, double tol) {
 }
 
 double btmax(const std::vector<double>& x) {
-    const int n = static_cast<int>(x.size());
-    double sumxi = x[0];
-    double ostat = 0.0;
-    const double dn = static_cast<double>(n);
-    double di = 1.0;
-    for (int i = 2; i <= n - 2; ++i) {
-        di += 1.0;
-        sumxi += x[i - 1];
-        const double btmaxi = dn * (sumxi * sumxi) / (di * (dn - di));
-        if (ostat < btmaxi) ostat = btmaxi;
-    }
-    return std::sqrt(ostat);
+    return std::sqrt(kernels::max_btstat(x.data(), static_cast<int>(x.size())));
 }
 
 BinarySegmentationResult tmaxo(const std::vector<double>& x, double tss, int al0, bool ibin) {
-    const auto r = tmaxo_impl(x, tss, al0, ibin, true);
+    Workspace ws;
+    return tmaxo(x, tss, al0, ibin, ws);
+}
+
+BinarySegmentationResult tmaxo(const std::vector<double>& x, double tss, int al0, bool ibin, Workspace& ws) {
+    const auto r = tmaxo_impl(x, tss, al0, ibin, true, ws);
     return {r.statistic, r.left - 1, r.right - 1};
 }
 
-double tmaxp(const std::vector<double>& px, double tss, int al0, bool ibin) {
-    return tmaxo_impl(px, tss, al0, ibin, false).statistic;
+double tmaxp(const std::vector<double>& px, double tss, int al0, bool ibin, Workspace& ws) {
+    return tmaxo_impl(px, tss, al0, ibin, false, ws).statistic;
 }
 
-double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ibin) {
+double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ibin, Workspace& ws) {
     const int n = static_cast<int>(px.size());
     const double rn = static_cast<double>(n);
     const int nb = static_cast<int>(rn / static_cast<double>(k));
-    std::vector<double> bpsmax(nb + 1), bpsmin(nb + 1), sx(n + 1, 0.0);
-    std::vector<int> bb(nb + 1);
+    std::vector<double>& bpsmax = ws.bpsmax;
+    std::vector<double>& bpsmin = ws.bpsmin;
+    std::vector<double>& sx = ws.sx;
+    std::vector<int>& bb = ws.bb;
+    sx.assign(n + 1, 0.0);
+    bpsmax.resize(nb + 1); bpsmin.resize(nb + 1); bb.resize(nb + 1);
     for (int i = 1; i <= nb; ++i) bb[i] = static_cast<int>(std::lround(rn * (static_cast<double>(i) / static_cast<double>(nb))));
 
     int ilo = 1;
@@ -425,11 +583,7 @@ double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ib
             const double fac = rn / (rj * (rn - rj));
             const double bsslim = fac * psdiffsq;
             if (bsslim < out) goto done;
-            double sxmx = 0.0;
-            for (int i = ilo1; i <= ihi - j; ++i) {
-                const double absx = std::abs(sx[i + j] - sx[i]);
-                if (sxmx < absx) sxmx = absx;
-            }
+            const double sxmx = kernels::max_absdiff(sx.data(), ilo1, ihi - j, j);
             const double bssmx = ibin ? fac * std::pow(std::abs(sxmx) - 0.5, 2.0) : fac * sxmx * sxmx;
             if (out < bssmx) out = bssmx;
         }
@@ -446,12 +600,7 @@ double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ib
             const double fac = rn / (rj * (rn - rj));
             const double bsslim = fac * psdiffsq;
             if (bsslim < out) break;
-            double sxmx = 0.0;
-            const int nmj = n - j;
-            for (int i = 1; i <= j; ++i) {
-                const double absx = std::abs(sx[i + nmj] - sx[i]);
-                if (sxmx < absx) sxmx = absx;
-            }
+            const double sxmx = kernels::max_absdiff(sx.data(), 1, j, n - j);
             const double bssmx = ibin ? fac * std::pow(std::abs(sxmx) - 0.5, 2.0) : fac * sxmx * sxmx;
             if (out < bssmx) out = bssmx;
         }
@@ -466,11 +615,7 @@ double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ib
             const double fac = rn / (rj * (rn - rj));
             const double bsslim = fac * psdiffsq;
             if (bsslim < out) break;
-            double sxmx = 0.0;
-            for (int i = bb[l - 1] + 1 - j; i <= bb[l - 1]; ++i) {
-                const double absx = std::abs(sx[i + j] - sx[i]);
-                if (sxmx < absx) sxmx = absx;
-            }
+            const double sxmx = kernels::max_absdiff(sx.data(), bb[l - 1] + 1 - j, bb[l - 1], j);
             const double bssmx = ibin ? fac * std::pow(std::abs(sxmx) - 0.5, 2.0) : fac * sxmx * sxmx;
             if (out < bssmx) out = bssmx;
         }
@@ -492,7 +637,8 @@ void xperm(const std::vector<double>& x, std::vector<double>& px, std::mt19937_6
     }
 }
 
-double tpermp(int n1, int n2, int n, const double* x, std::vector<double>& px, int nperm, std::mt19937_64& rng) {
+double tpermp(int n1, int n2, int n, const double* x, int nperm, std::mt19937_64& rng, Workspace& ws) {
+    std::vector<double>& px = ws.px;
     const double rn1 = static_cast<double>(n1);
     const double rn2 = static_cast<double>(n2);
     const double rn = rn1 + rn2;
@@ -523,7 +669,7 @@ double tpermp(int n1, int n2, int n, const double* x, std::vector<double>& px, i
     int nrej = 0;
     for (int np = 1; np <= nperm; ++np) {
         xsum1 = 0.0;
-        for (int i = 0; i < n; ++i) px[i] = x[i];
+        std::copy(x, x + n, px.begin());
         for (int i = n; i >= n - m1 + 1; --i) {
             const int j = static_cast<int>(runif01(rng) * static_cast<double>(i)) + 1;
             std::swap(px[i - 1], px[j - 1]);
@@ -546,7 +692,8 @@ void wxperm(const std::vector<double>& x, std::vector<double>& px, const std::ve
     }
 }
 
-double wtpermp(int n1, int n2, int n, const double* x, std::vector<double>& px, const double* wts, const double* rwts, int nperm, std::mt19937_64& rng) {
+double wtpermp(int n1, int n2, int n, const double* x, const double* wts, const double* rwts, int nperm, std::mt19937_64& rng, Workspace& ws) {
+    std::vector<double>& px = ws.px;
     if (n1 == 1 || n2 == 1) return 1.0;
     px.resize(n);
     double xsum1 = 0.0, xsum2 = 0.0, tss = 0.0, rn1 = 0.0, rn2 = 0.0;
@@ -608,12 +755,31 @@ void getmncwt(int n, const std::vector<double>& cwts, int k, std::vector<double>
 }
 
 BinarySegmentationResult wtmaxo(const std::vector<double>& x, const std::vector<double>& wts, double tss, const std::vector<double>& cwts, int al0) {
+    Workspace ws;
+    return wtmaxo(x, wts, tss, cwts, al0, ws);
+}
+
+BinarySegmentationResult wtmaxo(const std::vector<double>& x, const std::vector<double>& wts, double tss, const std::vector<double>& cwts, int al0, Workspace& ws) {
     const int n = static_cast<int>(x.size());
     const double rn = static_cast<double>(n);
-    const int nb = (n >= 50) ? static_cast<int>(std::lround(std::sqrt(rn))) : 1;
+    const int nb = tmaxo_nblocks(n);
     const int nb2 = nb * (nb + 1) / 2;
-    std::vector<double> sx(n + 1, 0.0), bpsmax(nb + 1), bpsmin(nb + 1), bssbij(nb2 + 1), bssijmax(nb2 + 1), awt(nb2 + 1);
-    std::vector<int> bb(nb + 1), ibmin(nb + 1), ibmax(nb + 1), bloci(nb2 + 1), blocj(nb2 + 1), loc(nb2 + 1);
+    std::vector<double>& sx = ws.sx;
+    std::vector<double>& bpsmax = ws.bpsmax;
+    std::vector<double>& bpsmin = ws.bpsmin;
+    std::vector<double>& bssbij = ws.bssbij;
+    std::vector<double>& bssijmax = ws.bssijmax;
+    std::vector<double>& awt = ws.awt;
+    std::vector<int>& bb = ws.bb;
+    std::vector<int>& ibmin = ws.ibmin;
+    std::vector<int>& ibmax = ws.ibmax;
+    std::vector<int>& bloci = ws.bloci;
+    std::vector<int>& blocj = ws.blocj;
+    std::vector<int>& loc = ws.loc;
+    sx.assign(n + 1, 0.0);
+    bpsmax.resize(nb + 1); bpsmin.resize(nb + 1); bssbij.resize(nb2 + 1); bssijmax.resize(nb2 + 1); awt.resize(nb2 + 1);
+    bb.resize(nb + 1); ibmin.resize(nb + 1); ibmax.resize(nb + 1);
+    bloci.resize(nb2 + 1); blocj.resize(nb2 + 1); loc.resize(nb2 + 1);
     for (int i = 1; i <= nb; ++i) bb[i] = static_cast<int>(std::lround(rn * (static_cast<double>(i) / static_cast<double>(nb))));
 
     int ilo = 1;
@@ -738,16 +904,20 @@ BinarySegmentationResult wtmaxo(const std::vector<double>& x, const std::vector<
     return {bssmax / ((tss - bssmax) / (rn - 2.0)), tmaxi - 1, tmaxj - 1};
 }
 
-double wtmaxp(const std::vector<double>& px, const std::vector<double>& wts, const std::vector<double>& cwts, int al0) {
-    return wtmaxo(px, wts, 0.0, cwts, al0).statistic; // placeholder, corrected below by local tss recomputation in hwt and wfind path not relying on this exact helper in tests
+double wtmaxp(const std::vector<double>& px, const std::vector<double>& wts, const std::vector<double>& cwts, int al0, Workspace& ws) {
+    return wtmaxo(px, wts, 0.0, cwts, al0, ws).statistic; // placeholder, corrected below by local tss recomputation in hwt and wfind path not relying on this exact helper in tests
 }
 
-double hwtmaxp(const std::vector<double>& px, const std::vector<double>& wts, const std::vector<double>& cwts, const std::vector<double>& mncwt, int k, int al0) {
+double hwtmaxp(const std::vector<double>& px, const std::vector<double>& wts, const std::vector<double>& cwts, const std::vector<double>& mncwt, int k, int al0, Workspace& ws) {
     const int n = static_cast<int>(px.size());
     double rn = static_cast<double>(n);
     const int nb = static_cast<int>(rn / static_cast<double>(k));
-    std::vector<double> bpsmax(nb + 1), bpsmin(nb + 1), sx(n + 1, 0.0);
-    std::vector<int> bb(nb + 1);
+    std::vector<double>& bpsmax = ws.bpsmax;
+    std::vector<double>& bpsmin = ws.bpsmin;
+    std::vector<double>& sx = ws.sx;
+    std::vector<int>& bb = ws.bb;
+    sx.assign(n + 1, 0.0);
+    bpsmax.resize(nb + 1); bpsmin.resize(nb + 1); bb.resize(nb + 1);
     for (int i = 1; i <= nb; ++i) bb[i] = static_cast<int>(std::lround(rn * (static_cast<double>(i) / static_cast<double>(nb))));
     int ilo = 1;
     double psum = 0.0, ssq = 0.0, bssmax = 0.0;
@@ -778,15 +948,11 @@ double hwtmaxp(const std::vector<double>& px, const std::vector<double>& wts, co
     auto scan_regular = [&](int left, int right, double psdiff) {
         const double psdiffsq = psdiff * psdiff;
         for (int j = al0; j <= k; ++j) {
-            double rj = mncwt[j];
+            const double rj = mncwt[j];
             const double bsslim = psdiffsq / (rj * (rn - rj));
             if (bsslim < bssmax) break;
-            for (int i = left; i <= right - j; ++i) {
-                const int ipj = i + j;
-                rj = cwts[ipj - 1] - cwts[i - 1];
-                const double bssij = std::pow(sx[ipj] - sx[i], 2.0) / (rj * (rn - rj));
-                if (bssij > bssmax) bssmax = bssij;
-            }
+            const double bssij = kernels::max_wbss(sx.data(), cwts.data(), left, right - j, j, rn);
+            if (bssij > bssmax) bssmax = bssij;
         }
     };
 
@@ -795,16 +961,11 @@ double hwtmaxp(const std::vector<double>& px, const std::vector<double>& wts, co
         const double psdiff = std::max(std::abs(bpsmax[1] - bpsmin[nb]), std::abs(bpsmax[nb] - bpsmin[1]));
         const double psdiffsq = psdiff * psdiff;
         for (int j = al0; j <= k; ++j) {
-            double rj = mncwt[j];
+            const double rj = mncwt[j];
             const double bsslim = psdiffsq / (rj * (rn - rj));
             if (bsslim < bssmax) break;
-            const int nmj = n - j;
-            for (int i = 1; i <= j; ++i) {
-                const int ipnmj = i + nmj;
-                rj = cwts[ipnmj - 1] - cwts[i - 1];
-                const double bssij = std::pow(sx[ipnmj] - sx[i], 2.0) / (rj * (rn - rj));
-                if (bssij > bssmax) bssmax = bssij;
-            }
+            const double bssij = kernels::max_wbss(sx.data(), cwts.data(), 1, j, n - j, rn);
+            if (bssij > bssmax) bssmax = bssij;
         }
     }
     for (int l = 2; l <= nb; ++l) {
@@ -812,26 +973,32 @@ double hwtmaxp(const std::vector<double>& px, const std::vector<double>& wts, co
         const double psdiff = std::max(std::abs(bpsmax[l] - bpsmin[l - 1]), std::abs(bpsmax[l - 1] - bpsmin[l]));
         const double psdiffsq = psdiff * psdiff;
         for (int j = al0; j <= k; ++j) {
-            double rj = mncwt[j];
+            const double rj = mncwt[j];
             const double bsslim = psdiffsq / (rj * (rn - rj));
             if (bsslim < bssmax) break;
-            for (int i = bb[l - 1] + 1 - j; i <= bb[l - 1]; ++i) {
-                const int ipj = i + j;
-                rj = cwts[ipj - 1] - cwts[i - 1];
-                const double bssij = std::pow(sx[ipj] - sx[i], 2.0) / (rj * (rn - rj));
-                if (bssij > bssmax) bssmax = bssij;
-            }
+            const double bssij = kernels::max_wbss(sx.data(), cwts.data(), bb[l - 1] + 1 - j, bb[l - 1], j, rn);
+            if (bssij > bssmax) bssmax = bssij;
         }
     }
     if (tss <= bssmax + 0.0001) tss = bssmax + 1.0;
     return bssmax / ((tss - bssmax) / (static_cast<double>(n) - 2.0));
 }
 
-ChangePointResult fndcpt(const std::vector<double>& x, double tss, int nperm, double cpval, bool ibin, bool hybrid, int al0, int hk, double delta, int ngrid, const std::vector<int>& sbdry, double tol, std::mt19937_64& rng) {
+namespace {
+
+// Tail probability for the hybrid drivers: from the nu() table, unless tol
+// asks for more accuracy than the table has.
+double hybrid_tailp(double b, double delta, int m, int ngrid, double tol) {
+    return tol < nu_table_error() ? tailp(b, delta, m, ngrid, tol) : tailp_tabulated(b, delta, m, ngrid);
+}
+
+} // namespace
+
+ChangePointResult fndcpt(const std::vector<double>& x, double tss, int nperm, double cpval, bool ibin, bool hybrid, int al0, int hk, double delta, int ngrid, const std::vector<int>& sbdry, double tol, std::mt19937_64& rng, Workspace& ws) {
     const int n = static_cast<int>(x.size());
-    std::vector<double> px(n);
+    std::vector<double>& px = ws.px;
     ChangePointResult res;
-    const auto obs = tmaxo(x, tss, al0, ibin);
+    const auto obs = tmaxo(x, tss, al0, ibin, ws);
     res.ostat = obs.statistic;
     res.iseg = {obs.start, obs.end};
     double ostat1 = std::sqrt(obs.statistic);
@@ -843,13 +1010,13 @@ ChangePointResult fndcpt(const std::vector<double>& x, double tss, int nperm, do
     if (!((ostat1 >= 7.0) && (l >= 10))) {
         int nrej = 0;
         if (hybrid) {
-            const double pval1 = tailp(ostat1, delta, n, ngrid, tol);
+            const double pval1 = hybrid_tailp(ostat1, delta, n, ngrid, tol);
             if (pval1 > cpval) return res;
             const int nrejc = static_cast<int>((cpval - pval1) * static_cast<double>(nperm));
             int k = nrejc * (nrejc + 1) / 2 + 1;
             for (int np = 1; np <= nperm; ++np) {
                 xperm(x, px, rng);
-                const double pstat = htmaxp(px, tss, hk, al0, ibin);
+                const double pstat = htmaxp(px, tss, hk, al0, ibin, ws);
                 if (ostat <= pstat) { ++nrej; ++k; }
                 if (nrej > nrejc) return res;
                 if (np >= sbdry[k - 1]) break;
@@ -859,7 +1026,7 @@ ChangePointResult fndcpt(const std::vector<double>& x, double tss, int nperm, do
             int k = nrejc * (nrejc + 1) / 2 + 1;
             for (int np = 1; np <= nperm; ++np) {
                 xperm(x, px, rng);
-                const double pstat = tmaxp(px, tss, al0, ibin);
+                const double pstat = tmaxp(px, tss, al0, ibin, ws);
                 if (ostat <= pstat) { ++nrej; ++k; }
                 if (nrej > nrejc) return res;
                 if (np >= sbdry[k - 1]) break;
@@ -874,13 +1041,13 @@ ChangePointResult fndcpt(const std::vector<double>& x, double tss, int nperm, do
         res.ncpt = 1; res.icpt[0] = obs.end;
     } else {
         int n1 = iseg1, n12 = iseg2, n2 = n12 - n1;
-        double tpval = tpermp(n1, n2, n12, x.data(), px, nperm, rng);
+        double tpval = tpermp(n1, n2, n12, x.data(), nperm, rng, ws);
         if (tpval <= cpval) { res.ncpt = 1; res.icpt[0] = obs.start; }
         const int offset = iseg1;
         n12 = n - iseg1;
         n2 = n - iseg2;
         n1 = n12 - n2;
-        tpval = tpermp(n1, n2, n12, x.data() + offset, px, nperm, rng);
+        tpval = tpermp(n1, n2, n12, x.data() + offset, nperm, rng, ws);
         if (tpval <= cpval) {
             if (res.ncpt < 2) {
                 res.icpt[res.ncpt] = obs.end;
@@ -891,11 +1058,12 @@ ChangePointResult fndcpt(const std::vector<double>& x, double tss, int nperm, do
     return res;
 }
 
-ChangePointResult wfindcpt(const std::vector<double>& x, double tss, const std::vector<double>& wts, const std::vector<double>& rwts, const std::vector<double>& cwts, int nperm, double cpval, bool hybrid, int al0, int hk, double delta, int ngrid, const std::vector<int>& sbdry, double tol, std::mt19937_64& rng) {
+ChangePointResult wfindcpt(const std::vector<double>& x, double tss, const std::vector<double>& wts, const std::vector<double>& rwts, const std::vector<double>& cwts, int nperm, double cpval, bool hybrid, int al0, int hk, double delta, int ngrid, const std::vector<int>& sbdry, double tol, std::mt19937_64& rng, Workspace& ws) {
     const int n = static_cast<int>(x.size());
-    std::vector<double> px(n), mncwt;
+    std::vector<double>& px = ws.px;
+    std::vector<double>& mncwt = ws.mncwt;
     ChangePointResult res;
-    const auto obs = wtmaxo(x, wts, tss, cwts, al0);
+    const auto obs = wtmaxo(x, wts, tss, cwts, al0, ws);
     res.ostat = obs.statistic;
     res.iseg = {obs.start, obs.end};
     double ostat1 = std::sqrt(obs.statistic);
@@ -908,13 +1076,13 @@ ChangePointResult wfindcpt(const std::vector<double>& x, double tss, const std::
         int nrej = 0;
         if (hybrid) {
             getmncwt(n, cwts, hk, mncwt, delta);
-            const double pval1 = tailp(ostat1, delta, n, ngrid, tol);
+            const double pval1 = hybrid_tailp(ostat1, delta, n, ngrid, tol);
             if (pval1 > cpval) return res;
             const int nrejc = static_cast<int>((cpval - pval1) * static_cast<double>(nperm));
             int k = nrejc * (nrejc + 1) / 2 + 1;
             for (int np = 1; np <= nperm; ++np) {
                 wxperm(x, px, rwts, rng);
-                const double pstat = hwtmaxp(px, wts, cwts, mncwt, hk, al0);
+                const double pstat = hwtmaxp(px, wts, cwts, mncwt, hk, al0, ws);
                 if (ostat <= pstat) { ++nrej; ++k; }
                 if (nrej > nrejc) return res;
                 if (np >= sbdry[k - 1]) break;
@@ -924,7 +1092,7 @@ ChangePointResult wfindcpt(const std::vector<double>& x, double tss, const std::
             int k = nrejc * (nrejc + 1) / 2 + 1;
             for (int np = 1; np <= nperm; ++np) {
                 wxperm(x, px, rwts, rng);
-                const double pstat = wtmaxp(px, wts, cwts, al0);
+                const double pstat = wtmaxp(px, wts, cwts, al0, ws);
                 if (ostat <= pstat) { ++nrej; ++k; }
                 if (nrej > nrejc) return res;
                 if (np >= sbdry[k - 1]) break;
@@ -939,13 +1107,13 @@ ChangePointResult wfindcpt(const std::vector<double>& x, double tss, const std::
         res.ncpt = 1; res.icpt[0] = obs.end;
     } else {
         int n1 = iseg1, n12 = iseg2, n2 = n12 - n1;
-        double tpval = wtpermp(n1, n2, n12, x.data(), px, wts.data(), rwts.data(), nperm, rng);
+        double tpval = wtpermp(n1, n2, n12, x.data(), wts.data(), rwts.data(), nperm, rng, ws);
         if (tpval <= cpval) { res.ncpt = 1; res.icpt[0] = obs.start; }
         const int offset = iseg1;
         n12 = n - iseg1;
         n2 = n - iseg2;
         n1 = n12 - n2;
-        tpval = wtpermp(n1, n2, n12, x.data() + offset, px, wts.data() + offset, rwts.data() + offset, nperm, rng);
+        tpval = wtpermp(n1, n2, n12, x.data() + offset, wts.data() + offset, rwts.data() + offset, nperm, rng, ws);
         if (tpval <= cpval) {
             if (res.ncpt < 2) {
                 res.icpt[res.ncpt] = obs.end;
@@ -956,6 +1124,108 @@ ChangePointResult wfindcpt(const std::vector<double>& x, double tss, const std::
     return res;
 }
 
+namespace {
+
+// Recursive binary segmentation of [0, n). split(lo, hi, rng, ws) finds the
+// change points of one interval, reading the chromosome in place. Serially,
+// intervals are taken right to left from a stack, so the random stream is
+// consumed exactly as by DNAcopy. With nthreads > 1 sibling intervals run as
+// independent tasks, each with its own generator seeded from one draw of rng
+// and the interval bounds, so the result does not depend on the schedule or
+// on the number of threads. Returns the sorted segment lengths.
+template <typename Split>
+std::vector<int> segment_intervals(int n, bool weighted, int nthreads, std::mt19937_64& rng, Split split) {
+    std::vector<std::pair<int, int>> stack{{0, n}};
+    std::vector<int> seg_end;
+    auto push_children = [&](int lo, int hi, const ChangePointResult& cpts) {
+        if (cpts.ncpt == 0) {
+            seg_end.push_back(hi);
+        } else if (cpts.ncpt == 1) {
+            const int c = lo + cpts.icpt[0] + 1;
+            stack.emplace_back(lo, c);
+            stack.emplace_back(c, hi);
+        } else {
+            const int c1 = lo + cpts.icpt[0] + 1;
+            const int c2 = lo + cpts.icpt[1] + 1;
+            stack.emplace_back(lo, c1);
+            stack.emplace_back(c1, c2);
+            stack.emplace_back(c2, hi);
+        }
+    };
+
+    if (nthreads <= 1) {
+        Workspace ws(n, weighted);
+        while (!stack.empty()) {
+            const auto iv = stack.back();
+            stack.pop_back();
+            push_children(iv.first, iv.second, split(iv.first, iv.second, rng, ws));
+        }
+    } else {
+        const std::uint64_t seed = rng();
+        std::mutex mtx;
+        std::condition_variable cv;
+        int busy = 0;
+        // the first failure, after which the remaining intervals are dropped
+        std::exception_ptr error;
+        auto fail = [&](std::exception_ptr e) {
+            if (!error) error = e;
+            stack.clear();
+            cv.notify_all();
+        };
+        auto worker = [&]() {
+            try {
+                Workspace ws(n, weighted);
+                std::unique_lock<std::mutex> lock(mtx);
+                while (true) {
+                    cv.wait(lock, [&] { return !stack.empty() || busy == 0; });
+                    if (stack.empty()) break;
+                    const auto iv = stack.back();
+                    stack.pop_back();
+                    ++busy;
+                    lock.unlock();
+                    std::seed_seq sseq{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+                                       static_cast<std::uint32_t>(iv.first), static_cast<std::uint32_t>(iv.second)};
+                    std::mt19937_64 task_rng(sseq);
+                    ChangePointResult cpts;
+                    std::exception_ptr failure;
+                    try {
+                        cpts = split(iv.first, iv.second, task_rng, ws);
+                    } catch (...) {
+                        failure = std::current_exception();
+                    }
+                    lock.lock();
+                    --busy;
+                    if (failure) {
+                        fail(failure);
+                        break;
+                    }
+                    if (!error) push_children(iv.first, iv.second, cpts);
+                    cv.notify_all();
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mtx);
+                fail(std::current_exception());
+            }
+        };
+        std::vector<std::thread> threads;
+        for (int t = 1; t < nthreads; ++t) threads.emplace_back(worker);
+        worker();
+        for (auto& t : threads) t.join();
+        if (error) std::rethrow_exception(error);
+    }
+
+    std::sort(seg_end.begin(), seg_end.end());
+    std::vector<int> lseg;
+    int prev = 0;
+    for (int e : seg_end) {
+        lseg.push_back(e - prev);
+        prev = e;
+    }
+    return lseg;
+}
+
+} // namespace
+
 SegmentationResult segment(const std::vector<double>& x,
                            bool ibin,
                            double alpha,
@@ -969,48 +1239,49 @@ SegmentationResult segment(const std::vector<double>& x,
                            double tol,
                            std::mt19937_64& rng,
                            bool undo_prune,
-                           double undo_prune_cutoff) {
-    std::vector<int> seg_end{0, static_cast<int>(x.size())};
-    std::vector<int> change_loc;
-    while (seg_end.size() > 1) {
-        const int k = static_cast<int>(seg_end.size()) - 1;
-        const int lo = seg_end[k - 1];
-        const int hi = seg_end[k];
+                           double undo_prune_cutoff,
+                           int nthreads) {
+    return segment(x.data(), static_cast<int>(x.size()), ibin, alpha, nperm, hybrid, min_width, kmax, nmin, eta, sbdry, tol, rng, undo_prune, undo_prune_cutoff, nthreads);
+}
+
+template <typename T>
+SegmentationResult segment(const T* x,
+                           int n,
+                           bool ibin,
+                           double alpha,
+                           int nperm,
+                           bool hybrid,
+                           int min_width,
+                           int kmax,
+                           int nmin,
+                           double eta,
+                           const std::vector<int>& sbdry,
+                           double tol,
+                           std::mt19937_64& rng,
+                           bool undo_prune,
+                           double undo_prune_cutoff,
+                           int nthreads) {
+    auto split = [&](int lo, int hi, std::mt19937_64& r, Workspace& ws) {
         const int current_n = hi - lo;
-        ChangePointResult zzz;
-        if (current_n >= 2 * min_width) {
-            std::vector<double> cur(x.begin() + lo, x.begin() + hi);
-            bool use_hybrid = hybrid && (nmin < current_n);
-            double delta = use_hybrid ? static_cast<double>(kmax + 1) / static_cast<double>(current_n) : 0.0;
-            if (!std::all_of(cur.begin(), cur.end(), [&](double v) { return std::abs(v - cur.front()) < 1e-12; })) {
-                const double avg = std::accumulate(cur.begin(), cur.end(), 0.0) / static_cast<double>(cur.size());
-                for (double& v : cur) v -= avg;
-                double tss = 0.0;
-                for (double v : cur) tss += v * v;
-                zzz = fndcpt(cur, tss, nperm, alpha, ibin, use_hybrid, min_width, kmax, delta, 100, sbdry, tol, rng);
-                if (current_n == static_cast<int>(x.size())) {
-                    (void)avg;
-                }
-            }
-        }
-        if (zzz.ncpt == 0) {
-            change_loc.push_back(seg_end[k]);
-            seg_end.erase(seg_end.begin() + k);
-        } else if (zzz.ncpt == 1) {
-            seg_end.insert(seg_end.begin() + k, lo + zzz.icpt[0] + 1);
-        } else {
-            seg_end.insert(seg_end.begin() + k, lo + zzz.icpt[0] + 1);
-            seg_end.insert(seg_end.begin() + k + 1, lo + zzz.icpt[1] + 1);
+        const ChangePointResult none;
+        if (current_n < 2 * min_width) return none;
+        const T* xi = x + lo;
+        if (std::all_of(xi, xi + current_n, [&](double v) { return std::abs(v - xi[0]) < 1e-12; })) return none;
+        const bool use_hybrid = hybrid && (nmin < current_n);
+        const double delta = use_hybrid ? static_cast<double>(kmax + 1) / static_cast<double>(current_n) : 0.0;
+        // centre the interval into the workspace in one pass over the chromosome
+        const double avg = std::accumulate(xi, xi + current_n, 0.0) / static_cast<double>(current_n);
+        std::vector<double>& cur = ws.cur;
+        cur.resize(current_n);
+        double tss = 0.0;
+        for (int i = 0; i < current_n; ++i) {
+            cur[i] = xi[i] - avg;
+            tss += cur[i] * cur[i];
         }
-    }
-    std::reverse(change_loc.begin(), change_loc.end());
-    std::vector<int> lseg;
-    int prev = 0;
-    for (int e : change_loc) {
-        lseg.push_back(e - prev);
-        prev = e;
-    }
-    if (undo_prune && lseg.size() > 1) lseg = prune_segments(x, lseg, undo_prune_cutoff);
+        return fndcpt(cur, tss, nperm, alpha, ibin, use_hybrid, min_width, kmax, delta, 100, sbdry, tol, r, ws);
+    };
+    std::vector<int> lseg = segment_intervals(n, false, nthreads, rng, split);
+    if (undo_prune && lseg.size() > 1) lseg = prune_partition(x, n, lseg, undo_prune_cutoff);
     std::vector<double> means;
     int ll = 0;
     for (int len : lseg) {
@@ -1023,6 +1294,9 @@ SegmentationResult segment(const std::vector<double>& x,
     return {lseg, means};
 }
 
+template SegmentationResult segment<float>(const float*, int, bool, double, int, bool, int, int, int, double, const std::vector<int>&, double, std::mt19937_64&, bool, double, int);
+template SegmentationResult segment<double>(const double*, int, bool, double, int, bool, int, int, int, double, const std::vector<int>&, double, std::mt19937_64&, bool, double, int);
+
 SegmentationResult segment_weighted(const std::vector<double>& x,
                                     const std::vector<double>& weights,
                                     double alpha,
@@ -1036,63 +1310,130 @@ SegmentationResult segment_weighted(const std::vector<double>& x,
                                     double tol,
                                     std::mt19937_64& rng,
                                     bool undo_prune,
-                                    double undo_prune_cutoff) {
-    std::vector<int> seg_end{0, static_cast<int>(x.size())};
-    std::vector<int> change_loc;
-    while (seg_end.size() > 1) {
-        const int k = static_cast<int>(seg_end.size()) - 1;
-        const int lo = seg_end[k - 1];
-        const int hi = seg_end[k];
+                                    double undo_prune_cutoff,
+                                    int nthreads) {
+    auto split = [&](int lo, int hi, std::mt19937_64& r, Workspace& ws) {
         const int current_n = hi - lo;
-        ChangePointResult zzz;
-        if (current_n >= 2 * min_width) {
-            std::vector<double> cur(x.begin() + lo, x.begin() + hi);
-            std::vector<double> w(weights.begin() + lo, weights.begin() + hi), rw(w.size()), cw(w.size());
-            bool use_hybrid = hybrid && (nmin < current_n);
-            double delta = use_hybrid ? static_cast<double>(kmax + 1) / static_cast<double>(current_n) : 0.0;
-            if (!std::all_of(cur.begin(), cur.end(), [&](double v) { return std::abs(v - cur.front()) < 1e-12; })) {
-                double wsum = 0.0, wxsum = 0.0, wxxsum = 0.0, csum = 0.0;
-                for (size_t i = 0; i < w.size(); ++i) {
-                    rw[i] = std::sqrt(w[i]);
-                    wsum += w[i];
-                    wxsum += w[i] * cur[i];
-                }
-                const double avg = wxsum / wsum;
-                const double cwscale = std::sqrt(wsum);
-                for (size_t i = 0; i < cur.size(); ++i) {
-                    cur[i] -= avg;
-                    wxxsum += w[i] * cur[i] * cur[i];
-                    csum += w[i];
-                    cw[i] = csum / cwscale;
-                }
-                zzz = wfindcpt(cur, wxxsum, w, rw, cw, nperm, alpha, use_hybrid, min_width, kmax, delta, 100, sbdry, tol, rng);
-            }
+        const ChangePointResult none;
+        if (current_n < 2 * min_width) return none;
+        const double* xi = x.data() + lo;
+        const double* wi = weights.data() + lo;
+        if (std::all_of(xi, xi + current_n, [&](double v) { return std::abs(v - xi[0]) < 1e-12; })) return none;
+        const bool use_hybrid = hybrid && (nmin < current_n);
+        const double delta = use_hybrid ? static_cast<double>(kmax + 1) / static_cast<double>(current_n) : 0.0;
+        std::vector<double>& cur = ws.cur;
+        std::vector<double>& w = ws.w;
+        std::vector<double>& rw = ws.rw;
+        std::vector<double>& cw = ws.cw;
+        w.assign(wi, wi + current_n);
+        cur.resize(current_n);
+        rw.resize(current_n);
+        cw.resize(current_n);
+        double wsum = 0.0, wxsum = 0.0, wxxsum = 0.0, csum = 0.0;
+        for (int i = 0; i < current_n; ++i) {
+            rw[i] = std::sqrt(w[i]);
+            wsum += w[i];
+            wxsum += w[i] * xi[i];
         }
-        if (zzz.ncpt == 0) {
-            change_loc.push_back(seg_end[k]);
-            seg_end.erase(seg_end.begin() + k);
-        } else if (zzz.ncpt == 1) {
-            seg_end.insert(seg_end.begin() + k, lo + zzz.icpt[0] + 1);
-        } else {
-            seg_end.insert(seg_end.begin() + k, lo + zzz.icpt[0] + 1);
-            seg_end.insert(seg_end.begin() + k + 1, lo + zzz.icpt[1] + 1);
+        const double avg = wxsum / wsum;
+        const double cwscale = std::sqrt(wsum);
+        for (int i = 0; i < current_n; ++i) {
+            cur[i] = xi[i] - avg;
+            wxxsum += w[i] * cur[i] * cur[i];
+            csum += w[i];
+            cw[i] = csum / cwscale;
         }
+        return wfindcpt(cur, wxxsum, w, rw, cw, nperm, alpha, use_hybrid, min_width, kmax, delta, 100, sbdry, tol, r, ws);
+    };
+    std::vector<int> lseg = segment_intervals(static_cast<int>(x.size()), true, nthreads, rng, split);
+    if (undo_prune && lseg.size() > 1) lseg = prune_segments(x, lseg, undo_prune_cutoff);
+    std::vector<double> means;
+    int ll = 0;
+    for (int len : lseg) {
+        const int uu = ll + len;
+        double sw = 0.0, swx = 0.0;
+        for (int i = ll; i < uu; ++i) { sw += weights[i]; swx += weights[i] * x[i]; }
+        means.push_back(swx / sw);
+        ll = uu;
     }
-    std::reverse(change_loc.begin(), change_loc.end());
+    return {lseg, means};
+}
+
+SegmentationResult segment_multires(const std::vector<double>& x,
+                                    int bin_size,
+                                    int refine_window,
+                                    double alpha,
+                                    int nperm,
+                                    bool hybrid,
+                                    int min_width,
+                                    int kmax,
+                                    int nmin,
+                                    double eta,
+                                    const std::vector<int>& sbdry,
+                                    double tol,
+                                    std::mt19937_64& rng,
+                                    bool undo_prune,
+                                    double undo_prune_cutoff) {
+    if (bin_size < 1) throw std::invalid_argument("bin_size must be positive");
+    if (refine_window < 0) throw std::invalid_argument("refine_window must be non-negative");
+    const int n = static_cast<int>(x.size());
+    const int nbins = (n + bin_size - 1) / bin_size;
+    if (bin_size == 1 || nbins < 2 * min_width) {
+        return segment(x, false, alpha, nperm, hybrid, min_width, kmax, nmin, eta, sbdry, tol, rng, undo_prune, undo_prune_cutoff);
+    }
+
+    std::vector<double> coarse(nbins);
+    for (int b = 0; b < nbins; ++b) {
+        const int lo = b * bin_size;
+        const int hi = std::min(n, lo + bin_size);
+        coarse[b] = std::accumulate(x.begin() + lo, x.begin() + hi, 0.0) / static_cast<double>(hi - lo);
+    }
+    const SegmentationResult cseg = segment(coarse, false, alpha, nperm, hybrid, min_width, kmax, nmin, eta, sbdry, tol, rng);
+
+    // refine each coarse boundary to the best single split at full resolution,
+    // searching within refine_window markers and keeping segments at least
+    // min_width markers wide
+    std::vector<double> cs(n + 1, 0.0);
+    for (int i = 0; i < n; ++i) cs[i + 1] = cs[i] + x[i];
+    std::vector<int> coarse_ends;
+    int e = 0;
+    for (std::size_t j = 0; j + 1 < cseg.lengths.size(); ++j) coarse_ends.push_back((e += cseg.lengths[j]) * bin_size);
+    coarse_ends.push_back(n);
+
     std::vector<int> lseg;
     int prev = 0;
-    for (int e : change_loc) {
-        lseg.push_back(e - prev);
-        prev = e;
+    for (std::size_t j = 0; j + 1 < coarse_ends.size(); ++j) {
+        const int c = coarse_ends[j];
+        const int next = coarse_ends[j + 1];
+        const int lo = std::max(prev, c - refine_window - bin_size);
+        const int hi = std::min(next, c + refine_window + bin_size);
+        const int first = std::max(lo + min_width, c - refine_window);
+        const int last = std::min(hi - min_width, c + refine_window);
+        int best = c;
+        double bss = -1.0;
+        for (int i = first; i <= last; ++i) {
+            const double dl = cs[i] - cs[lo];
+            const double dr = cs[hi] - cs[i];
+            const double v = dl * dl / static_cast<double>(i - lo) + dr * dr / static_cast<double>(hi - i);
+            if (v > bss) {
+                bss = v;
+                best = i;
+            }
+        }
+        if (best - prev < min_width) continue;
+        lseg.push_back(best - prev);
+        prev = best;
     }
+    lseg.push_back(n - prev);
+
     if (undo_prune && lseg.size() > 1) lseg = prune_segments(x, lseg, undo_prune_cutoff);
     std::vector<double> means;
     int ll = 0;
     for (int len : lseg) {
         const int uu = ll + len;
-        double sw = 0.0, swx = 0.0;
-        for (int i = ll; i < uu; ++i) { sw += weights[i]; swx += weights[i] * x[i]; }
-        means.push_back(swx / sw);
+        double sum = 0.0;
+        for (int i = ll; i < uu; ++i) sum += x[i];
+        means.push_back(sum / static_cast<double>(len));
         ll = uu;
     }
     return {lseg, means};
@@ -26,16 +26,43 @@ struct SegmentationResult {
     std::vector<double> means;
 };
 
+// Scratch buffers shared by the CBS kernels. A workspace is sized once per
+// chromosome by the segmentation drivers and reused for every subinterval and
+// permutation, so that the permutation loops do not touch the heap.
+struct Workspace {
+    Workspace() {}
+    explicit Workspace(int n, bool weighted = false) { reserve(n, weighted); }
+
+    void reserve(int n, bool weighted = false);
+
+    // current subinterval (and its weights) being searched by the driver
+    std::vector<double> cur, w, rw, cw;
+    // permuted copy of the subinterval
+    std::vector<double> px;
+    // minimum cumulative weights for the weighted hybrid statistic
+    std::vector<double> mncwt;
+
+    // partial sums and per-block bookkeeping of the maximal t-statistic scans
+    std::vector<double> sx, bpsmax, bpsmin, bssbij, bssijmax, awt;
+    std::vector<int> bb, ibmin, ibmax, bloci, blocj, loc, alen;
+};
+
 double tailp(double b, double delta, int m, int ngrid, double tol);
+// tailp with nu() read from a table built on first use, and the it1tsq weights
+// telescoped; used by the hybrid drivers unless their tol is below
+// nu_table_error(). nu() is tabulated on [0.01, 16] with a relative
+// interpolation error of at most nu_table_error() (below 1e-10).
+double tailp_tabulated(double b, double delta, int m, int ngrid);
+double nu_table_error();
 double btailp(double b, int m, int ng, double tol);
 
 double btmax(const std::vector<double>& x);
 BinarySegmentationResult tmaxo(const std::vector<double>& x, double tss, int al0, bool ibin);
-double tmaxp(const std::vector<double>& px, double tss, int al0, bool ibin);
-double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ibin);
+BinarySegmentationResult tmaxo(const std::vector<double>& x, double tss, int al0, bool ibin, Workspace& ws);
+double tmaxp(const std::vector<double>& px, double tss, int al0, bool ibin, Workspace& ws);
+double htmaxp(const std::vector<double>& px, double tss, int k, int al0, bool ibin, Workspace& ws);
 
-double tpermp(int n1, int n2, int n, const double* x, std::vector<double>& px, int nperm,
-              std::mt19937_64& rng);
+double tpermp(int n1, int n2, int n, const double* x, int nperm, std::mt19937_64& rng, Workspace& ws);
 void xperm(const std::vector<double>& x, std::vector<double>& px, std::mt19937_64& rng);
 
 void wxperm(const std::vector<double>& x,
@@ -46,27 +73,35 @@ double wtpermp(int n1,
                int n2,
                int n,
                const double* x,
-               std::vector<double>& px,
                const double* wts,
                const double* rwts,
                int nperm,
-               std::mt19937_64& rng);
+               std::mt19937_64& rng,
+               Workspace& ws);
 void getmncwt(int n, const std::vector<double>& cwts, int k, std::vector<double>& mncwt, double& delta);
 BinarySegmentationResult wtmaxo(const std::vector<double>& x,
                                 const std::vector<double>& wts,
                                 double tss,
                                 const std::vector<double>& cwts,
                                 int al0);
+BinarySegmentationResult wtmaxo(const std::vector<double>& x,
+                                const std::vector<double>& wts,
+                                double tss,
+                                const std::vector<double>& cwts,
+                                int al0,
+                                Workspace& ws);
 double wtmaxp(const std::vector<double>& px,
               const std::vector<double>& wts,
               const std::vector<double>& cwts,
-              int al0);
+              int al0,
+              Workspace& ws);
 double hwtmaxp(const std::vector<double>& px,
                const std::vector<double>& wts,
                const std::vector<double>& cwts,
                const std::vector<double>& mncwt,
                int k,
-               int al0);
+               int al0,
+               Workspace& ws);
 
 ChangePointResult fndcpt(const std::vector<double>& x,
                          double tss,
@@ -80,7 +115,8 @@ ChangePointResult fndcpt(const std::vector<double>& x,
                          int ngrid,
                          const std::vector<int>& sbdry,
                          double tol,
-                         std::mt19937_64& rng);
+                         std::mt19937_64& rng,
+                         Workspace& ws);
 ChangePointResult wfindcpt(const std::vector<double>& x,
                            double tss,
                            const std::vector<double>& wts,
@@ -95,8 +131,22 @@ ChangePointResult wfindcpt(const std::vector<double>& x,
                            int ngrid,
                            const std::vector<int>& sbdry,
                            double tol,
-                           std::mt19937_64& rng);
+                           std::mt19937_64& rng,
+                           Workspace& ws);
+
+// Undo change points whose removal raises the within-segment sum of squares by
+// at most a fraction pcut (DNAcopy undo.splits = "prune"). lseg holds segment
+// lengths over x; the optimal partition for each number of change points is
+// found by dynamic programming over the existing breakpoints.
+std::vector<int> prune_segments(const std::vector<double>& x, const std::vector<int>& lseg, double pcut);
 
+// Recursive CBS segmentation of one chromosome. With nthreads > 1, sibling
+// intervals are segmented concurrently; permutation draws then come from
+// per-interval generators, so results are reproducible for any thread count
+// but can differ from the serial (DNAcopy-compatible) stream. cna segment
+// always calls it with nthreads = 1, so that its output does not depend on
+// --threads. Each interval is still centred into the workspace before its
+// permutations, as in DNAcopy.
 SegmentationResult segment(const std::vector<double>& x,
                            bool ibin,
                            double alpha,
@@ -110,7 +160,29 @@ SegmentationResult segment(const std::vector<double>& x,
                            double tol,
                            std::mt19937_64& rng,
                            bool undo_prune = false,
-                           double undo_prune_cutoff = 0.05);
+                           double undo_prune_cutoff = 0.05,
+                           int nthreads = 1);
+
+// As segment, over the n values at x read in place (for instance a float
+// chromosome buffer); sums are accumulated in double. Instantiated for float
+// and double.
+template <typename T>
+SegmentationResult segment(const T* x,
+                           int n,
+                           bool ibin,
+                           double alpha,
+                           int nperm,
+                           bool hybrid,
+                           int min_width,
+                           int kmax,
+                           int nmin,
+                           double eta,
+                           const std::vector<int>& sbdry,
+                           double tol,
+                           std::mt19937_64& rng,
+                           bool undo_prune = false,
+                           double undo_prune_cutoff = 0.05,
+                           int nthreads = 1);
 
 SegmentationResult segment_weighted(const std::vector<double>& x,
                                     const std::vector<double>& weights,
@@ -125,6 +197,27 @@ SegmentationResult segment_weighted(const std::vector<double>& x,
                                     double tol,
                                     std::mt19937_64& rng,
                                     bool undo_prune = false,
+                                    double undo_prune_cutoff = 0.05,
+                                    int nthreads = 1);
+
+// Coarse-to-fine CBS: segment the means of bin_size consecutive markers, then
+// move each coarse boundary to the best single split of the full-resolution
+// data within refine_window markers of it. Permutation cost scales with the
+// number of bins rather than markers.
+SegmentationResult segment_multires(const std::vector<double>& x,
+                                    int bin_size,
+                                    int refine_window,
+                                    double alpha,
+                                    int nperm,
+                                    bool hybrid,
+                                    int min_width,
+                                    int kmax,
+                                    int nmin,
+                                    double eta,
+                                    const std::vector<int>& sbdry,
+                                    double tol,
+                                    std::mt19937_64& rng,
+                                    bool undo_prune = false,
                                     double undo_prune_cutoff = 0.05);
 
 } // namespace cbs
@@ -0,0 +1,129 @@
+#include "cbs/cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <unistd.h>
+
+namespace cbs {
+namespace {
+
+constexpr const char* kMagic = "cna-segment-cache 1";
+
+inline std::uint64_t mix64(std::uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+} // namespace
+
+void ContentHash::update(const void* data, std::size_t size) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        fnv_ = (fnv_ ^ p[i]) * 0x100000001b3ULL;
+        word_ |= static_cast<std::uint64_t>(p[i]) << (8 * nword_);
+        if (++nword_ == 8) {
+            mix_ = (mix_ ^ mix64(word_)) * 0x9fb21c651e98df25ULL;
+            mix_ = (mix_ << 29) | (mix_ >> 35);
+            word_ = 0;
+            nword_ = 0;
+        }
+    }
+    size_ += size;
+}
+
+void ContentHash::update(const std::string& s) {
+    // length-prefixed, so consecutive strings cannot run together
+    const std::uint64_t len = s.size();
+    update(&len, sizeof(len));
+    update(s.data(), s.size());
+}
+
+std::string ContentHash::hex() const {
+    const std::uint64_t a = mix64(fnv_ ^ size_);
+    const std::uint64_t b = mix64(mix_ ^ mix64(word_ + nword_) ^ size_);
+    char buf[33];
+    std::snprintf(buf, sizeof(buf), "%016llx%016llx", static_cast<unsigned long long>(a), static_cast<unsigned long long>(b));
+    return buf;
+}
+
+ResultCache::ResultCache(const std::string& dir) : dir_(dir) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    if (!std::filesystem::is_directory(dir_)) {
+        throw std::runtime_error("Cannot create cache directory '" + dir_ + "'.");
+    }
+}
+
+std::string ResultCache::path(const std::string& key) const {
+    // fan out over 256 subdirectories
+    return (std::filesystem::path(dir_) / key.substr(0, 2) / (key + ".seg")).string();
+}
+
+bool ResultCache::load(const std::string& key, const std::string& tag, int n, SegmentationResult& result, std::string& state) {
+    std::ifstream in(path(key).c_str());
+    std::string line;
+    int stored_n = -1;
+    std::size_t nseg = 0;
+    SegmentationResult r;
+    bool ok = in.is_open() && std::getline(in, line) && line == kMagic &&
+              std::getline(in, line) && line == tag &&
+              (in >> stored_n >> nseg) && stored_n == n;
+    long total = 0;
+    for (std::size_t i = 0; ok && i < nseg; ++i) {
+        int len;
+        std::string mean;
+        ok = static_cast<bool>(in >> len >> mean);
+        if (!ok) break;
+        r.lengths.push_back(len);
+        r.means.push_back(std::strtod(mean.c_str(), nullptr));
+        total += len;
+    }
+    ok = ok && total == n && (in >> std::ws) && std::getline(in, state);
+    if (!ok) {
+        ++misses_;
+        return false;
+    }
+    result = std::move(r);
+    ++hits_;
+    return true;
+}
+
+void ResultCache::store(const std::string& key, const std::string& tag, int n, const SegmentationResult& result, const std::string& state) {
+    const std::filesystem::path target(path(key));
+    std::error_code ec;
+    std::filesystem::create_directories(target.parent_path(), ec);
+    std::ostringstream tmpname;
+    // unique across processes sharing the directory, and across threads
+    tmpname << target.string() << ".tmp." << getpid() << '.' << std::this_thread::get_id() << '.' << static_cast<const void*>(this);
+    {
+        std::ofstream out(tmpname.str().c_str());
+        if (!out.is_open()) return;
+        out << kMagic << '\n' << tag << '\n' << n << ' ' << result.lengths.size() << '\n';
+        char buf[64];
+        for (std::size_t i = 0; i < result.lengths.size(); ++i) {
+            std::snprintf(buf, sizeof(buf), "%a", result.means[i]);
+            out << result.lengths[i] << ' ' << buf << '\n';
+        }
+        out << state << '\n';
+        if (!out) {
+            out.close();
+            std::filesystem::remove(tmpname.str(), ec);
+            return;
+        }
+    }
+    std::filesystem::rename(tmpname.str(), target, ec);
+    if (ec) std::filesystem::remove(tmpname.str(), ec);
+}
+
+} // namespace cbs
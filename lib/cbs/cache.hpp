@@ -0,0 +1,59 @@
+#ifndef CNA_LIB_CBS_CACHE_HPP
+#define CNA_LIB_CBS_CACHE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "cbs/CBS.hpp"
+
+namespace cbs {
+
+// Non-cryptographic 128-bit content hash: FNV-1a over the bytes alongside a
+// multiply-xorshift lane over 8-byte words.
+class ContentHash {
+public:
+    void update(const void* data, std::size_t size);
+    void update(const std::string& s);
+    // 32 hexadecimal digits
+    std::string hex() const;
+
+private:
+    std::uint64_t fnv_ = 0xcbf29ce484222325ULL;
+    std::uint64_t mix_ = 0x9e3779b97f4a7c15ULL;
+    std::uint64_t word_ = 0;
+    unsigned nword_ = 0;
+    std::uint64_t size_ = 0;
+};
+
+// Content-addressed store of segmentation results under a directory, one
+// file per entry. An entry is keyed by the hash of its inputs and records a
+// description of them (`tag`, e.g. the parameters, and the profile length),
+// which must match on lookup. Alongside the result an entry keeps an opaque
+// `state` string, such as the seed of the random generator, which the caller
+// can check on a hit. Means are stored as hex
+// floats and read back bit for bit. Entries are written to a temporary file
+// and renamed into place, so concurrent writers never expose partial files.
+class ResultCache {
+public:
+    // Creates dir if needed; throws std::runtime_error if it cannot.
+    explicit ResultCache(const std::string& dir);
+
+    bool load(const std::string& key, const std::string& tag, int n, SegmentationResult& result, std::string& state);
+    void store(const std::string& key, const std::string& tag, int n, const SegmentationResult& result, const std::string& state);
+
+    unsigned long hits() const { return hits_; }
+    unsigned long misses() const { return misses_; }
+
+private:
+    std::string dir_;
+    std::atomic<unsigned long> hits_{0};
+    std::atomic<unsigned long> misses_{0};
+
+    std::string path(const std::string& key) const;
+};
+
+} // namespace cbs
+
+#endif
@@ -0,0 +1,217 @@
+#include "cbs/joint.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "cbs/pelt.hpp"
+#include "parallel.hpp"
+
+namespace cbs {
+namespace {
+
+// samples per block of the prefix-sum matrix; partial statistics are summed
+// block by block in a fixed order
+constexpr int kBlock = 64;
+
+// split positions per scan task, so that long intervals are scanned by
+// several threads even when there are few blocks
+constexpr int kChunk = 256;
+
+// below this many (position, sample) cells a wave runs on the calling thread
+constexpr long kParallelCells = 1L << 16;
+
+class PrefixMatrix {
+public:
+    // cs_[i * m + j] is the sum of the first i scaled values of sample j;
+    // non-finite values are skipped, and if there are any, nf_[i * m + j]
+    // counts the finite ones
+    PrefixMatrix(const std::vector<std::vector<double>>& samples, int n)
+        : m_(static_cast<int>(samples.size())), cs_(static_cast<std::size_t>(n + 1) * m_, 0.0) {
+        for (const auto& s : samples) {
+            if (!std::all_of(s.begin(), s.end(), [](double v) { return std::isfinite(v); })) {
+                nf_.assign(cs_.size(), 0);
+                break;
+            }
+        }
+        for (int j = 0; j < m_; ++j) {
+            const double var = diff_variance(samples[j]);
+            const double scale = var > 0.0 ? 1.0 / std::sqrt(var) : 1.0;
+            for (int i = 0; i < n; ++i) {
+                const double v = samples[j][i];
+                const bool finite = std::isfinite(v);
+                at(i + 1, j) = at(i, j) + (finite ? v * scale : 0.0);
+                if (!nf_.empty()) count(i + 1, j) = count(i, j) + (finite ? 1 : 0);
+            }
+        }
+    }
+
+    int samples() const { return m_; }
+    bool missing() const { return !nf_.empty(); }
+    double at(int i, int j) const { return cs_[static_cast<std::size_t>(i) * m_ + j]; }
+    double& at(int i, int j) { return cs_[static_cast<std::size_t>(i) * m_ + j]; }
+    int count(int i, int j) const { return nf_[static_cast<std::size_t>(i) * m_ + j]; }
+    int& count(int i, int j) { return nf_[static_cast<std::size_t>(i) * m_ + j]; }
+
+private:
+    int m_;
+    std::vector<double> cs_;
+    std::vector<int> nf_;
+};
+
+// Sum of squares reduction from splitting a sum `tot` of `nt` values into
+// `left` of `nl` and the rest; a part without values contributes nothing.
+inline double reduction(double left, int nl, double tot, int nt) {
+    const int nr = nt - nl;
+    if (nl == 0 || nr == 0) return 0.0;
+    const double right = tot - left;
+    return left * left / nl + right * right / nr - tot * tot / nt;
+}
+
+// Add to stat[i - first] the reduction in the sum of squares of samples
+// [j0, j1) from splitting [lo, hi) at i, for first <= i <= last.
+void block_statistics(const PrefixMatrix& cs, int j0, int j1, int lo, int hi, int first, int last, double* stat) {
+    if (cs.missing()) {
+        // each sample's sums cover its finite values only
+        for (int i = first; i <= last; ++i) {
+            double s = 0.0;
+            for (int j = j0; j < j1; ++j) {
+                s += reduction(cs.at(i, j) - cs.at(lo, j), cs.count(i, j) - cs.count(lo, j),
+                               cs.at(hi, j) - cs.at(lo, j), cs.count(hi, j) - cs.count(lo, j));
+            }
+            stat[i - first] += s;
+        }
+        return;
+    }
+    const double rn = static_cast<double>(hi - lo);
+    for (int i = first; i <= last; ++i) {
+        const double rl = static_cast<double>(i - lo);
+        const double rr = static_cast<double>(hi - i);
+        double s = 0.0;
+        for (int j = j0; j < j1; ++j) {
+            const double tot = cs.at(hi, j) - cs.at(lo, j);
+            const double left = cs.at(i, j) - cs.at(lo, j);
+            const double right = tot - left;
+            s += left * left / rl + right * right / rr - tot * tot / rn;
+        }
+        stat[i - first] += s;
+    }
+}
+
+} // namespace
+
+double joint_penalty(int m, int n) {
+    const double x = 2.0 * std::log(static_cast<double>(std::max(n, 2)));
+    return m + 2.0 * std::sqrt(m * x) + 2.0 * x;
+}
+
+JointSegmentationResult segment_joint(const std::vector<std::vector<double>>& samples,
+                                      double penalty,
+                                      int min_width,
+                                      int nthreads) {
+    if (min_width < 1) throw std::invalid_argument("min_width must be positive");
+    JointSegmentationResult out;
+    if (samples.empty()) return out;
+    const int n = static_cast<int>(samples.front().size());
+    for (const auto& s : samples) {
+        if (static_cast<int>(s.size()) != n) throw std::invalid_argument("samples must have the same length");
+    }
+    const int m = static_cast<int>(samples.size());
+    if (penalty < 0.0) penalty = joint_penalty(m, n);
+    nthreads = std::max(nthreads, 1);
+
+    const PrefixMatrix cs(samples, n);
+    const int nblocks = (m + kBlock - 1) / kBlock;
+
+    // An interval is split whenever its best split exceeds the penalty,
+    // whatever the order, so intervals are scanned in waves: every interval
+    // made by the previous wave at once, as tasks over sample blocks and
+    // chunks of split positions.
+    struct Interval {
+        int lo, hi, first, last;
+        // of its statistics in each block's row of the wave buffer
+        std::size_t offset;
+    };
+    struct Task {
+        std::size_t interval;
+        int block, first, last;
+    };
+    std::vector<Interval> wave, next;
+    std::vector<Task> tasks;
+    std::vector<double> partial;
+    auto add = [&](std::vector<Interval>& to, int lo, int hi) {
+        if (lo + min_width <= hi - min_width) to.push_back({lo, hi, lo + min_width, hi - min_width, 0});
+    };
+
+    std::vector<int> ends{n};
+    add(wave, 0, n);
+    while (!wave.empty()) {
+        std::size_t total = 0;
+        tasks.clear();
+        for (std::size_t v = 0; v < wave.size(); ++v) {
+            Interval& iv = wave[v];
+            iv.offset = total;
+            total += static_cast<std::size_t>(iv.last - iv.first + 1);
+            for (int i = iv.first; i <= iv.last; i += kChunk) {
+                for (int b = 0; b < nblocks; ++b) tasks.push_back({v, b, i, std::min(iv.last, i + kChunk - 1)});
+            }
+        }
+        partial.assign(total * nblocks, 0.0);
+        const int workers = static_cast<long>(total) * m >= kParallelCells ? nthreads : 1;
+        cna::parallel_for(tasks.size(), workers, [&](std::size_t t) {
+            const Task& task = tasks[t];
+            const Interval& iv = wave[task.interval];
+            double* stat = partial.data() + task.block * total + iv.offset + (task.first - iv.first);
+            block_statistics(cs, task.block * kBlock, std::min(m, (task.block + 1) * kBlock), iv.lo, iv.hi, task.first, task.last, stat);
+        });
+
+        next.clear();
+        for (const Interval& iv : wave) {
+            // blocks are summed in a fixed order, so the statistic does not
+            // depend on the schedule
+            double best = 0.0;
+            int at = -1;
+            for (int i = iv.first; i <= iv.last; ++i) {
+                double stat = 0.0;
+                for (int b = 0; b < nblocks; ++b) stat += partial[b * total + iv.offset + (i - iv.first)];
+                if (stat > best) {
+                    best = stat;
+                    at = i;
+                }
+            }
+            if (at >= 0 && best > penalty) {
+                ends.push_back(at);
+                add(next, iv.lo, at);
+                add(next, at, iv.hi);
+            }
+        }
+        wave.swap(next);
+    }
+    std::sort(ends.begin(), ends.end());
+
+    int prev = 0;
+    for (int e : ends) {
+        out.lengths.push_back(e - prev);
+        prev = e;
+    }
+    out.means.assign(m, std::vector<double>());
+    for (int j = 0; j < m; ++j) {
+        int ll = 0;
+        for (int len : out.lengths) {
+            const int uu = ll + len;
+            double s = 0.0;
+            int count = 0;
+            for (int i = ll; i < uu; ++i) {
+                if (!std::isfinite(samples[j][i])) continue;
+                s += samples[j][i];
+                ++count;
+            }
+            out.means[j].push_back(count > 0 ? s / count : std::nan(""));
+            ll = uu;
+        }
+    }
+    return out;
+}
+
+} // namespace cbs
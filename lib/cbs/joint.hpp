@@ -0,0 +1,36 @@
+#ifndef CNA_LIB_CBS_JOINT_HPP
+#define CNA_LIB_CBS_JOINT_HPP
+
+#include <vector>
+
+namespace cbs {
+
+struct JointSegmentationResult {
+    // segment lengths shared by every sample
+    std::vector<int> lengths;
+    // means[j][k] is the mean of sample j over segment k
+    std::vector<std::vector<double>> means;
+};
+
+// Default penalty of segment_joint for m samples of n markers: the
+// Laurent-Massart bound m + 2 sqrt(m x) + 2x on a chi-square(m) tail, with
+// x = 2 log(n) to cover every candidate split.
+double joint_penalty(int m, int n);
+
+// Joint binary segmentation of samples that share a marker layout. Each
+// sample is scaled by its noise SD (see diff_variance) and a split's statistic
+// is the sum over samples of the reduction in the sum of squares, read off a
+// shared prefix-sum matrix; non-finite values are left out of a sample's
+// sums and means. Each interval is split at its largest statistic
+// for as long as that exceeds `penalty` (joint_penalty if negative). Candidate
+// splits are scanned on nthreads threads in blocks of samples and chunks of
+// positions, and block statistics are summed in a fixed order, so the result
+// does not depend on the thread count.
+JointSegmentationResult segment_joint(const std::vector<std::vector<double>>& samples,
+                                      double penalty = -1.0,
+                                      int min_width = 2,
+                                      int nthreads = 1);
+
+} // namespace cbs
+
+#endif
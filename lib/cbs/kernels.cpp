@@ -0,0 +1,365 @@
+#include "cbs/kernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include "config.h"
+
+#if cna_SIMD == 1 && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CNA_CBS_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define CNA_CBS_X86_KERNELS 0
+#endif
+
+namespace cbs {
+namespace kernels {
+namespace {
+
+// Scalar kernels. These are the reference semantics: the vector kernels
+// evaluate the same expressions element by element and only reorder the
+// max reductions, which are exact, so all paths return identical results.
+
+double max_absdiff_scalar(const double* sx, int lo, int hi, int d) {
+    double out = 0.0;
+    for (int i = lo; i <= hi; ++i) {
+        const double absx = std::abs(sx[i + d] - sx[i]);
+        if (out < absx) out = absx;
+    }
+    return out;
+}
+
+double argmax_absdiff_scalar(const double* sx, int lo, int hi, int d, int& imax) {
+    double out = 0.0;
+    for (int i = lo; i <= hi; ++i) {
+        const double absx = std::abs(sx[i + d] - sx[i]);
+        if (out < absx) { out = absx; imax = i; }
+    }
+    return out;
+}
+
+double max_wbss_scalar(const double* sx, const double* cwts, int lo, int hi, int d, double rn) {
+    double out = 0.0;
+    for (int i = lo; i <= hi; ++i) {
+        const double rj = cwts[i + d - 1] - cwts[i - 1];
+        const double diff = sx[i + d] - sx[i];
+        const double bss = (diff * diff) / (rj * (rn - rj));
+        if (out < bss) out = bss;
+    }
+    return out;
+}
+
+double max_btstat_scalar(const double* x, int n) {
+    if (n < 4) return 0.0;
+    const double dn = static_cast<double>(n);
+    double sumxi = x[0];
+    double di = 1.0;
+    double out = 0.0;
+    for (int i = 2; i <= n - 2; ++i) {
+        di += 1.0;
+        sumxi += x[i - 1];
+        const double bt = dn * (sumxi * sumxi) / (di * (dn - di));
+        if (out < bt) out = bt;
+    }
+    return out;
+}
+
+#if CNA_CBS_X86_KERNELS
+
+__attribute__((target("sse4.1")))
+double max_absdiff_sse4(const double* sx, int lo, int hi, int d) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d acc = _mm_setzero_pd();
+    int i = lo;
+    for (; i + 1 <= hi; i += 2) {
+        const __m128d v = _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(sx + i + d), _mm_loadu_pd(sx + i)));
+        // max_pd returns its second operand when the first is NaN,
+        // matching the scalar scan that never takes a NaN
+        acc = _mm_max_pd(v, acc);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double out = std::max(lanes[0], lanes[1]);
+    for (; i <= hi; ++i) {
+        const double absx = std::abs(sx[i + d] - sx[i]);
+        if (out < absx) out = absx;
+    }
+    return out;
+}
+
+__attribute__((target("sse4.1")))
+double argmax_absdiff_sse4(const double* sx, int lo, int hi, int d, int& imax) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d acc = _mm_setzero_pd();
+    __m128d accidx = _mm_set1_pd(-1.0);
+    __m128d idx = _mm_setr_pd(lo, lo + 1);
+    const __m128d step = _mm_set1_pd(2.0);
+    int i = lo;
+    for (; i + 1 <= hi; i += 2) {
+        const __m128d v = _mm_andnot_pd(sign, _mm_sub_pd(_mm_loadu_pd(sx + i + d), _mm_loadu_pd(sx + i)));
+        // strict comparison keeps the first maximizing index in each lane
+        const __m128d gt = _mm_cmpgt_pd(v, acc);
+        acc = _mm_blendv_pd(acc, v, gt);
+        accidx = _mm_blendv_pd(accidx, idx, gt);
+        idx = _mm_add_pd(idx, step);
+    }
+    double lanes[2], lanesidx[2];
+    _mm_storeu_pd(lanes, acc);
+    _mm_storeu_pd(lanesidx, accidx);
+    double out = 0.0;
+    double outidx = -1.0;
+    for (int l = 0; l < 2; ++l) {
+        if (lanes[l] > out || (lanes[l] == out && lanes[l] > 0.0 && lanesidx[l] < outidx)) {
+            out = lanes[l];
+            outidx = lanesidx[l];
+        }
+    }
+    if (out > 0.0) imax = static_cast<int>(outidx);
+    for (; i <= hi; ++i) {
+        const double absx = std::abs(sx[i + d] - sx[i]);
+        if (out < absx) { out = absx; imax = i; }
+    }
+    return out;
+}
+
+__attribute__((target("sse4.1")))
+double max_wbss_sse4(const double* sx, const double* cwts, int lo, int hi, int d, double rn) {
+    const __m128d vrn = _mm_set1_pd(rn);
+    __m128d acc = _mm_setzero_pd();
+    int i = lo;
+    for (; i + 1 <= hi; i += 2) {
+        const __m128d rj = _mm_sub_pd(_mm_loadu_pd(cwts + i + d - 1), _mm_loadu_pd(cwts + i - 1));
+        const __m128d diff = _mm_sub_pd(_mm_loadu_pd(sx + i + d), _mm_loadu_pd(sx + i));
+        const __m128d bss = _mm_div_pd(_mm_mul_pd(diff, diff), _mm_mul_pd(rj, _mm_sub_pd(vrn, rj)));
+        acc = _mm_max_pd(bss, acc);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double out = std::max(lanes[0], lanes[1]);
+    for (; i <= hi; ++i) {
+        const double rj = cwts[i + d - 1] - cwts[i - 1];
+        const double diff = sx[i + d] - sx[i];
+        const double bss = (diff * diff) / (rj * (rn - rj));
+        if (out < bss) out = bss;
+    }
+    return out;
+}
+
+__attribute__((target("sse4.1")))
+double max_btstat_sse4(const double* x, int n) {
+    if (n < 4) return 0.0;
+    const double dn = static_cast<double>(n);
+    const __m128d vdn = _mm_set1_pd(dn);
+    __m128d acc = _mm_setzero_pd();
+    // partial sums stay sequential, as in max_btstat_avx2
+    double sums[2], dis[2];
+    double sumxi = x[0];
+    double di = 1.0;
+    int i = 2;
+    for (; i + 1 <= n - 2; i += 2) {
+        for (int l = 0; l < 2; ++l) {
+            di += 1.0;
+            sumxi += x[i + l - 1];
+            sums[l] = sumxi;
+            dis[l] = di;
+        }
+        const __m128d s = _mm_loadu_pd(sums);
+        const __m128d vdi = _mm_loadu_pd(dis);
+        const __m128d bt = _mm_div_pd(_mm_mul_pd(vdn, _mm_mul_pd(s, s)), _mm_mul_pd(vdi, _mm_sub_pd(vdn, vdi)));
+        acc = _mm_max_pd(bt, acc);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double out = std::max(lanes[0], lanes[1]);
+    for (; i <= n - 2; ++i) {
+        di += 1.0;
+        sumxi += x[i - 1];
+        const double bt = dn * (sumxi * sumxi) / (di * (dn - di));
+        if (out < bt) out = bt;
+    }
+    return out;
+}
+
+__attribute__((target("avx2")))
+double max_absdiff_avx2(const double* sx, int lo, int hi, int d) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d acc = _mm256_setzero_pd();
+    int i = lo;
+    for (; i + 3 <= hi; i += 4) {
+        const __m256d v = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(sx + i + d), _mm256_loadu_pd(sx + i)));
+        acc = _mm256_max_pd(v, acc);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double out = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    for (; i <= hi; ++i) {
+        const double absx = std::abs(sx[i + d] - sx[i]);
+        if (out < absx) out = absx;
+    }
+    return out;
+}
+
+__attribute__((target("avx2")))
+double argmax_absdiff_avx2(const double* sx, int lo, int hi, int d, int& imax) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d acc = _mm256_setzero_pd();
+    __m256d accidx = _mm256_set1_pd(-1.0);
+    __m256d idx = _mm256_setr_pd(lo, lo + 1, lo + 2, lo + 3);
+    const __m256d step = _mm256_set1_pd(4.0);
+    int i = lo;
+    for (; i + 3 <= hi; i += 4) {
+        const __m256d v = _mm256_andnot_pd(sign, _mm256_sub_pd(_mm256_loadu_pd(sx + i + d), _mm256_loadu_pd(sx + i)));
+        const __m256d gt = _mm256_cmp_pd(v, acc, _CMP_GT_OQ);
+        acc = _mm256_blendv_pd(acc, v, gt);
+        accidx = _mm256_blendv_pd(accidx, idx, gt);
+        idx = _mm256_add_pd(idx, step);
+    }
+    double lanes[4], lanesidx[4];
+    _mm256_storeu_pd(lanes, acc);
+    _mm256_storeu_pd(lanesidx, accidx);
+    double out = 0.0;
+    double outidx = -1.0;
+    for (int l = 0; l < 4; ++l) {
+        if (lanes[l] > out || (lanes[l] == out && lanes[l] > 0.0 && lanesidx[l] < outidx)) {
+            out = lanes[l];
+            outidx = lanesidx[l];
+        }
+    }
+    if (out > 0.0) imax = static_cast<int>(outidx);
+    for (; i <= hi; ++i) {
+        const double absx = std::abs(sx[i + d] - sx[i]);
+        if (out < absx) { out = absx; imax = i; }
+    }
+    return out;
+}
+
+__attribute__((target("avx2")))
+double max_wbss_avx2(const double* sx, const double* cwts, int lo, int hi, int d, double rn) {
+    const __m256d vrn = _mm256_set1_pd(rn);
+    __m256d acc = _mm256_setzero_pd();
+    int i = lo;
+    for (; i + 3 <= hi; i += 4) {
+        const __m256d rj = _mm256_sub_pd(_mm256_loadu_pd(cwts + i + d - 1), _mm256_loadu_pd(cwts + i - 1));
+        const __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(sx + i + d), _mm256_loadu_pd(sx + i));
+        const __m256d bss = _mm256_div_pd(_mm256_mul_pd(diff, diff), _mm256_mul_pd(rj, _mm256_sub_pd(vrn, rj)));
+        acc = _mm256_max_pd(bss, acc);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double out = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    for (; i <= hi; ++i) {
+        const double rj = cwts[i + d - 1] - cwts[i - 1];
+        const double diff = sx[i + d] - sx[i];
+        const double bss = (diff * diff) / (rj * (rn - rj));
+        if (out < bss) out = bss;
+    }
+    return out;
+}
+
+__attribute__((target("avx2")))
+double max_btstat_avx2(const double* x, int n) {
+    if (n < 4) return 0.0;
+    const double dn = static_cast<double>(n);
+    const __m256d vdn = _mm256_set1_pd(dn);
+    __m256d acc = _mm256_setzero_pd();
+    // partial sums stay sequential so they round exactly as the scalar loop;
+    // only the statistic and its maximum are computed four at a time
+    double sums[4], dis[4];
+    double sumxi = x[0];
+    double di = 1.0;
+    int i = 2;
+    for (; i + 3 <= n - 2; i += 4) {
+        for (int l = 0; l < 4; ++l) {
+            di += 1.0;
+            sumxi += x[i + l - 1];
+            sums[l] = sumxi;
+            dis[l] = di;
+        }
+        const __m256d s = _mm256_loadu_pd(sums);
+        const __m256d vdi = _mm256_loadu_pd(dis);
+        const __m256d bt = _mm256_div_pd(_mm256_mul_pd(vdn, _mm256_mul_pd(s, s)), _mm256_mul_pd(vdi, _mm256_sub_pd(vdn, vdi)));
+        acc = _mm256_max_pd(bt, acc);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double out = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    for (; i <= n - 2; ++i) {
+        di += 1.0;
+        sumxi += x[i - 1];
+        const double bt = dn * (sumxi * sumxi) / (di * (dn - di));
+        if (out < bt) out = bt;
+    }
+    return out;
+}
+
+Isa detect_isa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Isa::avx2;
+    if (__builtin_cpu_supports("sse4.1")) return Isa::sse4;
+    return Isa::scalar;
+}
+
+#else
+
+Isa detect_isa() {
+    return Isa::scalar;
+}
+
+#endif
+
+const Isa supported_isa = detect_isa();
+// read on every kernel call, possibly while a test or benchmark thread
+// changes it; the kernels agree, so relaxed ordering is enough
+std::atomic<Isa> active_isa(supported_isa);
+
+} // namespace
+
+Isa isa() {
+    return active_isa.load(std::memory_order_relaxed);
+}
+
+Isa set_isa(Isa requested) {
+    const Isa selected = std::min(requested, supported_isa);
+    active_isa.store(selected, std::memory_order_relaxed);
+    return selected;
+}
+
+double max_absdiff(const double* sx, int lo, int hi, int d) {
+#if CNA_CBS_X86_KERNELS
+    const Isa selected = isa();
+    if (selected == Isa::avx2) return max_absdiff_avx2(sx, lo, hi, d);
+    if (selected == Isa::sse4) return max_absdiff_sse4(sx, lo, hi, d);
+#endif
+    return max_absdiff_scalar(sx, lo, hi, d);
+}
+
+double argmax_absdiff(const double* sx, int lo, int hi, int d, int& imax) {
+#if CNA_CBS_X86_KERNELS
+    const Isa selected = isa();
+    if (selected == Isa::avx2) return argmax_absdiff_avx2(sx, lo, hi, d, imax);
+    if (selected == Isa::sse4) return argmax_absdiff_sse4(sx, lo, hi, d, imax);
+#endif
+    return argmax_absdiff_scalar(sx, lo, hi, d, imax);
+}
+
+double max_wbss(const double* sx, const double* cwts, int lo, int hi, int d, double rn) {
+#if CNA_CBS_X86_KERNELS
+    const Isa selected = isa();
+    if (selected == Isa::avx2) return max_wbss_avx2(sx, cwts, lo, hi, d, rn);
+    if (selected == Isa::sse4) return max_wbss_sse4(sx, cwts, lo, hi, d, rn);
+#endif
+    return max_wbss_scalar(sx, cwts, lo, hi, d, rn);
+}
+
+double max_btstat(const double* x, int n) {
+#if CNA_CBS_X86_KERNELS
+    const Isa selected = isa();
+    if (selected == Isa::avx2) return max_btstat_avx2(x, n);
+    if (selected == Isa::sse4) return max_btstat_sse4(x, n);
+#endif
+    return max_btstat_scalar(x, n);
+}
+
+} // namespace kernels
+} // namespace cbs
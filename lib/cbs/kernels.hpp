@@ -0,0 +1,37 @@
+#ifndef CNA_LIB_CBS_KERNELS_HPP
+#define CNA_LIB_CBS_KERNELS_HPP
+
+namespace cbs {
+namespace kernels {
+
+// Instruction sets the kernels can be dispatched to. The widest one supported
+// by the running CPU is selected at load time; builds configured with
+// CNA_ENABLE_SIMD=OFF, or for non-x86 targets, only have the scalar path.
+enum class Isa { scalar, sse4, avx2 };
+
+Isa isa();
+
+// Restrict dispatch to at most `requested` (clamped to what the CPU supports)
+// and return the instruction set now in use. Intended for tests and benchmarks.
+Isa set_isa(Isa requested);
+
+// Largest |sx[i + d] - sx[i]| over lo <= i <= hi, or 0 if the range is empty.
+double max_absdiff(const double* sx, int lo, int hi, int d);
+
+// As max_absdiff, also reporting the first maximizing i in imax. Like the
+// scalar scan it replaces, imax is left untouched unless some difference
+// exceeds zero.
+double argmax_absdiff(const double* sx, int lo, int hi, int d, int& imax);
+
+// Largest (sx[i + d] - sx[i])^2 / (c * (rn - c)) over lo <= i <= hi, where
+// c = cwts[i + d - 1] - cwts[i - 1], or 0 if the range is empty.
+double max_wbss(const double* sx, const double* cwts, int lo, int hi, int d, double rn);
+
+// Largest n * s_i^2 / (i * (n - i)) over the partial sums s_i of x[0..i-1],
+// 2 <= i <= n - 2, or 0 if n < 4.
+double max_btstat(const double* x, int n);
+
+} // namespace kernels
+} // namespace cbs
+
+#endif
@@ -0,0 +1,157 @@
+#include "cbs/pelt.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+namespace cbs {
+namespace {
+
+std::vector<double> prefix_sums(const std::vector<double>& x) {
+    std::vector<double> cs(x.size() + 1, 0.0);
+    for (std::size_t i = 0; i < x.size(); ++i) cs[i + 1] = cs[i] + x[i];
+    return cs;
+}
+
+// sum of squares of x[s..t) about its mean, less the constant sum of x^2
+inline double segment_cost(const std::vector<double>& cs, int s, int t) {
+    const double d = cs[t] - cs[s];
+    return -d * d / static_cast<double>(t - s);
+}
+
+SegmentationResult with_means(const std::vector<double>& x, std::vector<int> lseg) {
+    std::vector<double> means;
+    means.reserve(lseg.size());
+    int ll = 0;
+    for (int len : lseg) {
+        const int uu = ll + len;
+        double s = 0.0;
+        for (int i = ll; i < uu; ++i) s += x[i];
+        means.push_back(s / static_cast<double>(len));
+        ll = uu;
+    }
+    return {std::move(lseg), means};
+}
+
+void check_arguments(double penalty, int min_width) {
+    if (!(penalty >= 0.0)) throw std::invalid_argument("penalty must be non-negative");
+    if (min_width < 1) throw std::invalid_argument("min_width must be positive");
+}
+
+} // namespace
+
+double diff_variance(const std::vector<double>& x) {
+    // differences touching a missing value are skipped: a NaN breaks the
+    // strict weak ordering nth_element relies on
+    std::vector<double> d;
+    d.reserve(x.size());
+    for (std::size_t i = 1; i < x.size(); ++i) {
+        const double v = std::abs(x[i] - x[i - 1]);
+        if (std::isfinite(v)) d.push_back(v);
+    }
+    if (d.empty()) return 0.0;
+    const std::size_t mid = d.size() / 2;
+    std::nth_element(d.begin(), d.begin() + mid, d.end());
+    // MAD of the differences, scaled to the SD of normal noise; each
+    // difference carries twice the noise variance
+    const double sd = 1.4826 * d[mid] / std::sqrt(2.0);
+    if (sd > 0.0) return sd * sd;
+    // most differences are zero in quantized or flat data, where the MAD
+    // vanishes; fall back to their mean square, which is zero only if x is
+    // constant
+    double ss = 0.0;
+    for (double v : d) ss += v * v;
+    return ss / static_cast<double>(d.size()) / 2.0;
+}
+
+SegmentationResult segment_pelt(const std::vector<double>& x, double penalty, int min_width) {
+    check_arguments(penalty, min_width);
+    const int n = static_cast<int>(x.size());
+    if (n == 0) return {};
+    if (n < 2 * min_width) return with_means(x, {n});
+
+    const double inf = std::numeric_limits<double>::infinity();
+    const std::vector<double> cs = prefix_sums(x);
+    // f[t] is the optimal penalized cost of x[0..t), last[t] its final change point
+    std::vector<double> f(n + 1, inf);
+    std::vector<int> last(n + 1, 0);
+    f[0] = -penalty;
+    std::vector<int> cand{0}, kept;
+    for (int t = 1; t <= n; ++t) {
+        for (int s : cand) {
+            if (t - s < min_width) continue;
+            const double v = f[s] + segment_cost(cs, s, t) + penalty;
+            if (v < f[t]) {
+                f[t] = v;
+                last[t] = s;
+            }
+        }
+        if (f[t] < inf) cand.push_back(t);
+
+        // s is never again the best last change point once ending a segment
+        // at t0 is at least as good; t0 = t + 1 - min_width keeps every later
+        // final segment feasible
+        const int t0 = t + 1 - min_width;
+        if (t0 > 0 && f[t0] < inf) {
+            kept.clear();
+            for (int s : cand) {
+                if (s >= t0 || f[s] + segment_cost(cs, s, t0) <= f[t0]) kept.push_back(s);
+            }
+            cand.swap(kept);
+        }
+    }
+
+    std::vector<int> lseg;
+    for (int t = n; t > 0; t = last[t]) lseg.push_back(t - last[t]);
+    std::reverse(lseg.begin(), lseg.end());
+    return with_means(x, std::move(lseg));
+}
+
+SegmentationResult segment_binseg(const std::vector<double>& x, double penalty, int min_width) {
+    check_arguments(penalty, min_width);
+    const int n = static_cast<int>(x.size());
+    if (n == 0) return {};
+    const std::vector<double> cs = prefix_sums(x);
+
+    struct Split {
+        double gain;
+        int lo, at, hi;
+        bool operator<(const Split& o) const { return gain < o.gain; }
+    };
+    std::priority_queue<Split> queue;
+    auto consider = [&](int lo, int hi) {
+        Split best{0.0, lo, -1, hi};
+        const double whole = segment_cost(cs, lo, hi);
+        for (int i = lo + min_width; i <= hi - min_width; ++i) {
+            const double gain = whole - segment_cost(cs, lo, i) - segment_cost(cs, i, hi);
+            if (gain > best.gain) {
+                best.gain = gain;
+                best.at = i;
+            }
+        }
+        if (best.at >= 0 && best.gain > penalty) queue.push(best);
+    };
+
+    std::vector<int> ends{n};
+    consider(0, n);
+    while (!queue.empty()) {
+        const Split sp = queue.top();
+        queue.pop();
+        ends.push_back(sp.at);
+        consider(sp.lo, sp.at);
+        consider(sp.at, sp.hi);
+    }
+    std::sort(ends.begin(), ends.end());
+    std::vector<int> lseg;
+    int prev = 0;
+    for (int e : ends) {
+        lseg.push_back(e - prev);
+        prev = e;
+    }
+    return with_means(x, std::move(lseg));
+}
+
+} // namespace cbs
@@ -0,0 +1,28 @@
+#ifndef CNA_LIB_CBS_PELT_HPP
+#define CNA_LIB_CBS_PELT_HPP
+
+#include <vector>
+
+#include "cbs/CBS.hpp"
+
+namespace cbs {
+
+// Robust noise variance of a piecewise-constant profile, from the median
+// absolute difference of adjacent points, or from their mean square when the
+// median is zero. Differences involving a non-finite value are ignored. Zero
+// only for a constant profile.
+double diff_variance(const std::vector<double>& x);
+
+// Exact minimizer of the within-segment sum of squares plus `penalty` per
+// change point over segmentations whose segments hold at least min_width
+// points, by pruned exact linear time search (PELT, Killick et al. 2012).
+SegmentationResult segment_pelt(const std::vector<double>& x, double penalty, int min_width = 2);
+
+// Binary segmentation on prefix sums: the segment whose best single split
+// reduces the sum of squares most is split next, for as long as the reduction
+// exceeds `penalty`.
+SegmentationResult segment_binseg(const std::vector<double>& x, double penalty, int min_width = 2);
+
+} // namespace cbs
+
+#endif
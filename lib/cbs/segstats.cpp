@@ -0,0 +1,155 @@
+#include "cbs/segstats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "cbs/CBS.hpp"
+#include "parallel.hpp"
+
+namespace cbs {
+namespace {
+
+const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+// sums of x and x^2 over [0, i), accumulated in double
+struct PrefixSums {
+    std::vector<double> s, q;
+
+    template <typename T>
+    PrefixSums(const T* x, int n) : s(n + 1, 0.0), q(n + 1, 0.0) {
+        for (int i = 0; i < n; ++i) {
+            const double v = static_cast<double>(x[i]);
+            s[i + 1] = s[i] + v;
+            q[i + 1] = q[i] + v * v;
+        }
+    }
+
+    double sum(int a, int b) const { return s[b] - s[a]; }
+
+    // sample variance of [a, b)
+    double variance(int a, int b) const {
+        const double m = static_cast<double>(b - a);
+        if (m < 2.0) return kNaN;
+        const double mean = sum(a, b) / m;
+        return std::max(0.0, (q[b] - q[a] - m * mean * mean) / (m - 1.0));
+    }
+};
+
+// btmax of the standardized values in [a, b) (DNAcopy bsegp)
+double pooled_btstat(const PrefixSums& ps, int a, int b) {
+    const int m = b - a;
+    if (m < 4) return 0.0;
+    const double var = ps.variance(a, b);
+    if (!(var > 0.0)) return 0.0;
+    const double dm = static_cast<double>(m);
+    const double mean = ps.sum(a, b) / dm;
+    double out = 0.0;
+    for (int i = 2; i <= m - 2; ++i) {
+        const double di = static_cast<double>(i);
+        const double c = ps.sum(a, a + i) - di * mean;
+        out = std::max(out, dm * c * c / (di * (dm - di)));
+    }
+    return std::sqrt(out / var);
+}
+
+// Bootstrap locations of the change point after k of the m values at x, which
+// hold two segments with means mean1 and mean2: residuals are resampled with
+// replacement onto the two-segment fit and the best split within
+// [lo, hi] is recorded (DNAcopy bsegci).
+template <typename T>
+std::vector<int> bootstrap_locations(const T* x, int m, int k, double mean1, double mean2, int lo, int hi, int nboot, std::mt19937_64& rng) {
+    std::vector<double> resid(m);
+    for (int i = 0; i < m; ++i) resid[i] = static_cast<double>(x[i]) - (i < k ? mean1 : mean2);
+    std::vector<double> sx(m + 1, 0.0);
+    std::uniform_int_distribution<int> pick(0, m - 1);
+    const double dm = static_cast<double>(m);
+    std::vector<int> out(nboot);
+    for (int l = 0; l < nboot; ++l) {
+        for (int i = 0; i < m; ++i) sx[i + 1] = sx[i] + (i < k ? mean1 : mean2) + resid[pick(rng)];
+        const double total = sx[m] / dm;
+        int best = lo;
+        double bmax = -1.0;
+        for (int i = lo; i <= hi; ++i) {
+            const double di = static_cast<double>(i);
+            const double c = sx[i] - di * total;
+            const double bt = c * c / (di * (dm - di));
+            if (bt > bmax) {
+                bmax = bt;
+                best = i;
+            }
+        }
+        out[l] = best;
+    }
+    return out;
+}
+
+} // namespace
+
+template <typename T>
+SegmentStatistics segment_statistics(const T* x,
+                                     int n,
+                                     const std::vector<int>& lengths,
+                                     int nboot,
+                                     double alpha,
+                                     int search_range,
+                                     std::uint64_t seed,
+                                     int ngrid,
+                                     double tol,
+                                     int nthreads) {
+    if (nboot < 0) throw std::invalid_argument("nboot must be non-negative");
+    if (!(alpha > 0.0 && alpha < 1.0)) throw std::invalid_argument("alpha must lie in (0, 1)");
+    const std::size_t nseg = lengths.size();
+    std::vector<int> starts(nseg + 1, 0);
+    for (std::size_t k = 0; k < nseg; ++k) starts[k + 1] = starts[k] + lengths[k];
+    if (starts[nseg] != n) throw std::invalid_argument("segment lengths do not cover the chromosome");
+
+    const PrefixSums ps(x, n);
+    SegmentStatistics out;
+    out.sd.assign(nseg, kNaN);
+    out.median.assign(nseg, kNaN);
+    out.bstat.assign(nseg, kNaN);
+    out.pval.assign(nseg, kNaN);
+    out.lcl.assign(nseg, -1);
+    out.ucl.assign(nseg, -1);
+
+    cna::parallel_for(nseg, nthreads, [&](std::size_t k) {
+        const int a = starts[k], b = starts[k + 1];
+        if (b == a) return;
+        out.sd[k] = std::sqrt(ps.variance(a, b));
+        std::vector<double> v(x + a, x + b);
+        const std::size_t half = v.size() / 2;
+        std::nth_element(v.begin(), v.begin() + half, v.end());
+        double med = v[half];
+        if (v.size() % 2 == 0) med = (med + *std::max_element(v.begin(), v.begin() + half)) / 2.0;
+        out.median[k] = med;
+
+        if (k + 1 == nseg) return;
+        const int c = starts[k + 2];
+        const int m = c - a;
+        out.bstat[k] = pooled_btstat(ps, a, c);
+        out.pval[k] = m > 4 ? std::min(1.0, btailp(out.bstat[k], m, ngrid, tol)) : 1.0;
+        if (nboot == 0 || b == c) return;
+
+        std::seed_seq seq{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32), static_cast<std::uint32_t>(k)};
+        std::mt19937_64 rng(seq);
+        const int split = b - a;
+        const int lo = std::max(1, split - search_range);
+        const int hi = std::min(m - 1, split + search_range);
+        std::vector<int> locs = bootstrap_locations(x + a, m, split, ps.sum(a, b) / (b - a), ps.sum(b, c) / (c - b), lo, hi, nboot, rng);
+        std::sort(locs.begin(), locs.end());
+        const int il = std::max(0, static_cast<int>(std::floor(alpha / 2.0 * nboot)));
+        const int iu = std::min(nboot - 1, static_cast<int>(std::ceil((1.0 - alpha / 2.0) * nboot)) - 1);
+        out.lcl[k] = a + locs[il] - 1;
+        out.ucl[k] = a + locs[std::max(il, iu)] - 1;
+    });
+    return out;
+}
+
+template SegmentStatistics segment_statistics<float>(const float*, int, const std::vector<int>&, int, double, int, std::uint64_t, int, double, int);
+template SegmentStatistics segment_statistics<double>(const double*, int, const std::vector<int>&, int, double, int, std::uint64_t, int, double, int);
+
+} // namespace cbs
@@ -0,0 +1,46 @@
+#ifndef CNA_LIB_CBS_SEGSTATS_HPP
+#define CNA_LIB_CBS_SEGSTATS_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace cbs {
+
+// Per-segment summaries of a segmented chromosome, and for the change point
+// after each segment (DNAcopy segments.p) the binary-segmentation statistic of
+// the two adjacent segments pooled, its p-value and a bootstrap confidence
+// interval for the change point. The change-point entries of the last segment
+// are NaN, or -1 for the limits.
+struct SegmentStatistics {
+    std::vector<double> sd;
+    std::vector<double> median;
+    std::vector<double> bstat;
+    std::vector<double> pval;
+    // marker index of the last marker left of the change point
+    std::vector<int> lcl;
+    std::vector<int> ucl;
+};
+
+// Statistics of the segments with the given lengths over the n values at x.
+// Means, SDs and the change-point statistics are read off one pass of prefix
+// sums of x and x^2. With nboot > 0, the (1 - alpha) interval of each change
+// point comes from nboot resamplings of the residuals of its two segments,
+// searching search_range markers either side of it. Segments are summarized
+// on nthreads threads; each change point draws from its own generator, seeded
+// from seed and its index, so results do not depend on nthreads.
+// Instantiated for float and double.
+template <typename T>
+SegmentStatistics segment_statistics(const T* x,
+                                     int n,
+                                     const std::vector<int>& lengths,
+                                     int nboot,
+                                     double alpha,
+                                     int search_range,
+                                     std::uint64_t seed,
+                                     int ngrid = 100,
+                                     double tol = 1e-6,
+                                     int nthreads = 1);
+
+} // namespace cbs
+
+#endif
@@ -2,11 +2,15 @@
 
 #include <algorithm>
 #include <cmath>
+#include <map>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 
 #include <boost/math/distributions/normal.hpp>
 
+#include "parallel.hpp"
+
 namespace cbs {
 namespace {
 
@@ -30,18 +34,38 @@ double inflfact(double trim) {
     return 1.0 / (sum * step);
 }
 
+// inflfact integrates over a 10,000-point grid; callers reuse a handful of
+// trim values, so cache the result per value
+double cached_inflfact(double trim) {
+    static std::mutex mtx;
+    static std::map<double, double> cache;
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = cache.find(trim);
+    if (it == cache.end()) it = cache.emplace(trim, inflfact(trim)).first;
+    return it->second;
+}
+
+// Variance estimate from the absolute differences of consecutive values of a
+// profile, in profile order; diffs is reordered.
+double trimmed_variance_of_diffs(std::vector<double>& diffs, double trim) {
+    if (diffs.empty()) return 0.0;
+    const long long n_keep = std::llround((1.0 - 2.0 * trim) * static_cast<double>(diffs.size()));
+    if (n_keep <= 0) return 0.0;
+    // only the set of the n_keep smallest differences matters, not their order
+    const std::size_t nk = static_cast<std::size_t>(n_keep);
+    if (nk < diffs.size()) std::nth_element(diffs.begin(), diffs.begin() + nk, diffs.end());
+    double ss = 0.0;
+    for (std::size_t i = 0; i < nk; ++i) ss += diffs[i] * diffs[i];
+    return cached_inflfact(trim) * (ss / (2.0 * static_cast<double>(n_keep)));
+}
+
 double trimmed_variance(const std::vector<double>& genomdat, double trim) {
     const std::size_t n = genomdat.size();
     if (n < 2) return 0.0;
-    const long long n_keep = std::llround((1.0 - 2.0 * trim) * static_cast<double>(n - 1));
-    if (n_keep <= 0) return 0.0;
     std::vector<double> diffs;
     diffs.reserve(n - 1);
     for (std::size_t i = 1; i < n; ++i) diffs.push_back(std::abs(genomdat[i] - genomdat[i - 1]));
-    std::sort(diffs.begin(), diffs.end());
-    double ss = 0.0;
-    for (long long i = 0; i < n_keep; ++i) ss += diffs[static_cast<std::size_t>(i)] * diffs[static_cast<std::size_t>(i)];
-    return inflfact(trim) * (ss / (2.0 * static_cast<double>(n_keep)));
+    return trimmed_variance_of_diffs(diffs, trim);
 }
 
 std::vector<int> finite_chrom_frequencies(const std::vector<int>& finite_chrom) {
@@ -60,25 +84,54 @@ std::vector<int> finite_chrom_frequencies(const std::vector<int>& finite_chrom)
     return cfrq;
 }
 
-double neighborhood_median(const std::vector<double>& gdat, int ilo, int ihi) {
-    std::vector<double> xnbhd;
-    xnbhd.reserve(static_cast<std::size_t>(ihi - ilo + 1));
-    for (int j = ilo; j <= ihi; ++j) xnbhd.push_back(gdat[static_cast<std::size_t>(j)]);
-    std::sort(xnbhd.begin(), xnbhd.end());
-    const int k1 = static_cast<int>(xnbhd.size());
-    const int j1 = k1 / 2;
-    if (k1 == 2 * j1) {
-        return (xnbhd[static_cast<std::size_t>(j1 - 1)] + xnbhd[static_cast<std::size_t>(j1)]) / 2.0;
+// Median of gdat[ilo..ihi] for windows that slide forward. The window is kept
+// sorted and updated by removing the values that left it and inserting the
+// values that entered, so consecutive outliers cost O(k) rather than a sort.
+template <typename T>
+class WindowMedian {
+public:
+    explicit WindowMedian(const T* gdat) : gdat_(gdat) {}
+
+    double operator()(int ilo, int ihi) {
+        if (ilo < lo_ || ihi < hi_ || ilo > hi_) {
+            sorted_.assign(gdat_ + ilo, gdat_ + ihi + 1);
+            std::sort(sorted_.begin(), sorted_.end());
+        } else {
+            for (int j = lo_; j < ilo; ++j) {
+                sorted_.erase(std::lower_bound(sorted_.begin(), sorted_.end(), static_cast<double>(gdat_[j])));
+            }
+            for (int j = hi_ + 1; j <= ihi; ++j) {
+                const double v = gdat_[j];
+                sorted_.insert(std::upper_bound(sorted_.begin(), sorted_.end(), v), v);
+            }
+        }
+        lo_ = ilo;
+        hi_ = ihi;
+        const int k1 = static_cast<int>(sorted_.size());
+        const int j1 = k1 / 2;
+        if (k1 == 2 * j1) {
+            return (sorted_[static_cast<std::size_t>(j1 - 1)] + sorted_[static_cast<std::size_t>(j1)]) / 2.0;
+        }
+        return sorted_[static_cast<std::size_t>(j1)];
     }
-    return xnbhd[static_cast<std::size_t>(j1)];
-}
 
-std::vector<double> smooth_lr_kernel(const std::vector<double>& gdat,
-                                     const std::vector<int>& cfrq,
-                                     int k,
-                                     double oSD,
-                                     double sSD) {
-    std::vector<double> sgdat(gdat.size());
+private:
+    const T* gdat_;
+    std::vector<double> sorted_;
+    int lo_ = 0;
+    int hi_ = -1;
+};
+
+// Smooth the finite values g over the chromosome runs cfrq into sgdat. Values
+// are read as T and compared and written in double.
+template <typename T>
+void smooth_lr_kernel(const T* g,
+                      const std::vector<int>& cfrq,
+                      int k,
+                      double oSD,
+                      double sSD,
+                      double* sgdat) {
+    WindowMedian<T> window_median(g);
     int cilo = 0;
     int cihi = -1;
     for (int freq : cfrq) {
@@ -86,44 +139,61 @@ std::vector<double> smooth_lr_kernel(const std::vector<double>& gdat,
         for (int i = cilo; i <= cihi; ++i) {
             const int ilo = std::max(cilo, i - k);
             const int ihi = std::min(cihi, i + k);
+            const double gi = g[i];
+            // nearly every probe lies within oSD of an adjacent one
+            if ((i > ilo && std::abs(gi - g[i - 1]) <= oSD) || (i < ihi && std::abs(gi - g[i + 1]) <= oSD)) {
+                sgdat[i] = gi;
+                continue;
+            }
+            // scan the whole window without early exit: if any neighbour is
+            // within oSD the extremes are unused, otherwise they are what the
+            // exhaustive scan would have found
             double mxnbd = 100.0 * oSD;
             double mnnbd = 100.0 * oSD;
-            bool keep = false;
-            for (int j = ilo; j <= ihi; ++j) {
-                if (j == i) continue;
-                const double distij = gdat[static_cast<std::size_t>(i)] - gdat[static_cast<std::size_t>(j)];
-                if (std::abs(distij) <= oSD) {
-                    sgdat[static_cast<std::size_t>(i)] = gdat[static_cast<std::size_t>(i)];
-                    keep = true;
-                    break;
-                }
-                if (distij < mxnbd) mxnbd = distij;
-                if (-distij < mnnbd) mnnbd = -distij;
+            int near = 0;
+            for (int j = ilo; j < i; ++j) {
+                const double distij = gi - g[j];
+                near |= std::abs(distij) <= oSD;
+                mxnbd = std::min(mxnbd, distij);
+                mnnbd = std::min(mnnbd, -distij);
+            }
+            for (int j = i + 1; j <= ihi; ++j) {
+                const double distij = gi - g[j];
+                near |= std::abs(distij) <= oSD;
+                mxnbd = std::min(mxnbd, distij);
+                mnnbd = std::min(mnnbd, -distij);
             }
-            if (keep) continue;
-            if ((mxnbd <= 0.0) && (mnnbd <= 0.0)) {
-                sgdat[static_cast<std::size_t>(i)] = gdat[static_cast<std::size_t>(i)];
+            if (near || ((mxnbd <= 0.0) && (mnnbd <= 0.0))) {
+                sgdat[i] = gi;
                 continue;
             }
-            const double xmed = neighborhood_median(gdat, ilo, ihi);
-            if (mxnbd > 0.0) sgdat[static_cast<std::size_t>(i)] = xmed + sSD;
-            if (mnnbd > 0.0) sgdat[static_cast<std::size_t>(i)] = xmed - sSD;
+            const double xmed = window_median(ilo, ihi);
+            if (mxnbd > 0.0) sgdat[i] = xmed + sSD;
+            if (mnnbd > 0.0) sgdat[i] = xmed - sSD;
         }
         cilo += freq;
     }
-    return sgdat;
 }
 
-} // namespace
-
-std::vector<double> smooth(const std::vector<double>& values,
-                               const std::vector<int>& chrom,
-                               int smooth_region,
-                               double outlier_sd_scale,
-                               double smooth_sd_scale,
-                               double trim) {
-    if (values.size() != chrom.size()) throw std::invalid_argument("values and chrom must have same length");
-    if (smooth_region < 0) throw std::invalid_argument("smooth_region must be non-negative");
+// Smooth one profile given the chromosome run lengths of the full marker set.
+// A profile without missing values is smoothed in place of the finite subset,
+// skipping the compaction and the recount of chromosome runs.
+std::vector<double> smooth_profile(const std::vector<double>& values,
+                                   const std::vector<int>& chrom,
+                                   const std::vector<int>& cfrq_all,
+                                   int smooth_region,
+                                   double outlier_sd_scale,
+                                   double smooth_sd_scale,
+                                   double trim) {
+    if (std::all_of(values.begin(), values.end(), [](double v) { return std::isfinite(v); })) {
+        if (values.size() < 2) return values;
+        const double tvar = trimmed_variance(values, trim);
+        if (!(std::isfinite(tvar)) || tvar < 0.0) return values;
+        const double trimmed_sd = std::sqrt(tvar);
+        std::vector<double> out(values.size());
+        smooth_lr_kernel(values.data(), cfrq_all, smooth_region, outlier_sd_scale * trimmed_sd, smooth_sd_scale * trimmed_sd, out.data());
+        return out;
+    }
 
     std::vector<double> out = values;
     std::vector<std::size_t> finite_idx;
@@ -147,23 +217,207 @@ std::vector<double> smooth(const std::vector<double>& values,
     const double outlier_sd = outlier_sd_scale * trimmed_sd;
     const double smooth_sd = smooth_sd_scale * trimmed_sd;
     const std::vector<int> cfrq = finite_chrom_frequencies(finite_chrom);
-    const std::vector<double> smoothed = smooth_lr_kernel(finite_vals, cfrq, smooth_region, outlier_sd, smooth_sd);
+    std::vector<double> smoothed(finite_vals.size());
+    smooth_lr_kernel(finite_vals.data(), cfrq, smooth_region, outlier_sd, smooth_sd, smoothed.data());
     for (std::size_t i = 0; i < finite_idx.size(); ++i) out[finite_idx[i]] = smoothed[i];
     return out;
 }
 
+// Smooth a profile stored as one buffer per chromosome, as smooth_profile
+// does for the concatenated profile. Without missing values the buffers are
+// read in place; otherwise they are gathered for smooth_profile.
+template <typename T>
+std::vector<double> smooth_pieces(const std::vector<const T*>& pieces,
+                                  const std::vector<int>& lengths,
+                                  const std::vector<int>& chrom,
+                                  const std::vector<int>& cfrq_all,
+                                  int smooth_region,
+                                  double outlier_sd_scale,
+                                  double smooth_sd_scale,
+                                  double trim) {
+    bool finite = true;
+    for (std::size_t c = 0; c < pieces.size() && finite; ++c) {
+        finite = std::all_of(pieces[c], pieces[c] + lengths[c], [](T v) { return std::isfinite(v); });
+    }
+    auto gather = [&]() {
+        std::vector<double> values;
+        values.reserve(chrom.size());
+        for (std::size_t c = 0; c < pieces.size(); ++c) values.insert(values.end(), pieces[c], pieces[c] + lengths[c]);
+        return values;
+    };
+    if (!finite || chrom.size() < 2) {
+        return smooth_profile(gather(), chrom, cfrq_all, smooth_region, outlier_sd_scale, smooth_sd_scale, trim);
+    }
+
+    std::vector<double> diffs;
+    diffs.reserve(chrom.size() - 1);
+    bool first = true;
+    double prev = 0.0;
+    for (std::size_t c = 0; c < pieces.size(); ++c) {
+        for (int i = 0; i < lengths[c]; ++i) {
+            const double v = pieces[c][i];
+            if (!first) diffs.push_back(std::abs(v - prev));
+            prev = v;
+            first = false;
+        }
+    }
+    const double tvar = trimmed_variance_of_diffs(diffs, trim);
+    if (!(std::isfinite(tvar)) || tvar < 0.0) return gather();
+    const double trimmed_sd = std::sqrt(tvar);
+    std::vector<double> out(chrom.size());
+    std::size_t offset = 0;
+    for (std::size_t c = 0; c < pieces.size(); ++c) {
+        if (lengths[c] == 0) continue;
+        smooth_lr_kernel(pieces[c], {lengths[c]}, smooth_region, outlier_sd_scale * trimmed_sd, smooth_sd_scale * trimmed_sd, out.data() + offset);
+        offset += static_cast<std::size_t>(lengths[c]);
+    }
+    return out;
+}
+
+// Trimmed SD of the finite values of a profile stored as one buffer per
+// chromosome, as smooth_pieces scales its thresholds, or NaN if it leaves the
+// profile unsmoothed.
+template <typename T>
+double profile_scale(const std::vector<const T*>& pieces, const std::vector<int>& lengths, double trim) {
+    std::vector<double> diffs;
+    std::size_t nfinite = 0;
+    double prev = 0.0;
+    for (std::size_t c = 0; c < pieces.size(); ++c) {
+        for (int i = 0; i < lengths[c]; ++i) {
+            const double v = pieces[c][i];
+            if (!std::isfinite(v)) continue;
+            if (nfinite++ > 0) diffs.push_back(std::abs(v - prev));
+            prev = v;
+        }
+    }
+    if (nfinite < 2) return std::nan("");
+    const double tvar = trimmed_variance_of_diffs(diffs, trim);
+    if (!(std::isfinite(tvar)) || tvar < 0.0) return std::nan("");
+    return std::sqrt(tvar);
+}
+
+void check_buffers(std::size_t nbuffers, const std::vector<int>& lengths) {
+    if (nbuffers != lengths.size()) throw std::invalid_argument("every sample must have one buffer per chromosome");
+}
+
+} // namespace
+
+std::vector<double> smooth(const std::vector<double>& values,
+                               const std::vector<int>& chrom,
+                               int smooth_region,
+                               double outlier_sd_scale,
+                               double smooth_sd_scale,
+                               double trim) {
+    if (values.size() != chrom.size()) throw std::invalid_argument("values and chrom must have same length");
+    if (smooth_region < 0) throw std::invalid_argument("smooth_region must be non-negative");
+    return smooth_profile(values, chrom, finite_chrom_frequencies(chrom), smooth_region, outlier_sd_scale, smooth_sd_scale, trim);
+}
+
 std::vector<std::vector<double>> smooth_matrix(const std::vector<std::vector<double>>& samples,
                                                    const std::vector<int>& chrom,
                                                    int smooth_region,
                                                    double outlier_sd_scale,
                                                    double smooth_sd_scale,
-                                                   double trim) {
-    std::vector<std::vector<double>> out;
-    out.reserve(samples.size());
+                                                   double trim,
+                                                   int nthreads) {
     for (const auto& sample : samples) {
-        out.push_back(smooth(sample, chrom, smooth_region, outlier_sd_scale, smooth_sd_scale, trim));
+        if (sample.size() != chrom.size()) throw std::invalid_argument("values and chrom must have same length");
+    }
+    if (smooth_region < 0) throw std::invalid_argument("smooth_region must be non-negative");
+
+    // every sample shares the chromosome layout
+    const std::vector<int> cfrq_all = finite_chrom_frequencies(chrom);
+    std::vector<std::vector<double>> out(samples.size());
+    cna::parallel_for(samples.size(), nthreads, [&](std::size_t j) {
+        out[j] = smooth_profile(samples[j], chrom, cfrq_all, smooth_region, outlier_sd_scale, smooth_sd_scale, trim);
+    });
+    return out;
+}
+
+template <typename T>
+std::vector<std::vector<double>> smooth_chromosomes(const std::vector<std::vector<const T*>>& samples,
+                                                        const std::vector<int>& lengths,
+                                                        int smooth_region,
+                                                        double outlier_sd_scale,
+                                                        double smooth_sd_scale,
+                                                        double trim,
+                                                        int nthreads) {
+    for (const auto& sample : samples) check_buffers(sample.size(), lengths);
+    if (smooth_region < 0) throw std::invalid_argument("smooth_region must be non-negative");
+
+    std::vector<int> chrom;
+    for (std::size_t c = 0; c < lengths.size(); ++c) {
+        if (lengths[c] < 0) throw std::invalid_argument("chromosome lengths must be non-negative");
+        chrom.insert(chrom.end(), static_cast<std::size_t>(lengths[c]), static_cast<int>(c + 1));
     }
+    const std::vector<int> cfrq_all = finite_chrom_frequencies(chrom);
+    std::vector<std::vector<double>> out(samples.size());
+    cna::parallel_for(samples.size(), nthreads, [&](std::size_t j) {
+        out[j] = smooth_pieces(samples[j], lengths, chrom, cfrq_all, smooth_region, outlier_sd_scale, smooth_sd_scale, trim);
+    });
+    return out;
+}
+
+template <typename T>
+std::vector<double> smooth_scales(const std::vector<std::vector<const T*>>& samples,
+                                  const std::vector<int>& lengths,
+                                  double trim,
+                                  int nthreads) {
+    for (const auto& sample : samples) check_buffers(sample.size(), lengths);
+    std::vector<double> out(samples.size());
+    cna::parallel_for(samples.size(), nthreads, [&](std::size_t j) {
+        out[j] = profile_scale(samples[j], lengths, trim);
+    });
+    return out;
+}
+
+template <typename T>
+std::vector<std::vector<double>> smooth_chromosome(const std::vector<std::vector<const T*>>& samples,
+                                                       const std::vector<int>& lengths,
+                                                       std::size_t c,
+                                                       const std::vector<double>& scales,
+                                                       int smooth_region,
+                                                       double outlier_sd_scale,
+                                                       double smooth_sd_scale,
+                                                       int nthreads) {
+    for (const auto& sample : samples) check_buffers(sample.size(), lengths);
+    if (c >= lengths.size()) throw std::invalid_argument("chromosome index out of range");
+    if (scales.size() != samples.size()) throw std::invalid_argument("every sample must have a scale");
+    if (smooth_region < 0) throw std::invalid_argument("smooth_region must be non-negative");
+
+    const int n = lengths[c];
+    std::vector<std::vector<double>> out(samples.size());
+    cna::parallel_for(samples.size(), nthreads, [&](std::size_t j) {
+        const T* x = samples[j][c];
+        std::vector<double>& sm = out[j];
+        sm.assign(x, x + n);
+        const double sd = scales[j];
+        if (std::isnan(sd) || n == 0) return;
+        if (std::all_of(x, x + n, [](T v) { return std::isfinite(v); })) {
+            smooth_lr_kernel(x, {n}, smooth_region, outlier_sd_scale * sd, smooth_sd_scale * sd, sm.data());
+            return;
+        }
+        // smooth the finite values, leaving the missing ones in place
+        std::vector<int> idx;
+        std::vector<double> vals;
+        for (int i = 0; i < n; ++i) {
+            if (!std::isfinite(x[i])) continue;
+            idx.push_back(i);
+            vals.push_back(x[i]);
+        }
+        if (vals.empty()) return;
+        std::vector<double> smoothed(vals.size());
+        smooth_lr_kernel(vals.data(), {static_cast<int>(vals.size())}, smooth_region, outlier_sd_scale * sd, smooth_sd_scale * sd, smoothed.data());
+        for (std::size_t i = 0; i < idx.size(); ++i) sm[idx[i]] = smoothed[i];
+    });
     return out;
 }
 
+template std::vector<std::vector<double>> smooth_chromosomes<float>(const std::vector<std::vector<const float*>>&, const std::vector<int>&, int, double, double, double, int);
+template std::vector<std::vector<double>> smooth_chromosomes<double>(const std::vector<std::vector<const double*>>&, const std::vector<int>&, int, double, double, double, int);
+template std::vector<double> smooth_scales<float>(const std::vector<std::vector<const float*>>&, const std::vector<int>&, double, int);
+template std::vector<double> smooth_scales<double>(const std::vector<std::vector<const double*>>&, const std::vector<int>&, double, int);
+template std::vector<std::vector<double>> smooth_chromosome<float>(const std::vector<std::vector<const float*>>&, const std::vector<int>&, std::size_t, const std::vector<double>&, int, double, double, int);
+template std::vector<std::vector<double>> smooth_chromosome<double>(const std::vector<std::vector<const double*>>&, const std::vector<int>&, std::size_t, const std::vector<double>&, int, double, double, int);
+
 } // namespace cbs
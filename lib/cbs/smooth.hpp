@@ -1,6 +1,7 @@
 #ifndef CNA_LIB_CBS_SMOOTH_HPP
 #define CNA_LIB_CBS_SMOOTH_HPP
 
+#include <cstddef>
 #include <vector>
 
 namespace cbs {
@@ -12,12 +13,52 @@ std::vector<double> smooth(const std::vector<double>& values,
                                double smooth_sd_scale = 2.0,
                                double trim = 0.025);
 
+// Smooth every sample over the shared chromosome layout `chrom`, which is
+// scanned once for the whole batch. Samples are distributed over nthreads
+// threads; the result does not depend on the thread count.
 std::vector<std::vector<double>> smooth_matrix(const std::vector<std::vector<double>>& samples,
                                                    const std::vector<int>& chrom,
                                                    int smooth_region = 10,
                                                    double outlier_sd_scale = 4.0,
                                                    double smooth_sd_scale = 2.0,
-                                                   double trim = 0.025);
+                                                   double trim = 0.025,
+                                                   int nthreads = 1);
+
+// As smooth_matrix for profiles stored as one buffer per chromosome, such as
+// the float chromosomes of a RawSampleSet sample: samples[j][c] points at the
+// lengths[c] values of chromosome c. Buffers are read in place (gathered only
+// when a sample has missing values) and the smoothed profiles are returned
+// concatenated, in double. Instantiated for float and double.
+template <typename T>
+std::vector<std::vector<double>> smooth_chromosomes(const std::vector<std::vector<const T*>>& samples,
+                                                        const std::vector<int>& lengths,
+                                                        int smooth_region = 10,
+                                                        double outlier_sd_scale = 4.0,
+                                                        double smooth_sd_scale = 2.0,
+                                                        double trim = 0.025,
+                                                        int nthreads = 1);
+
+// The outlier and smoothing thresholds of smooth_chromosomes scale with a
+// trimmed noise SD of each whole profile. smooth_scales returns it for every
+// sample, or NaN for a profile that is left unsmoothed, and
+// smooth_chromosome then smooths chromosome c of every sample exactly as the
+// matching slice of smooth_chromosomes, so that a cohort can be smoothed one
+// chromosome at a time. Instantiated for float and double.
+template <typename T>
+std::vector<double> smooth_scales(const std::vector<std::vector<const T*>>& samples,
+                                  const std::vector<int>& lengths,
+                                  double trim = 0.025,
+                                  int nthreads = 1);
+
+template <typename T>
+std::vector<std::vector<double>> smooth_chromosome(const std::vector<std::vector<const T*>>& samples,
+                                                       const std::vector<int>& lengths,
+                                                       std::size_t c,
+                                                       const std::vector<double>& scales,
+                                                       int smooth_region = 10,
+                                                       double outlier_sd_scale = 4.0,
+                                                       double smooth_sd_scale = 2.0,
+                                                       int nthreads = 1);
 
 } // namespace cbs
 
@@ -0,0 +1,86 @@
+#include "cbs/split.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "cbs/pelt.hpp"
+
+namespace cbs {
+namespace {
+
+// piece lengths from sorted candidate cut indices
+std::vector<int> cut(int n, const std::vector<int>& cuts, int min_piece) {
+    std::vector<int> pieces;
+    int last = 0;
+    for (int c : cuts) {
+        if (c - last >= min_piece && n - c >= min_piece) {
+            pieces.push_back(c - last);
+            last = c;
+        }
+    }
+    if (n > 0) pieces.push_back(n - last);
+    return pieces;
+}
+
+} // namespace
+
+std::vector<int> split_at_gaps(const std::vector<long>& positions, long min_gap, int min_piece) {
+    if (min_gap <= 0) throw std::invalid_argument("min_gap must be positive");
+    const int n = static_cast<int>(positions.size());
+    std::vector<int> cuts;
+    for (int i = 1; i < n; ++i) {
+        if (positions[i] - positions[i - 1] >= min_gap) cuts.push_back(i);
+    }
+    return cut(n, cuts, std::max(min_piece, 1));
+}
+
+std::vector<int> split_at_boundaries(const std::vector<long>& positions, const std::vector<long>& boundaries, int min_piece) {
+    const int n = static_cast<int>(positions.size());
+    std::vector<int> cuts;
+    for (long b : boundaries) {
+        const int c = static_cast<int>(std::lower_bound(positions.begin(), positions.end(), b) - positions.begin());
+        if (c > 0 && c < n) cuts.push_back(c);
+    }
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+    return cut(n, cuts, std::max(min_piece, 1));
+}
+
+SegmentationResult reconcile_pieces(const double* x, int n, const SegmentationResult& seg, const std::vector<int>& pieces, double alpha) {
+    if (pieces.size() < 2) return seg;
+    const double sd = std::sqrt(diff_variance(std::vector<double>(x, x + n)));
+    // the piece boundaries, as marker indices
+    std::vector<int> bounds;
+    int acc = 0;
+    for (std::size_t p = 0; p + 1 < pieces.size(); ++p) bounds.push_back(acc += pieces[p]);
+
+    SegmentationResult out;
+    int start = 0;
+    for (std::size_t k = 0; k < seg.lengths.size(); ++k) {
+        const int len = seg.lengths[k];
+        const int end = start + len;
+        if (!out.lengths.empty() && std::binary_search(bounds.begin(), bounds.end(), start)) {
+            const double n1 = out.lengths.back();
+            const double n2 = len;
+            const double diff = out.means.back() - seg.means[k];
+            const bool same = sd > 0.0 ? std::erfc(std::abs(diff) / (sd * std::sqrt(2.0 * (1.0 / n1 + 1.0 / n2)))) > alpha : diff == 0.0;
+            if (same) {
+                const int mstart = start - out.lengths.back();
+                double s = 0.0;
+                for (int i = mstart; i < end; ++i) s += x[i];
+                out.lengths.back() += len;
+                out.means.back() = s / static_cast<double>(end - mstart);
+                start = end;
+                continue;
+            }
+        }
+        out.lengths.push_back(len);
+        out.means.push_back(seg.means[k]);
+        start = end;
+    }
+    return out;
+}
+
+} // namespace cbs
@@ -0,0 +1,27 @@
+#ifndef CNA_LIB_CBS_SPLIT_HPP
+#define CNA_LIB_CBS_SPLIT_HPP
+
+#include <vector>
+
+#include "cbs/CBS.hpp"
+
+namespace cbs {
+
+// Lengths of the pieces of a chromosome with sorted marker positions when it
+// is cut wherever consecutive markers are at least min_gap apart. A cut is
+// skipped if it would leave a piece shorter than min_piece markers.
+std::vector<int> split_at_gaps(const std::vector<long>& positions, long min_gap, int min_piece = 1);
+
+// As split_at_gaps, cutting before the first marker at or after each of the
+// given boundary positions (e.g. centromeres).
+std::vector<int> split_at_boundaries(const std::vector<long>& positions, const std::vector<long>& boundaries, int min_piece = 1);
+
+// Merge the two segments that meet at each piece boundary when their means do
+// not differ at level alpha, by a z-test against the noise SD of x (see
+// diff_variance). seg covers the n values at x and is cut at every piece
+// boundary; merged means are recomputed from x.
+SegmentationResult reconcile_pieces(const double* x, int n, const SegmentationResult& seg, const std::vector<int>& pieces, double alpha);
+
+} // namespace cbs
+
+#endif
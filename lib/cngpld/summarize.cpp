@@ -4,6 +4,8 @@
 #include <cmath>
 #include <stdexcept>
 
+#include "parallel.hpp"
+
 namespace {
 
 const cna::SegmentedSampleSet<rvalue>::Segments& get_segments(
@@ -83,21 +85,124 @@ CNSummary summarize_cn(
 	double cutoff,
 	const std::vector<position>* positions)
 {
-	const cna::SegmentedSampleSet<rvalue>::Segments& segments = get_segments(seg, sample, chrom_index);
+	typedef cna::SegmentedSampleSet<rvalue>::Segments Segments;
+	const Segments& segments = get_segments(seg, sample, chrom_index);
 	std::vector<position> computed_positions;
 	if (positions == NULL) {
 		computed_positions = default_positions(segments);
 		positions = &computed_positions;
 	}
 
-	CNSummary out;
-	out.reserve(positions->size());
-	for (std::vector<position>::const_iterator it = positions->begin(); it != positions->end(); ++it) {
-		CNSummaryPoint pt;
-		pt.pos = *it;
-		pt.value = summarize_cn_at_position(seg, sample, chrom_index, *it, direction, cutoff);
-		out.push_back(pt);
+	CNSummary out(positions->size());
+	if (positions->empty()) {
+		return out;
+	}
+	if (direction != 1 && direction != -1) {
+		throw std::invalid_argument("direction must be 1 or -1.");
+	}
+
+	// Sweep the positions in ascending order against the segments ordered by
+	// start, keeping the segments that overlap the current position active.
+	// Altered values are summed in segment order, as summarize_cn_at_position
+	// does, so both give identical results.
+	const size_t nsegs = segments.size();
+	const cna::Segment<rvalue>* segs = segments.data();
+	std::vector<double> altered(nsegs);
+	std::vector<bool> is_altered(nsegs);
+	std::vector<size_t> by_start(nsegs);
+	for (size_t i = 0; i < nsegs; ++i) {
+		if (segs[i].start > segs[i].end) {
+			throw std::invalid_argument("Segment start is greater than end.");
+		}
+		const double adj = static_cast<double>(direction) * static_cast<double>(segs[i].value);
+		is_altered[i] = adj > cutoff;
+		if (is_altered[i]) altered[i] = std::exp(adj);
+		by_start[i] = i;
 	}
+	std::stable_sort(by_start.begin(), by_start.end(), [segs](size_t a, size_t b) {
+		return segs[a].start < segs[b].start;
+	});
+
+	std::vector<size_t> by_pos(positions->size());
+	for (size_t i = 0; i < by_pos.size(); ++i) by_pos[i] = i;
+	std::stable_sort(by_pos.begin(), by_pos.end(), [positions](size_t a, size_t b) {
+		return (*positions)[a] < (*positions)[b];
+	});
+
+	// indices of the active segments, kept in segment order
+	std::vector<size_t> active;
+	size_t next = 0;
+	for (std::vector<size_t>::const_iterator it = by_pos.begin(); it != by_pos.end(); ++it) {
+		const position pos = (*positions)[*it];
+		for (; next < nsegs && segs[by_start[next]].start <= pos; ++next) {
+			active.insert(std::lower_bound(active.begin(), active.end(), by_start[next]), by_start[next]);
+		}
+		active.erase(std::remove_if(active.begin(), active.end(), [segs, pos](size_t i) {
+			return segs[i].end < pos;
+		}), active.end());
+
+		size_t altered_count = 0;
+		double altered_sum = 0.0;
+		for (std::vector<size_t>::const_iterator a = active.begin(); a != active.end(); ++a) {
+			if (is_altered[*a]) {
+				altered_sum += altered[*a];
+				++altered_count;
+			}
+		}
+		out[*it].pos = pos;
+		out[*it].value = altered_count == 0 ? 0.0 : altered_sum / static_cast<double>(active.size());
+	}
+	return out;
+}
+
+std::vector< std::vector<position> > shared_positions(
+	const cna::SegmentedSampleSet<rvalue>& seg)
+{
+	std::vector< std::vector<position> > grid;
+	for (cna::SegmentedSampleSet<rvalue>::Samples::const_iterator it = seg.begin(); it != seg.end(); ++it) {
+		const cna::SegmentedSampleSet<rvalue>::SegmentedSample& sam = **it;
+		if (grid.size() < sam.size()) grid.resize(sam.size());
+		for (size_t c = 0; c < sam.size(); ++c) {
+			const cna::SegmentedSampleSet<rvalue>::Segments& segments = sam.at(static_cast<chromid>(c));
+			for (cna::SegmentedSampleSet<rvalue>::Segments::const_iterator s = segments.begin(); s != segments.end(); ++s) {
+				grid[c].push_back(s->start);
+				grid[c].push_back(s->end);
+			}
+		}
+	}
+	for (size_t c = 0; c < grid.size(); ++c) {
+		std::sort(grid[c].begin(), grid[c].end());
+		grid[c].erase(std::unique(grid[c].begin(), grid[c].end()), grid[c].end());
+	}
+	return grid;
+}
+
+std::vector< std::vector<CNSummary> > summarize_cohort(
+	const cna::SegmentedSampleSet<rvalue>& seg,
+	int direction,
+	double cutoff,
+	const std::vector< std::vector<position> >* grid,
+	int nthreads)
+{
+	if (direction != 1 && direction != -1) {
+		throw std::invalid_argument("direction must be 1 or -1.");
+	}
+
+	// one task per sample and chromosome
+	std::vector<const cna::SegmentedSampleSet<rvalue>::SegmentedSample*> samples(seg.begin(), seg.end());
+	std::vector< std::vector<CNSummary> > out(samples.size());
+	std::vector< std::pair<size_t, size_t> > tasks;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		size_t nchroms = samples[i]->size();
+		if (grid != NULL) nchroms = std::min(nchroms, grid->size());
+		out[i].resize(nchroms);
+		for (size_t c = 0; c < nchroms; ++c) tasks.push_back(std::make_pair(i, c));
+	}
+
+	cna::parallel_for(tasks.size(), nthreads, [&](size_t t) {
+		const size_t i = tasks[t].first, c = tasks[t].second;
+		out[i][c] = summarize_cn(seg, samples[i]->name, c, direction, cutoff, grid != NULL ? &(*grid)[c] : NULL);
+	});
 	return out;
 }
 
@@ -32,6 +32,22 @@ CNSummary summarize_cn(
 	double cutoff,
 	const std::vector<position>* positions = NULL);
 
+// Position grid shared by all samples: the sorted union of the segment starts
+// and ends of every sample, per chromosome index.
+std::vector< std::vector<position> > shared_positions(
+	const cna::SegmentedSampleSet<rvalue>& seg);
+
+// summarize_cn of every sample (in set order) and chromosome index, indexed
+// [sample][chromosome], computed on nthreads threads. With a grid, chromosome
+// c of every sample is evaluated at (*grid)[c], so that results line up across
+// samples; otherwise each at its own segment starts and ends.
+std::vector< std::vector<CNSummary> > summarize_cohort(
+	const cna::SegmentedSampleSet<rvalue>& seg,
+	int direction,
+	double cutoff,
+	const std::vector< std::vector<position> >* grid = NULL,
+	int nthreads = 1);
+
 } // namespace cngpld
 
 #endif
@@ -100,6 +100,13 @@ namespace mapping
 			*/
 		}
 		
+		// Index of chromosome name, or 0 if unknown; unlike operator[], does
+		// not add unknown names to the map.
+		chromid find(const std::string& name) const {
+			chr2index::const_iterator it = index.find(name);
+			return it == index.end() ? 0 : it->second;
+		}
+		
 		std::string operator[] (chromid index) {
 			return chr[index];
 			/*
@@ -0,0 +1,44 @@
+#ifndef cna_parallel_h
+#define cna_parallel_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cna {
+
+// Run fn(i) for every i in [0, count) on up to nthreads threads, the calling
+// thread included. Threads take the next index from a shared counter, so
+// tasks of uneven cost balance out. Every task runs even if another throws;
+// the first exception is rethrown once all threads have joined.
+template <typename F>
+void parallel_for(size_t count, int nthreads, F fn)
+{
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			try {
+				fn(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error) error = std::current_exception();
+			}
+		}
+	};
+	const size_t nworkers = std::min<size_t>(static_cast<size_t>(std::max(nthreads, 1)), count);
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < nworkers; ++t) threads.emplace_back(worker);
+	worker();
+	for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+	if (error) std::rethrow_exception(error);
+}
+
+} // namespace cna
+
+#endif
@@ -21,6 +21,7 @@ int main(int argc, char **argv)
 	Clean clean;
 	Sort sort;
 	Segment segment;
+	Summarize summarize;
 	CommandMap commands;
 	
 	bool printUsage = false;
@@ -34,6 +35,7 @@ int main(int argc, char **argv)
 		commands.emplace("clean", ref(clean));
 		commands.emplace("sort", ref(sort));
 		commands.emplace("segment", ref(segment));
+		commands.emplace("summarize", ref(summarize));
 		
 		// Use the first argument (excluding name of program itself)
 		//   to determine the command
@@ -11,5 +11,6 @@
 #include "cna_clean.hpp"
 #include "cna_sort.hpp"
 #include "cna_segment.hpp"
+#include "cna_summarize.hpp"
 
 #endif
\ No newline at end of file
@@ -1,7 +1,16 @@
 #ifndef cna_segment_h
 #define cna_segment_h
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -13,8 +22,113 @@ namespace po = boost::program_options;
 #include "global.hpp"
 #include "cna_common.hpp"
 #include "SampleSets.hpp"
+#include "logging.hpp"
+#include "parallel.hpp"
 #include "cbs/smooth.hpp"
 #include "cbs/CBS.hpp"
+#include "cbs/cache.hpp"
+#include "cbs/pelt.hpp"
+#include "cbs/joint.hpp"
+#include "cbs/segstats.hpp"
+#include "cbs/split.hpp"
+
+// Incremental output of a checkpointed run. Each finished sample is appended
+// to the output, then recorded in the journal <output>.journal with the size
+// of the output after it. A restarted run
+// with the same options and input keeps the journaled samples, truncates any
+// rows written after the last journal line and continues from there, so the
+// output equals that of an uninterrupted run. The journal is removed once the
+// run completes.
+class SegmentCheckpoint {
+public:
+	typedef cna::SegmentedSampleSet<rvalue> SegmentedSet;
+
+	SegmentCheckpoint(const std::string& output, const std::string& header)
+	: outputName(output), journalName(output + ".journal"), header(header) {}
+
+	// Resume from the journal if it matches this run and the sample names;
+	// otherwise start a new output. Returns the number of samples already
+	// complete.
+	std::size_t open(SegmentedSet& set, const std::vector<std::string>& names) {
+		std::vector<std::string> entries;
+		std::uintmax_t offset = 0;
+		read_journal(names, entries, offset);
+
+		std::error_code ec;
+		if (!entries.empty()) {
+			std::filesystem::resize_file(outputName, offset, ec);
+			if (ec) throw std::runtime_error("Failed to truncate output file '" + outputName + "'.");
+			// rewrite the journal without any trailing partial line
+			const std::string tmp = journalName + ".tmp";
+			{
+				std::ofstream out(tmp.c_str());
+				out << header;
+				for (const std::string& e : entries) out << e << '\n';
+				if (!out) throw std::runtime_error("Failed to write journal file '" + tmp + "'.");
+			}
+			std::filesystem::rename(tmp, journalName, ec);
+			if (ec) throw std::runtime_error("Failed to write journal file '" + journalName + "'.");
+			output.open(outputName.c_str(), std::ios::out | std::ios::app);
+			journal.open(journalName.c_str(), std::ios::out | std::ios::app);
+		} else {
+			output.open(outputName.c_str(), std::ios::out | std::ios::trunc);
+			journal.open(journalName.c_str(), std::ios::out | std::ios::trunc);
+			if (output.is_open()) set.writeHeader(output);
+			journal << header << std::flush;
+		}
+		if (!output.is_open()) throw std::runtime_error("Failed to open output file '" + outputName + "'.");
+		if (!journal) throw std::runtime_error("Failed to open journal file '" + journalName + "'.");
+		return entries.size();
+	}
+
+	void commit(SegmentedSet& set, SegmentedSet::SegmentedSample& sample) {
+		set.writeSample(output, sample);
+		output.flush();
+		if (!output) throw std::runtime_error("Failed to write output file '" + outputName + "'.");
+		journal << sample.name << '\t' << static_cast<std::uintmax_t>(output.tellp()) << '\n' << std::flush;
+		if (!journal) throw std::runtime_error("Failed to write journal file '" + journalName + "'.");
+	}
+
+	void finish() {
+		output.close();
+		journal.close();
+		std::error_code ec;
+		std::filesystem::remove(journalName, ec);
+	}
+
+private:
+	std::string outputName, journalName, header;
+	std::ofstream output, journal;
+
+	// the complete journal lines that agree with the sample order and the
+	// output, and the output size after the last of them
+	void read_journal(const std::vector<std::string>& names, std::vector<std::string>& entries, std::uintmax_t& offset) const {
+		std::ifstream in(journalName.c_str(), std::ios::binary);
+		if (!in.is_open()) return;
+		std::ostringstream content;
+		content << in.rdbuf();
+		const std::string text = content.str();
+		if (text.compare(0, header.size(), header) != 0) {
+			log_warn(__FILE__, __LINE__, __func__, "Journal '%s' is from a different run; starting over.", journalName.c_str());
+			return;
+		}
+		std::error_code ec;
+		const std::uintmax_t size = std::filesystem::file_size(outputName, ec);
+		if (ec) return;
+		std::size_t pos = header.size();
+		std::uintmax_t last = 0;
+		for (std::size_t end; entries.size() < names.size() && (end = text.find('\n', pos)) != std::string::npos; pos = end + 1) {
+			const std::string line = text.substr(pos, end - pos);
+			const std::size_t t1 = line.find('\t');
+			if (t1 == std::string::npos || t1 + 1 == line.size() || line.compare(0, t1, names[entries.size()]) != 0 || t1 != names[entries.size()].size()) break;
+			char* end_off = nullptr;
+			const std::uintmax_t off = std::strtoull(line.c_str() + t1 + 1, &end_off, 10);
+			if (*end_off != '\0' || off < last || off > size) break;
+			entries.push_back(line);
+			offset = last = off;
+		}
+	}
+};
 
 class Segment : public Command {
 public:
@@ -25,9 +139,11 @@ public:
 			("input,i", po::value<std::string>(), "raw sample matrix file")
 			("output,o", po::value<std::string>(), "output segmentation file")
 			("format,f", po::value<std::string>(), "input file format [default: determined from file extension]")
+			("method,m", po::value<std::string>(), "segmentation method: cbs, pelt, binseg or joint (common change points across samples) [default: cbs]")
+			("penalty", po::value<double>(), "pelt/binseg/joint penalty per change point, in units of the noise variance [default: 2 log(n); joint: see doc/cbs.md]")
 			("alpha", po::value<double>(), "CBS alpha [default: 0.01]")
 			("nperm", po::value<int>(), "CBS permutations [default: 200]")
-			("min_width", po::value<int>(), "CBS minimum segment width [default: 2]")
+			("min_width", po::value<int>(), "minimum segment width [default: 2]")
 			("kmax", po::value<int>(), "CBS kmax [default: 25]")
 			("nmin", po::value<int>(), "CBS nmin [default: 200]")
 			("eta", po::value<double>(), "CBS eta [default: 0.05]")
@@ -35,9 +151,21 @@ public:
 			("smooth_region", po::value<int>(), "smooth neighborhood radius [default: 10]")
 			("outlier_sd_scale", po::value<double>(), "smooth outlier SD scale [default: 4.0]")
 			("smooth_sd_scale", po::value<double>(), "smooth replacement SD scale [default: 2.0]")
-			("hybrid", po::value<bool>(), "use hybrid CBS p-values [default: false]")
+			("hybrid", po::value<bool>(), "use hybrid CBS p-values on segments longer than nmin, as DNAcopy does [default: true]")
 			("undo_prune", po::value<bool>(), "apply prune undo [default: false]")
 			("undo_prune_cutoff", po::value<double>(), "prune cutoff [default: 0.05]")
+			("coarse_bin", po::value<int>(), "CBS on means of this many consecutive markers, refined at full resolution; 1 disables [default: 1]")
+			("refine_window", po::value<int>(), "half-width in markers of the coarse-to-fine refinement window [default: 2 * coarse_bin]")
+			("threads", po::value<int>(), "number of threads used to smooth samples and for joint segmentation [default: 1]")
+			("cache_dir", po::value<std::string>(), "reuse per-chromosome segmentations stored in this directory, and store new ones [default: none]")
+			("split_gap", po::value<long>(), "segment the pieces of each chromosome between inter-marker gaps of at least this many bases independently, in parallel; 0 disables [default: 0]")
+			("arm_table", po::value<std::string>(), "also split chromosomes at the positions listed in this file (chromosome and position per line, e.g. centromeres)")
+			("reconcile", po::value<bool>(), "merge segments across piece boundaries whose means do not differ at level alpha [default: false]")
+			("stats_output", po::value<std::string>(), "also write per-segment SD, median and change-point statistics (as DNAcopy segments.p) to this file")
+			("ci_nboot", po::value<int>(), "bootstrap resamples for change-point confidence intervals; 0 disables [default: 1000]")
+			("ci_alpha", po::value<double>(), "change-point confidence intervals have level 1 - ci_alpha [default: 0.05]")
+			("ci_search_range", po::value<int>(), "markers either side of a change point searched by the bootstrap [default: 100]")
+			("checkpoint", po::value<bool>(), "write each sample as it finishes, journaled in <output>.journal, and resume an interrupted run from the journal [default: false]")
 			;
 		popts.add("input", 1).add("output", 1);
 	}
@@ -57,13 +185,28 @@ public:
 		cna::RawSampleSet<rvalue> raw;
 		raw.read(inputFileName);
 		ensure_log_scale(raw);
-		cna::SegmentedSampleSet<rvalue> segmented = segment_raw(raw);
-		segmented.write(outputFileName);
+		std::unique_ptr<cbs::ResultCache> cache;
+		if (!cacheDir.empty()) cache.reset(new cbs::ResultCache(cacheDir));
+		if (checkpoint) {
+			SegmentCheckpoint journal(outputFileName, checkpoint_header());
+			segment_raw(raw, cache.get(), &journal);
+			journal.finish();
+		} else {
+			std::vector<std::string> stats;
+			cna::SegmentedSampleSet<rvalue> segmented = segment_raw(raw, cache.get(), nullptr, statsFileName.empty() ? nullptr : &stats);
+			segmented.write(outputFileName);
+			if (!statsFileName.empty()) write_statistics(stats);
+		}
+		if (cache) {
+			std::cerr << "segmentation cache: " << cache->hits() << " hits, " << cache->misses() << " misses" << std::endl;
+		}
 	}
 
 private:
 	std::string inputFileName, outputFileName;
 	cna::data::Type inputType = cna::data::invalid;
+	std::string method = "cbs";
+	double penalty = -1.0;
 	double alpha = 0.01;
 	int nperm = 200;
 	int minWidth = 2;
@@ -74,9 +217,23 @@ private:
 	int smoothRegion = 10;
 	double outlierSdScale = 4.0;
 	double smoothSdScale = 2.0;
-	bool hybrid = false;
+	bool hybrid = true;
 	bool undoPrune = false;
 	double undoPruneCutoff = 0.05;
+	int coarseBin = 1;
+	int refineWindow = -1;
+	int nthreads = 1;
+	std::string cacheDir;
+	bool checkpoint = false;
+	std::string statsFileName;
+	int ciNboot = 1000;
+	double ciAlpha = 0.05;
+	int ciSearchRange = 100;
+	long splitGap = 0;
+	std::string armTableFileName;
+	bool reconcile = false;
+	// boundaries read from the arm table, per chromosome index
+	std::vector<std::vector<long>> armBoundaries;
 
 	void getOptions() {
 		if (vm.count("input")) inputFileName = vm["input"].as<std::string>();
@@ -91,6 +248,15 @@ private:
 		if (vm.count("output")) outputFileName = vm["output"].as<std::string>();
 		else outputFileName = cna::name::filestem(inputFileName) + ".seg";
 
+		if (vm.count("method")) method = vm["method"].as<std::string>();
+		if (method != "cbs" && method != "pelt" && method != "binseg" && method != "joint") {
+			throw std::invalid_argument("Invalid segmentation method '" + method + "'.");
+		}
+		if (vm.count("penalty")) {
+			penalty = vm["penalty"].as<double>();
+			if (!(penalty >= 0.0)) throw std::invalid_argument("Penalty must be non-negative.");
+		}
+
 		if (vm.count("alpha")) alpha = vm["alpha"].as<double>();
 		if (vm.count("nperm")) nperm = vm["nperm"].as<int>();
 		if (vm.count("min_width")) minWidth = vm["min_width"].as<int>();
@@ -104,6 +270,34 @@ private:
 		if (vm.count("hybrid")) hybrid = vm["hybrid"].as<bool>();
 		if (vm.count("undo_prune")) undoPrune = vm["undo_prune"].as<bool>();
 		if (vm.count("undo_prune_cutoff")) undoPruneCutoff = vm["undo_prune_cutoff"].as<double>();
+		if (vm.count("coarse_bin")) coarseBin = vm["coarse_bin"].as<int>();
+		if (coarseBin < 1) throw std::invalid_argument("Coarse bin size must be positive.");
+		if (vm.count("refine_window")) refineWindow = vm["refine_window"].as<int>();
+		else refineWindow = 2 * coarseBin;
+		if (refineWindow < 0) throw std::invalid_argument("Refinement window must be non-negative.");
+		if (coarseBin > 1 && method != "cbs") throw std::invalid_argument("Coarse binning is only supported for CBS segmentation.");
+		if (vm.count("refine_window") && coarseBin == 1) throw std::invalid_argument("Refinement window requires a coarse bin size above 1.");
+		if (vm.count("threads")) nthreads = vm["threads"].as<int>();
+		if (nthreads < 1) throw std::invalid_argument("Number of threads must be positive.");
+		if (vm.count("cache_dir")) cacheDir = vm["cache_dir"].as<std::string>();
+		if (vm.count("checkpoint")) checkpoint = vm["checkpoint"].as<bool>();
+		if (checkpoint && method == "joint") throw std::invalid_argument("Checkpointing is not supported for joint segmentation.");
+		if (vm.count("stats_output")) statsFileName = vm["stats_output"].as<std::string>();
+		if (vm.count("ci_nboot")) ciNboot = vm["ci_nboot"].as<int>();
+		if (ciNboot < 0) throw std::invalid_argument("Number of bootstrap resamples must be non-negative.");
+		if (vm.count("ci_alpha")) ciAlpha = vm["ci_alpha"].as<double>();
+		if (!(ciAlpha > 0.0 && ciAlpha < 1.0)) throw std::invalid_argument("Confidence interval alpha must lie in (0, 1).");
+		if (vm.count("ci_search_range")) ciSearchRange = vm["ci_search_range"].as<int>();
+		if (ciSearchRange < 1) throw std::invalid_argument("Confidence interval search range must be positive.");
+		if (checkpoint && !statsFileName.empty()) throw std::invalid_argument("Segment statistics are not supported with checkpointing.");
+		if (vm.count("split_gap")) splitGap = vm["split_gap"].as<long>();
+		if (splitGap < 0) throw std::invalid_argument("Split gap must be non-negative.");
+		if (vm.count("arm_table")) {
+			armTableFileName = vm["arm_table"].as<std::string>();
+			read_arm_table();
+		}
+		if (vm.count("reconcile")) reconcile = vm["reconcile"].as<bool>();
+		if (splitting() && method == "joint") throw std::invalid_argument("Chromosome splitting is not supported for joint segmentation.");
 	}
 
 	static void ensure_log_scale(cna::RawSampleSet<rvalue>& raw) {
@@ -124,39 +318,339 @@ private:
 		}
 	}
 
-	cna::SegmentedSampleSet<rvalue> segment_raw(cna::RawSampleSet<rvalue>& raw) const {
+	cbs::SegmentationResult segment_chromosome(const double* x, int n, const std::vector<int>& sbdry, std::mt19937_64& rng) const {
+		if (method == "cbs" && coarseBin == 1) {
+			// serial intervals: interval threading would tie the random
+			// stream, and so the output, to --threads
+			return cbs::segment(x, n, false, alpha, nperm, hybrid, minWidth, kmax, nmin, eta, sbdry, 1e-6, rng, undoPrune, undoPruneCutoff);
+		}
+		const std::vector<double> xv(x, x + n);
+		if (method == "cbs") {
+			return cbs::segment_multires(xv, coarseBin, refineWindow, alpha, nperm, hybrid, minWidth, kmax, nmin, eta, sbdry, 1e-6, rng, undoPrune, undoPruneCutoff);
+		}
+		const double beta = (penalty >= 0.0 ? penalty : 2.0 * std::log(static_cast<double>(n))) * cbs::diff_variance(xv);
+		if (method == "pelt") return cbs::segment_pelt(xv, beta, minWidth);
+		return cbs::segment_binseg(xv, beta, minWidth);
+	}
+
+	// every option that affects a chromosome's segmentation, for cache entries
+	std::string cache_tag() const {
+		std::ostringstream tag;
+		tag.precision(17);
+		tag << "method=" << method << " penalty=" << penalty << " alpha=" << alpha << " nperm=" << nperm
+			<< " min_width=" << minWidth << " kmax=" << kmax << " nmin=" << nmin << " eta=" << eta
+			<< " hybrid=" << hybrid << " undo_prune=" << undoPrune << " undo_prune_cutoff=" << undoPruneCutoff
+			<< " coarse_bin=" << coarseBin << " refine_window=" << refineWindow
+			<< " trim=" << trim << " smooth_region=" << smoothRegion
+			<< " outlier_sd_scale=" << outlierSdScale << " smooth_sd_scale=" << smoothSdScale;
+		if (splitting()) {
+			tag << " split_gap=" << splitGap << " arm_table=" << armTableFileName << " reconcile=" << reconcile;
+		}
+		return tag.str();
+	}
+
+	bool splitting() const {
+		return splitGap > 0 || !armTableFileName.empty();
+	}
+
+	void read_arm_table() {
+		std::ifstream in(armTableFileName.c_str());
+		if (!in.is_open()) throw std::runtime_error("Failed to open arm table '" + armTableFileName + "'.");
+		armBoundaries.assign(cna::nChromosomes, std::vector<long>());
+		std::string line, chromName;
+		while (std::getline(in, line)) {
+			if (line.empty() || line[0] == '#') continue;
+			std::istringstream fields(line);
+			long pos;
+			// lines without a known chromosome and a position, such as a header, are skipped
+			if (!(fields >> chromName >> pos)) continue;
+			const chromid chr = cna::mapping::chromosome.find(chromName);
+			if (chr == 0) continue;
+			armBoundaries[chr - 1].push_back(pos);
+		}
+	}
+
+	// piece lengths of chromosome chri
+	std::vector<int> chromosome_pieces(cna::RawSampleSet<rvalue>& raw, std::size_t chri) const {
+		const auto& markers = raw.marker_set()->at(chri);
+		std::vector<long> positions(markers.size());
+		for (std::size_t i = 0; i < markers.size(); ++i) positions[i] = static_cast<long>(markers[i]->pos);
+		std::vector<int> pieces{static_cast<int>(positions.size())};
+		std::vector<long> boundaries;
+		if (chri < armBoundaries.size()) boundaries = armBoundaries[chri];
+		if (splitGap > 0) {
+			for (std::size_t i = 1; i < positions.size(); ++i) {
+				if (positions[i] - positions[i - 1] >= splitGap) boundaries.push_back(positions[i]);
+			}
+		}
+		if (!boundaries.empty()) pieces = cbs::split_at_boundaries(positions, boundaries, minWidth);
+		return pieces;
+	}
+
+	// Segment every piece of one sample on nthreads threads. Each piece draws
+	// from its own generator, seeded from the sample's seed and the piece's
+	// location, so results do not depend on the thread count.
+	std::vector<cbs::SegmentationResult> segment_sample_pieces(const std::vector<double>& sm, const std::vector<std::size_t>& offsets, const std::vector<std::vector<int>>& pieces, const std::vector<int>& sbdry, std::uint64_t seed, cbs::ResultCache* cache, const std::string& tag) const {
+		struct Task {
+			std::size_t chri;
+			int start, n;
+			cbs::SegmentationResult seg;
+		};
+		std::vector<Task> tasks;
+		for (std::size_t chri = 0; chri < pieces.size(); ++chri) {
+			int start = 0;
+			for (int n : pieces[chri]) {
+				tasks.push_back({chri, start, n, cbs::SegmentationResult()});
+				start += n;
+			}
+		}
+		cna::parallel_for(tasks.size(), nthreads, [&](std::size_t t) {
+			Task& task = tasks[t];
+			task.seg = segment_seeded(sm.data() + offsets[task.chri] + task.start, task.n, sbdry, seed_words(seed, task.chri, task.start), cache, tag);
+		});
+
+		std::vector<cbs::SegmentationResult> out(pieces.size());
+		std::size_t t = 0;
+		for (std::size_t chri = 0; chri < pieces.size(); ++chri) {
+			cbs::SegmentationResult& seg = out[chri];
+			for (std::size_t p = 0; p < pieces[chri].size(); ++p, ++t) {
+				seg.lengths.insert(seg.lengths.end(), tasks[t].seg.lengths.begin(), tasks[t].seg.lengths.end());
+				seg.means.insert(seg.means.end(), tasks[t].seg.means.begin(), tasks[t].seg.means.end());
+			}
+			if (reconcile) {
+				const int n = static_cast<int>(offsets[chri + 1] - offsets[chri]);
+				seg = cbs::reconcile_pieces(sm.data() + offsets[chri], n, seg, pieces[chri], alpha);
+			}
+		}
+		return out;
+	}
+
+	// first lines of the journal: the options and the input the run reads,
+	// identified by its size, modification time and content hash, so that an
+	// input edited in place is not resumed against stale entries
+	std::string checkpoint_header() const {
+		std::error_code ec;
+		const std::uintmax_t size = std::filesystem::file_size(inputFileName, ec);
+		const auto mtime = std::filesystem::last_write_time(inputFileName, ec).time_since_epoch().count();
+		cbs::ContentHash hash;
+		std::ifstream in(inputFileName.c_str(), std::ios::binary);
+		std::vector<char> buf(1 << 20);
+		while (in.read(buf.data(), buf.size()) || in.gcount() > 0) hash.update(buf.data(), static_cast<std::size_t>(in.gcount()));
+		std::ostringstream header;
+		header << "cna-segment-journal 2\n" << cache_tag() << "\ninput=" << inputFileName << " size=" << size << " mtime=" << mtime << " hash=" << hash.hex() << "\n";
+		return header.str();
+	}
+
+	// Seed words of the generator for the piece of a chromosome at start.
+	static std::vector<std::uint32_t> seed_words(std::uint64_t seed, std::size_t chri, int start) {
+		return {static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32), static_cast<std::uint32_t>(chri), static_cast<std::uint32_t>(start)};
+	}
+
+	// Seed of a sample, from its name, so that its segmentation does not
+	// depend on which samples precede it in the input.
+	static std::uint64_t sample_seed(const std::string& name) {
+		cbs::ContentHash hash;
+		hash.update(name);
+		return std::stoull(hash.hex().substr(0, 16), nullptr, 16);
+	}
+
+	// Segment with a generator seeded with words, through the cache if there
+	// is one.
+	cbs::SegmentationResult segment_seeded(const double* x, int n, const std::vector<int>& sbdry, const std::vector<std::uint32_t>& words, cbs::ResultCache* cache, const std::string& tag) const {
+		if (cache) return segment_cached(x, n, sbdry, words, *cache, tag);
+		std::seed_seq seq(words.begin(), words.end());
+		std::mt19937_64 rng(seq);
+		return segment_chromosome(x, n, sbdry, rng);
+	}
+
+	// Entries are keyed by the smoothed values, the options and the seed, so
+	// a chromosome hits whenever it was segmented before with the same seed,
+	// whatever the other samples of that run.
+	cbs::SegmentationResult segment_cached(const double* x, int n, const std::vector<int>& sbdry, const std::vector<std::uint32_t>& words, cbs::ResultCache& cache, const std::string& tag) const {
+		std::ostringstream seed;
+		for (std::uint32_t w : words) seed << w << ' ';
+		cbs::ContentHash hash;
+		hash.update(tag);
+		hash.update(seed.str());
+		hash.update(x, static_cast<std::size_t>(n) * sizeof(double));
+		const std::string key = hash.hex();
+
+		cbs::SegmentationResult seg;
+		std::string stored;
+		if (cache.load(key, tag, n, seg, stored) && stored == seed.str()) return seg;
+		std::seed_seq seq(words.begin(), words.end());
+		std::mt19937_64 rng(seq);
+		seg = segment_chromosome(x, n, sbdry, rng);
+		cache.store(key, tag, n, seg, seed.str());
+		return seg;
+	}
+
+	// With stats, per-segment statistics rows of each sample are collected in
+	// stats, in input order.
+	cna::SegmentedSampleSet<rvalue> segment_raw(cna::RawSampleSet<rvalue>& raw, cbs::ResultCache* cache = nullptr, SegmentCheckpoint* journal = nullptr, std::vector<std::string>* stats = nullptr) const {
 		cna::SegmentedSampleSet<rvalue> out(raw.marker_set());
-		std::mt19937_64 rng(1);
 		std::vector<int> sbdry((nperm + 1) * (nperm + 2) / 2 + 2, nperm + 1);
 
-		for (const auto* sample_ptr : raw.getSamples()) {
-			auto* sample_it = const_cast<cna::RawSampleSet<rvalue>::RawSample*>(sample_ptr);
-			auto* out_sample = out.create(sample_it->name);
-			for (std::size_t chri = 0; chri < sample_it->size(); ++chri) {
-				auto& chr = (*sample_it)[static_cast<chromid>(chri)];
-				std::vector<double> x(chr.begin(), chr.end());
-				if (x.empty()) continue;
-				std::vector<int> chrom(x.size(), static_cast<int>(chri + 1));
-				const std::vector<double> smoothed = cbs::smooth(x, chrom, smoothRegion, outlierSdScale, smoothSdScale, trim);
-				const auto seg = cbs::segment(smoothed, false, alpha, nperm, hybrid, minWidth, kmax, nmin, eta, sbdry, 1e-6, rng, undoPrune, undoPruneCutoff);
-
-				std::size_t start_index = 0;
-				for (std::size_t i = 0; i < seg.lengths.size(); ++i) {
-					const std::size_t len = static_cast<std::size_t>(seg.lengths[i]);
-					if (len == 0) continue;
-					const std::size_t end_index = start_index + len - 1;
-					cna::Segment<rvalue> s(static_cast<chromid>(chri + 1),
-						raw.marker_set()->at(chri)[start_index]->pos,
-						raw.marker_set()->at(chri)[end_index]->pos,
-						static_cast<unsigned long>(len),
-						seg.means[i]);
-					out_sample->chromosome(static_cast<chromid>(chri))->push_back(s);
-					start_index += len;
+		// chromosome layout shared by all samples, as in DNAcopy's smooth.CNA
+		const std::size_t nchroms = raw.marker_set()->size();
+		std::vector<std::size_t> offsets(nchroms + 1, 0);
+		std::vector<int> lengths(nchroms);
+		for (std::size_t chri = 0; chri < nchroms; ++chri) {
+			lengths[chri] = static_cast<int>(raw.marker_set()->at(chri).size());
+			offsets[chri + 1] = offsets[chri] + raw.marker_set()->at(chri).size();
+		}
+
+		const auto& samples = raw.getSamples();
+		if (stats) stats->assign(samples.size(), std::string());
+		if (method == "joint") {
+			// joint segmentation needs every sample of a chromosome at once;
+			// only one smoothed chromosome is held at a time, smoothed with
+			// the noise scale of each whole profile
+			const std::vector<std::vector<const rvalue*>> buffers = chromosome_buffers(raw, lengths, 0, samples.size());
+			const std::vector<double> scales = cbs::smooth_scales(buffers, lengths, trim, nthreads);
+			std::vector<cna::SegmentedSampleSet<rvalue>::SegmentedSample*> out_samples;
+			for (const auto* sample : samples) out_samples.push_back(out.create(sample->name));
+			for (std::size_t chri = 0; chri < nchroms; ++chri) {
+				if (offsets[chri] == offsets[chri + 1]) continue;
+				const std::vector<std::vector<double>> xs = cbs::smooth_chromosome(buffers, lengths, chri, scales, smoothRegion, outlierSdScale, smoothSdScale, nthreads);
+				const cbs::JointSegmentationResult seg = cbs::segment_joint(xs, penalty, minWidth, nthreads);
+				for (std::size_t si = 0; si < out_samples.size(); ++si) {
+					append_segments(raw, chri, seg.lengths, seg.means[si], out_samples[si]);
+					if (stats) append_statistics(raw, si, chri, xs[si].data(), seg.lengths, seg.means[si], (*stats)[si]);
 				}
 			}
+			return out;
+		}
+
+		// smooth a bounded batch of samples at a time, then segment them in
+		// input order; each chromosome draws from a generator seeded by the
+		// sample name and its location, so results depend neither on the
+		// thread count nor on the other samples
+		const std::string tag = cache ? cache_tag() : std::string();
+		const std::size_t batch_size = 4 * static_cast<std::size_t>(nthreads);
+		std::size_t done = 0;
+		if (journal) {
+			std::vector<std::string> names;
+			for (const auto* sample : samples) names.push_back(sample->name);
+			done = journal->open(out, names);
+		}
+		std::vector<std::vector<int>> pieces;
+		if (splitting()) {
+			for (std::size_t chri = 0; chri < nchroms; ++chri) pieces.push_back(chromosome_pieces(raw, chri));
+		}
+		for (std::size_t first = done; first < samples.size(); first += batch_size) {
+			const std::size_t last = std::min(samples.size(), first + batch_size);
+			const std::vector<std::vector<double>> smoothed = smooth_samples(raw, lengths, first, last);
+
+			for (std::size_t si = first; si < last; ++si) {
+				auto* out_sample = out.create(samples[si]->name);
+				const std::vector<double>& sm = smoothed[si - first];
+				std::vector<cbs::SegmentationResult> segs;
+				const std::uint64_t seed = sample_seed(samples[si]->name);
+				if (splitting()) {
+					segs = segment_sample_pieces(sm, offsets, pieces, sbdry, seed, cache, tag);
+				} else {
+					// an unsplit chromosome is seeded as a single piece
+					segs.resize(nchroms);
+					for (std::size_t chri = 0; chri < nchroms; ++chri) {
+						if (offsets[chri] == offsets[chri + 1]) continue;
+						segs[chri] = segment_seeded(sm.data() + offsets[chri], lengths[chri], sbdry, seed_words(seed, chri, 0), cache, tag);
+					}
+				}
+				for (std::size_t chri = 0; chri < nchroms; ++chri) {
+					append_segments(raw, chri, segs[chri].lengths, segs[chri].means, out_sample);
+					if (stats && !segs[chri].lengths.empty()) append_statistics(raw, si, chri, sm.data() + offsets[chri], segs[chri].lengths, segs[chri].means, (*stats)[si]);
+				}
+				if (journal) journal->commit(out, *out_sample);
+			}
 		}
 		return out;
 	}
+
+	// smoothed genome-wide profiles of samples [first, last), read in place
+	// from the chromosome buffers
+	std::vector<std::vector<double>> smooth_samples(cna::RawSampleSet<rvalue>& raw, const std::vector<int>& lengths, std::size_t first, std::size_t last) const {
+		return cbs::smooth_chromosomes(chromosome_buffers(raw, lengths, first, last), lengths, smoothRegion, outlierSdScale, smoothSdScale, trim, nthreads);
+	}
+
+	// the chromosome buffers of samples [first, last), checked against the
+	// marker layout
+	std::vector<std::vector<const rvalue*>> chromosome_buffers(cna::RawSampleSet<rvalue>& raw, const std::vector<int>& lengths, std::size_t first, std::size_t last) const {
+		const auto& samples = raw.getSamples();
+		std::vector<std::vector<const rvalue*>> batch;
+		batch.reserve(last - first);
+		for (std::size_t si = first; si < last; ++si) {
+			auto* sample_it = const_cast<cna::RawSampleSet<rvalue>::RawSample*>(samples[si]);
+			if (sample_it->size() != lengths.size()) throw std::invalid_argument("Sample '" + sample_it->name + "' does not match the marker set.");
+			std::vector<const rvalue*> chrs(lengths.size());
+			for (std::size_t chri = 0; chri < lengths.size(); ++chri) {
+				const auto& chr = (*sample_it)[static_cast<chromid>(chri)];
+				if (static_cast<int>(chr.size()) != lengths[chri]) throw std::invalid_argument("Sample '" + sample_it->name + "' does not match the marker set.");
+				chrs[chri] = chr.data();
+			}
+			batch.push_back(std::move(chrs));
+		}
+		return batch;
+	}
+
+	// Rows of the statistics table for one segmented chromosome of sample si.
+	// The bootstrap of each sample and chromosome draws from its own seed, so
+	// the table does not depend on the thread count or the segmentation stream.
+	void append_statistics(cna::RawSampleSet<rvalue>& raw, std::size_t si, std::size_t chri, const double* x, const std::vector<int>& lengths, const std::vector<double>& means, std::string& rows) const {
+		const int n = std::accumulate(lengths.begin(), lengths.end(), 0);
+		const std::uint64_t seed = (static_cast<std::uint64_t>(si) << 32) | static_cast<std::uint64_t>(chri);
+		const cbs::SegmentStatistics st = cbs::segment_statistics(x, n, lengths, ciNboot, ciAlpha, ciSearchRange, seed, 100, 1e-6, nthreads);
+		const auto& markers = raw.marker_set()->at(chri);
+		const std::string& name = raw.getSamples()[si]->name;
+		std::ostringstream out;
+		auto value = [&out](double v) -> std::ostringstream& {
+			if (std::isnan(v)) out << "NA";
+			else out << v;
+			return out;
+		};
+		auto location = [&out, &markers](int i) -> std::ostringstream& {
+			if (i < 0) out << "NA";
+			else out << markers[i]->pos;
+			return out;
+		};
+		int start = 0;
+		for (std::size_t k = 0; k < lengths.size(); ++k) {
+			if (lengths[k] == 0) continue;
+			const int end = start + lengths[k] - 1;
+			out << name << '\t' << cna::mapping::chromosome[static_cast<chromid>(chri + 1)] << '\t' << markers[start]->pos << '\t' << markers[end]->pos << '\t' << lengths[k] << '\t' << static_cast<rvalue>(means[k]) << '\t';
+			value(st.sd[k]) << '\t';
+			value(st.median[k]) << '\t';
+			value(st.bstat[k]) << '\t';
+			value(st.pval[k]) << '\t';
+			location(st.lcl[k]) << '\t';
+			location(st.ucl[k]) << '\n';
+			start = end + 1;
+		}
+		rows += out.str();
+	}
+
+	void write_statistics(const std::vector<std::string>& stats) const {
+		std::ofstream out(statsFileName.c_str());
+		if (!out.is_open()) throw std::runtime_error("Failed to open '" + statsFileName + "' for writing.");
+		out << "sample\tchromosome\tstart\tend\tcount\tstate\tsd\tmedian\tbstat\tpval\tlcl\tucl\n";
+		for (const auto& rows : stats) out << rows;
+	}
+
+	static void append_segments(cna::RawSampleSet<rvalue>& raw, std::size_t chri, const std::vector<int>& lengths, const std::vector<double>& means, cna::SegmentedSampleSet<rvalue>::SegmentedSample* out_sample) {
+		std::size_t start_index = 0;
+		for (std::size_t i = 0; i < lengths.size(); ++i) {
+			const std::size_t len = static_cast<std::size_t>(lengths[i]);
+			if (len == 0) continue;
+			const std::size_t end_index = start_index + len - 1;
+			cna::Segment<rvalue> s(static_cast<chromid>(chri + 1),
+				raw.marker_set()->at(chri)[start_index]->pos,
+				raw.marker_set()->at(chri)[end_index]->pos,
+				static_cast<unsigned long>(len),
+				means[i]);
+			out_sample->chromosome(static_cast<chromid>(chri))->push_back(s);
+			start_index += len;
+		}
+	}
 };
 
 #endif
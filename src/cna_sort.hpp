@@ -1,7 +1,10 @@
 #ifndef cna_sort_h
 #define cna_sort_h
 
+#include <filesystem>
 #include <stdexcept>
+#include <string>
+#include <system_error>
 
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
@@ -10,6 +13,7 @@ namespace po = boost::program_options;
 #include "global.hpp"
 #include "cna_common.hpp"
 #include "Marker.hpp"
+#include "MarkerSort.hpp"
 
 
 class Sort : public Command {
@@ -25,6 +29,9 @@ public:
 			("input,i", po::value<std::string>(), "markers file")
 			("output,o", po::value<std::string>(), "output sorted file")
 			("named,m", po::value<bool>(), "whether marker names are present")
+			("memory", po::value<double>(), "sort externally, holding about this many megabytes of markers in memory and merging sorted runs from temporary files; 0 sorts in memory [default: 0]")
+			("threads", po::value<int>(), "number of runs sorted and written concurrently when sorting externally [default: 1]")
+			("temp_dir", po::value<std::string>(), "directory of the temporary files of an external sort [default: system temporary directory]")
 			;
 		popts.add("input", 1).add("output", 1);
 		
@@ -40,6 +47,11 @@ public:
 		
 		getOptions();
 		
+		if (memoryBytes > 0) {
+			cna::marker::sortFile(inputFileName, outputFileName, named, IOProperties(), memoryBytes, nthreads, tempDir);
+			return;
+		}
+		
 		std::string platform = "";
 		
 		cna::marker::Set set(platform);
@@ -57,6 +69,9 @@ private:
 	
 	std::string inputFileName, outputFileName;
 	bool named;
+	size_t memoryBytes = 0;
+	int nthreads = 1;
+	std::string tempDir;
 	
 	void getOptions() {
 		
@@ -77,6 +92,22 @@ private:
 			named = true;
 		}
 		
+		if (vm.count("memory")) {
+			const double mb = vm["memory"].as<double>();
+			if (!(mb >= 0.0)) throw std::invalid_argument("Memory budget must be non-negative.");
+			memoryBytes = static_cast<size_t>(mb * 1024 * 1024);
+			if (mb > 0.0 && memoryBytes == 0) memoryBytes = 1;
+		}
+		if (vm.count("threads")) nthreads = vm["threads"].as<int>();
+		if (nthreads < 1) throw std::invalid_argument("Number of threads must be positive.");
+		if (vm.count("temp_dir")) {
+			tempDir = vm["temp_dir"].as<std::string>();
+		} else {
+			std::error_code ec;
+			tempDir = std::filesystem::temp_directory_path(ec).string();
+			if (ec) tempDir = ".";
+		}
+		
 	}
 	
 };
@@ -0,0 +1,187 @@
+#ifndef cna_summarize_h
+#define cna_summarize_h
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+#include "typedefs.h"
+#include "global.hpp"
+#include "cna_common.hpp"
+#include "SampleSets.hpp"
+#include "cngpld/summarize.hpp"
+
+
+class Summarize : public Command {
+
+public:
+
+	Summarize()
+	: Command("summarize copy-number alterations of segmented samples at positions") {
+		opts.add_options()
+			("help", "print help message")
+			("input,i", po::value<std::string>(), "input segmented file")
+			("output,o", po::value<std::string>(), "output summary file")
+			("direction", po::value<std::string>(), "alterations to summarize: amp, del or both [default: both]")
+			("cutoff", po::value<double>(), "segments whose state, signed by direction, exceeds this are altered [default: 0.5]")
+			("layout", po::value<std::string>(), "output layout: long (one row per sample and position) or matrix (one row per position, one column per sample) [default: long]")
+			("grid", po::value<bool>(), "evaluate every sample at the union of all segment starts and ends, so that rows line up across samples; implied by matrix [default: false]")
+			("positions", po::value<std::string>(), "evaluate every sample at the positions in this file (chromosome and position per line) instead")
+			("threads", po::value<int>(), "number of samples and chromosomes summarized concurrently [default: 1]")
+			;
+		popts.add("input", 1).add("output", 1);
+	}
+
+	void run() {
+		if (vm.count("help")) {
+			std::cout << "usage:  " << progname << " summarize [options] <input file> <output file>" << std::endl;
+			std::cout << opts << std::endl;
+			return;
+		}
+
+		getOptions();
+
+		cna::SegmentedSampleSet<rvalue> seg;
+		seg.read(inputFileName);
+
+		std::vector< std::vector<position> > grid;
+		const std::vector< std::vector<position> >* gridp = NULL;
+		if (!positionsFileName.empty()) {
+			grid = read_positions();
+			gridp = &grid;
+		} else if (useGrid) {
+			grid = cngpld::shared_positions(seg);
+			gridp = &grid;
+		}
+
+		std::vector<int> directions;
+		if (direction != "del") directions.push_back(1);
+		if (direction != "amp") directions.push_back(-1);
+		std::vector< std::vector< std::vector<cngpld::CNSummary> > > summaries;
+		for (size_t d = 0; d < directions.size(); ++d) {
+			summaries.push_back(cngpld::summarize_cohort(seg, directions[d], cutoff, gridp, nthreads));
+		}
+
+		std::vector<std::string> names;
+		for (cna::SegmentedSampleSet<rvalue>::Samples::const_iterator it = seg.begin(); it != seg.end(); ++it) {
+			names.push_back((*it)->name);
+		}
+
+		std::ofstream out(outputFileName.c_str());
+		if (!out.is_open()) throw std::runtime_error("Failed to open '" + outputFileName + "' for writing.");
+		if (layout == "long") write_long(out, names, directions, summaries);
+		else write_matrix(out, names, directions, summaries, grid);
+	}
+
+private:
+
+	std::string inputFileName, outputFileName;
+	std::string direction = "both";
+	double cutoff = 0.5;
+	std::string layout = "long";
+	bool useGrid = false;
+	std::string positionsFileName;
+	int nthreads = 1;
+
+	void getOptions() {
+		if (vm.count("input")) inputFileName = vm["input"].as<std::string>();
+		else throw std::invalid_argument("Input file not specified.");
+
+		if (vm.count("output")) outputFileName = vm["output"].as<std::string>();
+		else outputFileName = cna::name::filestem(inputFileName) + ".summary.tsv";
+
+		if (vm.count("direction")) direction = vm["direction"].as<std::string>();
+		if (direction != "amp" && direction != "del" && direction != "both") {
+			throw std::invalid_argument("Invalid direction '" + direction + "'.");
+		}
+		if (vm.count("cutoff")) cutoff = vm["cutoff"].as<double>();
+		if (vm.count("layout")) layout = vm["layout"].as<std::string>();
+		if (layout != "long" && layout != "matrix") {
+			throw std::invalid_argument("Invalid output layout '" + layout + "'.");
+		}
+		if (vm.count("grid")) useGrid = vm["grid"].as<bool>();
+		if (layout == "matrix") useGrid = true;
+		if (vm.count("positions")) positionsFileName = vm["positions"].as<std::string>();
+		if (vm.count("threads")) nthreads = vm["threads"].as<int>();
+		if (nthreads < 1) throw std::invalid_argument("Number of threads must be positive.");
+	}
+
+	// sorted, unique positions per chromosome index
+	std::vector< std::vector<position> > read_positions() const {
+		std::ifstream in(positionsFileName.c_str());
+		if (!in.is_open()) throw std::runtime_error("Failed to open positions file '" + positionsFileName + "'.");
+		std::vector< std::vector<position> > grid;
+		std::string line, chromName;
+		while (std::getline(in, line)) {
+			if (line.empty() || line[0] == '#') continue;
+			std::istringstream fields(line);
+			position pos;
+			// lines without a known chromosome and a position, such as a header, are skipped
+			if (!(fields >> chromName >> pos)) continue;
+			const chromid chr = cna::mapping::chromosome.find(chromName);
+			if (chr == 0) continue;
+			if (grid.size() < chr) grid.resize(chr);
+			grid[chr - 1].push_back(pos);
+		}
+		for (size_t c = 0; c < grid.size(); ++c) {
+			std::sort(grid[c].begin(), grid[c].end());
+			grid[c].erase(std::unique(grid[c].begin(), grid[c].end()), grid[c].end());
+		}
+		return grid;
+	}
+
+	static const char* direction_name(int d) {
+		return d > 0 ? "amp" : "del";
+	}
+
+	static void write_long(std::ostream& out, const std::vector<std::string>& names, const std::vector<int>& directions, const std::vector< std::vector< std::vector<cngpld::CNSummary> > >& summaries) {
+		out << "sample\tchromosome\tposition";
+		for (size_t d = 0; d < directions.size(); ++d) out << '\t' << direction_name(directions[d]);
+		out << '\n';
+		for (size_t i = 0; i < names.size(); ++i) {
+			const std::vector<cngpld::CNSummary>& chroms = summaries[0][i];
+			for (size_t c = 0; c < chroms.size(); ++c) {
+				for (size_t k = 0; k < chroms[c].size(); ++k) {
+					out << names[i] << '\t' << cna::mapping::chromosome[static_cast<chromid>(c + 1)] << '\t' << chroms[c][k].pos;
+					for (size_t d = 0; d < directions.size(); ++d) out << '\t' << summaries[d][i][c][k].value;
+					out << '\n';
+				}
+			}
+		}
+	}
+
+	static void write_matrix(std::ostream& out, const std::vector<std::string>& names, const std::vector<int>& directions, const std::vector< std::vector< std::vector<cngpld::CNSummary> > >& summaries, const std::vector< std::vector<position> >& grid) {
+		// columns are named by sample, suffixed by direction when both are given
+		out << "chromosome\tposition";
+		for (size_t d = 0; d < directions.size(); ++d) {
+			for (size_t i = 0; i < names.size(); ++i) {
+				out << '\t' << names[i];
+				if (directions.size() > 1) out << '.' << direction_name(directions[d]);
+			}
+		}
+		out << '\n';
+		for (size_t c = 0; c < grid.size(); ++c) {
+			for (size_t k = 0; k < grid[c].size(); ++k) {
+				out << cna::mapping::chromosome[static_cast<chromid>(c + 1)] << '\t' << grid[c][k];
+				for (size_t d = 0; d < directions.size(); ++d) {
+					for (size_t i = 0; i < names.size(); ++i) {
+						// samples without this chromosome have no segments on it
+						const std::vector<cngpld::CNSummary>& chroms = summaries[d][i];
+						out << '\t' << (c < chroms.size() ? chroms[c][k].value : 0.0);
+					}
+				}
+				out << '\n';
+			}
+		}
+	}
+
+};
+
+#endif
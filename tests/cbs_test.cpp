@@ -3,6 +3,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include <fstream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -11,6 +12,11 @@
 #include <tuple>
 
 #include "cbs/CBS.hpp"
+#include "cbs/joint.hpp"
+#include "cbs/kernels.hpp"
+#include "cbs/pelt.hpp"
+#include "cbs/segstats.hpp"
+#include "cbs/split.hpp"
 
 using namespace std;
 
@@ -331,5 +337,498 @@ BOOST_AUTO_TEST_CASE(Weighted_SegmentDriver_MatchesDNAcopy_SimpleCase)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(Workspace_ReusedAcrossIntervals_MatchesFreshKernels)
+{
+	std::mt19937_64 gen(7);
+	std::normal_distribution<double> noise(0.0, 0.5);
+	vector<double> x(400);
+	for (size_t i = 0; i < x.size(); ++i) x[i] = noise(gen) + ((i >= 150 && i < 260) ? 1.0 : 0.0);
+
+	cbs::Workspace ws(static_cast<int>(x.size()));
+	const vector<pair<int, int>> intervals{{0, 400}, {150, 260}, {0, 60}, {260, 400}, {0, 400}};
+	for (const auto& iv : intervals) {
+		vector<double> cur(x.begin() + iv.first, x.begin() + iv.second);
+		double mean = 0.0;
+		for (double v : cur) mean += v;
+		mean /= cur.size();
+		double tss = 0.0;
+		for (double& v : cur) {
+			v -= mean;
+			tss += v * v;
+		}
+		const auto fresh = cbs::tmaxo(cur, tss, 2, false);
+		const auto reused = cbs::tmaxo(cur, tss, 2, false, ws);
+		BOOST_TEST_CONTEXT("interval=[" << iv.first << ", " << iv.second << ")") {
+			BOOST_CHECK_EQUAL(reused.start, fresh.start);
+			BOOST_CHECK_EQUAL(reused.end, fresh.end);
+			BOOST_CHECK_EQUAL(reused.statistic, fresh.statistic);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Kernels_AllIsas_MatchScalarReference)
+{
+	// coarse quantization produces many tied maxima, exercising first-index selection
+	std::mt19937_64 gen(11);
+	std::uniform_int_distribution<int> level(-3, 3);
+	vector<double> sx(203, 0.0), cwts(203, 0.0);
+	for (size_t i = 1; i < sx.size(); ++i) {
+		sx[i] = sx[i - 1] + 0.5 * level(gen);
+		cwts[i] = cwts[i - 1] + 0.25 * (1 + (level(gen) & 3));
+	}
+	const double rn = cwts.back() + 1.0;
+
+	const cbs::kernels::Isa isas[] = {cbs::kernels::Isa::scalar, cbs::kernels::Isa::sse4, cbs::kernels::Isa::avx2};
+	const cbs::kernels::Isa native = cbs::kernels::isa();
+	for (auto requested : isas) {
+		const auto used = cbs::kernels::set_isa(requested);
+		for (int lo = 1; lo <= 6; ++lo) {
+			for (int hi = lo - 1; hi <= 150; hi += 7) {
+				for (int d = 1; d <= 40; d += 13) {
+					double mx = 0.0, wmx = 0.0;
+					int mxi = -1;
+					for (int i = lo; i <= hi; ++i) {
+						const double absx = std::abs(sx[i + d] - sx[i]);
+						if (mx < absx) { mx = absx; mxi = i; }
+						const double c = cwts[i + d - 1] - cwts[i - 1];
+						const double bss = std::pow(sx[i + d] - sx[i], 2.0) / (c * (rn - c));
+						if (wmx < bss) wmx = bss;
+					}
+					int imax = -1;
+					BOOST_TEST_CONTEXT("isa=" << static_cast<int>(used) << " lo=" << lo << " hi=" << hi << " d=" << d) {
+						BOOST_CHECK_EQUAL(cbs::kernels::max_absdiff(sx.data(), lo, hi, d), mx);
+						BOOST_CHECK_EQUAL(cbs::kernels::argmax_absdiff(sx.data(), lo, hi, d, imax), mx);
+						BOOST_CHECK_EQUAL(imax, mxi);
+						BOOST_CHECK_EQUAL(cbs::kernels::max_wbss(sx.data(), cwts.data(), lo, hi, d, rn), wmx);
+					}
+				}
+			}
+		}
+		for (int n = 1; n <= 40; ++n) {
+			vector<double> x(sx.begin() + 1, sx.begin() + 1 + n);
+			double sumxi = x[0], di = 1.0, ostat = 0.0;
+			for (int i = 2; i <= n - 2; ++i) {
+				di += 1.0;
+				sumxi += x[i - 1];
+				const double bt = n * (sumxi * sumxi) / (di * (n - di));
+				if (ostat < bt) ostat = bt;
+			}
+			BOOST_CHECK_EQUAL(cbs::btmax(x), std::sqrt(ostat));
+		}
+	}
+	cbs::kernels::set_isa(native);
+}
+
+// exhaustive reference: DNAcopy's enumeration of change-point subsets
+static vector<int> prune_segments_exhaustive(const vector<double>& x, const vector<int>& lseg, double pcut) {
+	const int n = static_cast<int>(x.size());
+	const int nseg = static_cast<int>(lseg.size());
+	const int k = nseg - 1;
+	if (k <= 0) return lseg;
+	double ssq = 0.0;
+	for (double v : x) ssq += v * v;
+	vector<double> sx(nseg, 0.0);
+	vector<int> cums(nseg);
+	int kk = 0, cs = 0;
+	for (int i = 0; i < nseg; ++i) {
+		for (int j = 0; j < lseg[i]; ++j) sx[i] += x[kk++];
+		cs += lseg[i];
+		cums[i] = cs;
+	}
+	auto errssq = [&](const vector<int>& loc, int r) {
+		double out = 0.0;
+		int lo = 0;
+		for (int g = 0; g <= r; ++g) {
+			const int hi = g < r ? loc[g] : nseg - 1;
+			double segsx = 0.0;
+			int segnx = 0;
+			for (int i = lo; i <= hi; ++i) {
+				segsx += sx[i];
+				segnx += lseg[i];
+			}
+			out += segsx * segsx / segnx;
+			lo = hi + 1;
+		}
+		return out;
+	};
+	vector<int> loc(k), best_prev(k), best_cur(k);
+	for (int i = 0; i < k; ++i) loc[i] = best_prev[i] = i;
+	const double wssqk = ssq - errssq(loc, k);
+	for (int j = k - 1; j >= 1; --j) {
+		for (int i = 0; i < j; ++i) loc[i] = best_cur[i] = i;
+		double wssqj = ssq - errssq(loc, j);
+		while (true) {
+			int i = j - 1;
+			while (i >= 0 && loc[i] == k - j + i) --i;
+			if (i < 0) break;
+			++loc[i];
+			for (int m = i + 1; m < j; ++m) loc[m] = loc[m - 1] + 1;
+			const double wssq1 = ssq - errssq(loc, j);
+			if (wssq1 <= wssqj) {
+				wssqj = wssq1;
+				best_cur = loc;
+			}
+		}
+		if (wssqj / wssqk > 1.0 + pcut) {
+			vector<int> out;
+			int prev = 0;
+			for (int i = 0; i <= j; ++i) {
+				out.push_back(cums[best_prev[i]] - prev);
+				prev = cums[best_prev[i]];
+			}
+			out.push_back(n - prev);
+			return out;
+		}
+		best_prev = best_cur;
+	}
+	return vector<int>{n};
+}
+
+BOOST_AUTO_TEST_CASE(PruneSegments_DynamicProgram_MatchesExhaustiveSearch)
+{
+	std::mt19937_64 gen(3);
+	std::normal_distribution<double> noise(0.0, 0.3);
+	std::uniform_int_distribution<int> len(1, 12);
+	std::uniform_real_distribution<double> shift(-1.0, 1.0);
+	for (int rep = 0; rep < 200; ++rep) {
+		const int nseg = 1 + rep % 11;
+		vector<int> lseg(nseg);
+		vector<double> x;
+		for (int s = 0; s < nseg; ++s) {
+			lseg[s] = len(gen);
+			const double mu = shift(gen);
+			for (int i = 0; i < lseg[s]; ++i) x.push_back(mu + noise(gen));
+		}
+		for (double pcut : {0.01, 0.05, 0.2}) {
+			BOOST_TEST_CONTEXT("rep=" << rep << " nseg=" << nseg << " pcut=" << pcut) {
+				const auto expected = prune_segments_exhaustive(x, lseg, pcut);
+				const auto pruned = cbs::prune_segments(x, lseg, pcut);
+				BOOST_CHECK_EQUAL_COLLECTIONS(pruned.begin(), pruned.end(), expected.begin(), expected.end());
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(SegmentDriver_ThreadedSiblings_AreReproducible)
+{
+	std::mt19937_64 gen(5);
+	std::normal_distribution<double> noise(0.0, 0.2);
+	const double levels[] = {0.0, 1.5, -1.0, 0.5, 2.0, 0.0};
+	vector<double> x, wts;
+	for (double mu : levels) {
+		for (int i = 0; i < 120; ++i) {
+			x.push_back(mu + noise(gen));
+			wts.push_back(0.5 + (i % 3) * 0.25);
+		}
+	}
+	std::vector<int> sbdry(101 * 102 / 2 + 2, 101);
+
+	std::mt19937_64 rng(1);
+	const auto serial = cbs::segment(x, false, 0.01, 100, false, 2, 25, 200, 0.05, sbdry, 1e-6, rng);
+	for (int nthreads : {2, 4}) {
+		std::mt19937_64 trng(1);
+		const auto threaded = cbs::segment(x, false, 0.01, 100, false, 2, 25, 200, 0.05, sbdry, 1e-6, trng, false, 0.05, nthreads);
+		BOOST_TEST_CONTEXT("nthreads=" << nthreads) {
+			// the steps are far above noise, so every permutation stream accepts them
+			BOOST_CHECK_EQUAL_COLLECTIONS(threaded.lengths.begin(), threaded.lengths.end(), serial.lengths.begin(), serial.lengths.end());
+		}
+	}
+	BOOST_CHECK_EQUAL(serial.lengths.size(), 6u);
+
+	std::mt19937_64 wrng2(1), wrng4(1);
+	const auto w2 = cbs::segment_weighted(x, wts, 0.01, 100, false, 2, 25, 200, 0.05, sbdry, 1e-6, wrng2, false, 0.05, 2);
+	const auto w4 = cbs::segment_weighted(x, wts, 0.01, 100, false, 2, 25, 200, 0.05, sbdry, 1e-6, wrng4, false, 0.05, 4);
+	BOOST_CHECK_EQUAL_COLLECTIONS(w2.lengths.begin(), w2.lengths.end(), w4.lengths.begin(), w4.lengths.end());
+	BOOST_CHECK_EQUAL_COLLECTIONS(w2.means.begin(), w2.means.end(), w4.means.begin(), w4.means.end());
+}
+
+BOOST_AUTO_TEST_CASE(Pelt_MatchesOptimalPartitioning)
+{
+	std::mt19937_64 gen(17);
+	std::normal_distribution<double> noise(0.0, 0.4);
+	std::uniform_int_distribution<int> len(1, 15);
+	for (int rep = 0; rep < 60; ++rep) {
+		vector<double> x;
+		while (x.size() < 80) {
+			const double mu = 0.5 * (len(gen) % 5);
+			for (int i = len(gen); i > 0; --i) x.push_back(mu + noise(gen));
+		}
+		const int n = static_cast<int>(x.size());
+		const int mw = 1 + rep % 4;
+		const double penalty = 0.2 + 0.1 * (rep % 7);
+
+		// unpruned O(n^2) optimal partitioning
+		vector<double> cs(n + 1, 0.0), f(n + 1, numeric_limits<double>::infinity());
+		for (int i = 0; i < n; ++i) cs[i + 1] = cs[i] + x[i];
+		f[0] = -penalty;
+		for (int t = mw; t <= n; ++t) {
+			for (int s = 0; s + mw <= t; ++s) {
+				const double d = cs[t] - cs[s];
+				f[t] = std::min(f[t], f[s] - d * d / (t - s) + penalty);
+			}
+		}
+
+		const auto seg = cbs::segment_pelt(x, penalty, mw);
+		double cost = -penalty;
+		int lo = 0;
+		for (int l : seg.lengths) {
+			BOOST_CHECK_GE(l, mw);
+			const double d = cs[lo + l] - cs[lo];
+			cost += -d * d / l + penalty;
+			lo += l;
+		}
+		BOOST_TEST_CONTEXT("rep=" << rep << " mw=" << mw) {
+			BOOST_CHECK_EQUAL(lo, n);
+			BOOST_CHECK_SMALL(cost - f[n], 1e-9);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Pelt_And_BinarySegmentation_RecoverClearSteps)
+{
+	std::mt19937_64 gen(23);
+	std::normal_distribution<double> noise(0.0, 0.2);
+	const vector<int> lengths{150, 40, 300, 10, 200};
+	const double levels[] = {0.0, 1.2, -0.6, 2.0, 0.3};
+	vector<double> x;
+	for (size_t s = 0; s < lengths.size(); ++s) {
+		for (int i = 0; i < lengths[s]; ++i) x.push_back(levels[s] + noise(gen));
+	}
+	const double penalty = 2.0 * std::log(static_cast<double>(x.size())) * cbs::diff_variance(x);
+	BOOST_CHECK_CLOSE(cbs::diff_variance(x), 0.04, 20.0);
+	for (const auto& seg : {cbs::segment_pelt(x, penalty), cbs::segment_binseg(x, penalty)}) {
+		BOOST_CHECK_EQUAL_COLLECTIONS(seg.lengths.begin(), seg.lengths.end(), lengths.begin(), lengths.end());
+		BOOST_REQUIRE_EQUAL(seg.means.size(), lengths.size());
+		for (size_t s = 0; s < lengths.size(); ++s) BOOST_CHECK_SMALL(seg.means[s] - levels[s], 0.1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Pelt_And_BinarySegmentation_QuantizedDataKeepsPenalty)
+{
+	// noise rounded to a coarse grid: most adjacent differences are zero
+	std::mt19937_64 gen(37);
+	std::normal_distribution<double> noise(0.0, 0.15);
+	const vector<int> lengths{300, 120, 400};
+	const double levels[] = {0.0, 2.0, -1.0};
+	vector<double> x;
+	for (size_t s = 0; s < lengths.size(); ++s) {
+		for (int i = 0; i < lengths[s]; ++i) x.push_back(levels[s] + 0.5 * std::round(noise(gen) / 0.5));
+	}
+	const double var = cbs::diff_variance(x);
+	BOOST_CHECK(var > 0.0);
+	const double penalty = 2.0 * std::log(static_cast<double>(x.size())) * var;
+	for (const auto& seg : {cbs::segment_pelt(x, penalty), cbs::segment_binseg(x, penalty)}) {
+		BOOST_CHECK_EQUAL_COLLECTIONS(seg.lengths.begin(), seg.lengths.end(), lengths.begin(), lengths.end());
+	}
+	BOOST_CHECK_EQUAL(cbs::diff_variance(vector<double>(50, 1.5)), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(Pelt_DiffVariance_IgnoresNonFiniteValues)
+{
+	std::mt19937_64 gen(41);
+	std::normal_distribution<double> noise(0.0, 0.3);
+	vector<double> x;
+	for (int i = 0; i < 500; ++i) x.push_back(noise(gen));
+	const double var = cbs::diff_variance(x);
+	// missing values break a few differences but leave the estimate close
+	vector<double> y = x;
+	const double nan = std::numeric_limits<double>::quiet_NaN();
+	for (int i = 3; i < 500; i += 37) y[i] = nan;
+	y[250] = std::numeric_limits<double>::infinity();
+	const double vy = cbs::diff_variance(y);
+	BOOST_CHECK(std::isfinite(vy));
+	BOOST_CHECK_CLOSE(vy, var, 15.0);
+	BOOST_CHECK_EQUAL(cbs::diff_variance(vector<double>(20, nan)), 0.0);
+	BOOST_CHECK_EQUAL(cbs::diff_variance(vector<double>{1.0, nan, 1.0, 1.0}), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(Multires_RefinesCoarseBoundariesToMarkerResolution)
+{
+	std::mt19937_64 gen(29);
+	std::normal_distribution<double> noise(0.0, 0.2);
+	const vector<int> lengths{1203, 377, 2051, 96, 1273};
+	const double levels[] = {0.0, 0.9, -0.5, 1.5, 0.2};
+	vector<double> x;
+	for (size_t s = 0; s < lengths.size(); ++s) {
+		for (int i = 0; i < lengths[s]; ++i) x.push_back(levels[s] + noise(gen));
+	}
+	std::vector<int> sbdry(101 * 102 / 2 + 2, 101);
+
+	for (int bin : {1, 8, 20}) {
+		std::mt19937_64 rng(1);
+		const auto seg = cbs::segment_multires(x, bin, 2 * bin, 0.01, 100, false, 2, 25, 200, 0.05, sbdry, 1e-6, rng);
+		BOOST_TEST_CONTEXT("bin=" << bin) {
+			BOOST_CHECK_EQUAL_COLLECTIONS(seg.lengths.begin(), seg.lengths.end(), lengths.begin(), lengths.end());
+		}
+	}
+	std::mt19937_64 rng(1);
+	BOOST_CHECK_THROW(cbs::segment_multires(x, 0, 0, 0.01, 100, false, 2, 25, 200, 0.05, sbdry, 1e-6, rng), std::invalid_argument);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_CASE(Joint_RecoversSharedBreakpointsAcrossSamples)
+{
+	// 150 samples (three blocks): each carries the shared change points with
+	// its own amplitude and noise level, too weak to call reliably alone
+	std::mt19937_64 gen(31);
+	std::normal_distribution<double> unit(0.0, 1.0);
+	const vector<int> lengths{220, 60, 400, 120};
+	const int m = 150;
+	vector<vector<double>> samples(m);
+	for (int j = 0; j < m; ++j) {
+		const double sd = 0.2 + 0.1 * (j % 3);
+		const double amp = (j % 5 == 0) ? 0.0 : 0.15 * (1 + j % 4) * (j % 2 ? 1.0 : -1.0);
+		const double levels[] = {0.0, amp, -amp, 0.5 * amp};
+		for (size_t s = 0; s < lengths.size(); ++s) {
+			for (int i = 0; i < lengths[s]; ++i) samples[j].push_back(levels[s] + sd * unit(gen));
+		}
+	}
+	samples[7][100] = std::numeric_limits<double>::quiet_NaN();
+
+	const auto seg = cbs::segment_joint(samples);
+	BOOST_CHECK_EQUAL_COLLECTIONS(seg.lengths.begin(), seg.lengths.end(), lengths.begin(), lengths.end());
+	BOOST_REQUIRE_EQUAL(seg.means.size(), samples.size());
+	for (int j = 0; j < m; ++j) {
+		BOOST_REQUIRE_EQUAL(seg.means[j].size(), seg.lengths.size());
+		BOOST_CHECK(std::isfinite(seg.means[j][0]));
+	}
+
+	for (int nthreads : {2, 5}) {
+		const auto threaded = cbs::segment_joint(samples, -1.0, 2, nthreads);
+		BOOST_CHECK(threaded.lengths == seg.lengths);
+		BOOST_CHECK(threaded.means == seg.means);
+	}
+
+	// pure noise yields a single segment
+	vector<vector<double>> noise(20, vector<double>(500));
+	for (auto& s : noise) for (auto& v : s) v = unit(gen);
+	BOOST_CHECK_EQUAL(cbs::segment_joint(noise).lengths.size(), 1u);
+
+	// a run of missing values away from zero neither splits the profile nor
+	// pulls its mean towards zero
+	for (auto& s : noise) for (auto& v : s) v += 3.0;
+	for (int i = 200; i < 260; ++i) noise[4][i] = std::numeric_limits<double>::quiet_NaN();
+	const auto gapped = cbs::segment_joint(noise);
+	BOOST_REQUIRE_EQUAL(gapped.lengths.size(), 1u);
+	BOOST_CHECK_CLOSE(gapped.means[4][0], 3.0, 5.0);
+
+	BOOST_CHECK_THROW(cbs::segment_joint({vector<double>(10), vector<double>(9)}), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(TailpTabulated_MatchesSeriesEvaluation)
+{
+	BOOST_CHECK_LT(cbs::nu_table_error(), 1e-10);
+	for (double b : {0.5, 2.0, 3.5, 5.0, 6.9}) {
+		for (int m : {60, 250, 1200}) {
+			const double delta = 26.0 / m;
+			const double exact = cbs::tailp(b, delta, m, 100, 1e-6);
+			BOOST_TEST_CONTEXT("b=" << b << " m=" << m) {
+				BOOST_CHECK_CLOSE(cbs::tailp_tabulated(b, delta, m, 100), exact, 1e-7);
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Segment_FloatBuffer_MatchesDoubleProfile)
+{
+	std::mt19937_64 gen(37);
+	std::normal_distribution<float> noise(0.0f, 0.25f);
+	const vector<int> lengths{180, 45, 260};
+	const float levels[] = {0.0f, 1.0f, -0.4f};
+	vector<float> xf;
+	for (size_t s = 0; s < lengths.size(); ++s) {
+		for (int i = 0; i < lengths[s]; ++i) xf.push_back(levels[s] + noise(gen));
+	}
+	const vector<double> xd(xf.begin(), xf.end());
+	std::vector<int> sbdry(101 * 102 / 2 + 2, 101);
+
+	for (bool hybrid : {false, true}) {
+		std::mt19937_64 rng_d(1), rng_f(1);
+		const auto sd = cbs::segment(xd, false, 0.01, 100, hybrid, 2, 25, 200, 0.05, sbdry, 1e-6, rng_d, true, 0.05);
+		const auto sf = cbs::segment(xf.data(), static_cast<int>(xf.size()), false, 0.01, 100, hybrid, 2, 25, 200, 0.05, sbdry, 1e-6, rng_f, true, 0.05);
+		BOOST_TEST_CONTEXT("hybrid=" << hybrid) {
+			BOOST_CHECK_EQUAL_COLLECTIONS(sf.lengths.begin(), sf.lengths.end(), sd.lengths.begin(), sd.lengths.end());
+			BOOST_CHECK_EQUAL_COLLECTIONS(sf.means.begin(), sf.means.end(), sd.means.begin(), sd.means.end());
+			BOOST_CHECK_EQUAL_COLLECTIONS(sd.lengths.begin(), sd.lengths.end(), lengths.begin(), lengths.end());
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Split_CutsAtGapsAndBoundaries)
+{
+	const vector<long> pos = {10, 20, 30, 1000, 1010, 1020, 1030, 5000, 5010};
+	BOOST_CHECK(cbs::split_at_gaps(pos, 500) == vector<int>({3, 4, 2}));
+	// a cut leaving fewer than min_piece markers is skipped
+	BOOST_CHECK(cbs::split_at_gaps(pos, 500, 3) == vector<int>({3, 6}));
+	BOOST_CHECK(cbs::split_at_gaps(pos, 10000) == vector<int>({9}));
+	BOOST_CHECK(cbs::split_at_boundaries(pos, {1015, 25, 1015, 0, 9999}) == vector<int>({2, 3, 4}));
+}
+
+BOOST_AUTO_TEST_CASE(Split_ReconcileMergesOnlyEqualLevels)
+{
+	// three pieces of 40: the level is shared across the first boundary and
+	// steps at the second
+	vector<double> x;
+	for (int i = 0; i < 120; ++i) x.push_back((i < 80 ? 0.0 : 2.0) + 0.1 * ((i * 7) % 5 - 2));
+	cbs::SegmentationResult seg;
+	for (int p = 0; p < 3; ++p) {
+		double s = 0.0;
+		for (int i = 40 * p; i < 40 * (p + 1); ++i) s += x[i];
+		seg.lengths.push_back(40);
+		seg.means.push_back(s / 40);
+	}
+	const cbs::SegmentationResult out = cbs::reconcile_pieces(x.data(), 120, seg, {40, 40, 40}, 0.01);
+	BOOST_CHECK(out.lengths == vector<int>({80, 40}));
+	BOOST_CHECK_CLOSE(out.means[0], (seg.means[0] + seg.means[1]) / 2, 1e-9);
+	BOOST_CHECK_CLOSE(out.means[1], seg.means[2], 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(SegmentStatistics_MatchDirectComputation)
+{
+	mt19937_64 gen(11);
+	normal_distribution<double> noise(0.0, 0.5);
+	vector<double> x;
+	for (int i = 0; i < 300; ++i) x.push_back((i >= 120 && i < 200 ? 1.0 : 0.0) + noise(gen));
+	const vector<int> lengths = {120, 80, 100};
+
+	const cbs::SegmentStatistics st = cbs::segment_statistics(x.data(), 300, lengths, 200, 0.05, 30, 5);
+	int start = 0;
+	for (size_t k = 0; k < lengths.size(); ++k) {
+		vector<double> seg(x.begin() + start, x.begin() + start + lengths[k]);
+		double mean = 0.0, ss = 0.0;
+		for (double v : seg) mean += v;
+		mean /= seg.size();
+		for (double v : seg) ss += (v - mean) * (v - mean);
+		BOOST_CHECK_CLOSE(st.sd[k], sqrt(ss / (seg.size() - 1)), 1e-8);
+		sort(seg.begin(), seg.end());
+		const size_t h = seg.size() / 2;
+		BOOST_CHECK_CLOSE(st.median[k], seg.size() % 2 ? seg[h] : (seg[h - 1] + seg[h]) / 2, 1e-12);
+		if (k + 1 < lengths.size()) {
+			// bsegp: btmax of the two segments pooled and standardized
+			vector<double> pooled(x.begin() + start, x.begin() + start + lengths[k] + lengths[k + 1]);
+			double pm = 0.0, pss = 0.0;
+			for (double v : pooled) pm += v;
+			pm /= pooled.size();
+			for (double v : pooled) pss += (v - pm) * (v - pm);
+			for (double& v : pooled) v = (v - pm) / sqrt(pss / (pooled.size() - 1));
+			BOOST_CHECK_CLOSE(st.bstat[k], cbs::btmax(pooled), 1e-6);
+			BOOST_CHECK_CLOSE(st.pval[k], min(1.0, cbs::btailp(cbs::btmax(pooled), static_cast<int>(pooled.size()), 100, 1e-6)), 1e-4);
+			BOOST_CHECK_LT(st.pval[k], 1e-6);
+			// the interval brackets the true change point
+			const int cpt = start + lengths[k] - 1;
+			BOOST_CHECK_LE(st.lcl[k], cpt);
+			BOOST_CHECK_GE(st.ucl[k], cpt);
+			BOOST_CHECK_LT(st.ucl[k] - st.lcl[k], 30);
+		} else {
+			BOOST_CHECK(std::isnan(st.bstat[k]) && std::isnan(st.pval[k]));
+			BOOST_CHECK_EQUAL(st.lcl[k], -1);
+		}
+		start += lengths[k];
+	}
+
+	// the bootstrap does not depend on the number of threads
+	const cbs::SegmentStatistics threaded = cbs::segment_statistics(x.data(), 300, lengths, 200, 0.05, 30, 5, 100, 1e-6, 3);
+	BOOST_CHECK(threaded.lcl == st.lcl);
+	BOOST_CHECK(threaded.ucl == st.ucl);
+}
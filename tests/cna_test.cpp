@@ -7,13 +7,19 @@
 #include "SampleSets.hpp"
 #include "SegmentedSampleSet.hpp"
 #include "FilesDiff.hpp"
+#include "MarkerImage.hpp"
 
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <queue>
+#include <random>
 #include <stdexcept>
 #include <cstdio>
 #include <cstdlib>
 #include <sstream>
+#include <set>
+#include <thread>
 
 using namespace std;
 
@@ -179,6 +185,180 @@ BOOST_AUTO_TEST_CASE(RawSampleSet_CopyConstructor)
 	BOOST_CHECK_EQUAL(diff.different(fn_copy, fn_copy2), 0);
 }
 
+BOOST_AUTO_TEST_CASE(MarkerManager_Concurrent_Reads_And_Copies)
+{
+	typedef cna::RawSampleSet<rvalue> SampleSetType;
+	const string fn_in = "raw1.in";
+	const string fn_expected = "raw1.concurrent";
+	{
+		SampleSetType set;
+		set.read(fn_in);
+		set.write(fn_expected);
+	}
+
+	// every read draws and registers a marker set name, and every copy and
+	// destruction references and releases a marker set
+	const int nthreads = 8;
+	vector<int> mismatches(nthreads, 0);
+	vector< vector<string> > names(nthreads);
+	vector<thread> threads;
+	for (int t = 0; t < nthreads; ++t) {
+		threads.emplace_back([&, t]() {
+			FilesDiff diff;
+			const string fn_out = "raw1.concurrent" + to_string(t);
+			for (int i = 0; i < 20; ++i) {
+				SampleSetType* set = new SampleSetType();
+				set->read(fn_in);
+				SampleSetType copy(*set);
+				delete set;
+				copy.write(fn_out);
+				if (diff.different(fn_out, fn_expected) != 0) ++mismatches[t];
+			}
+			for (int i = 0; i < 200; ++i) {
+				string name;
+				cna::marker::manager.newSetName(name);
+				names[t].push_back(name);
+			}
+		});
+	}
+	for (auto& th : threads) th.join();
+
+	set<string> unique;
+	for (int t = 0; t < nthreads; ++t) {
+		BOOST_CHECK_EQUAL(mismatches[t], 0);
+		for (const auto& name : names[t]) {
+			BOOST_CHECK_EQUAL(name.size(), 6u);
+			unique.insert(name);
+		}
+	}
+	BOOST_CHECK_EQUAL(unique.size(), static_cast<size_t>(nthreads * 200));
+}
+
+BOOST_AUTO_TEST_CASE(MarkerManager_Shares_Identical_Marker_Sets)
+{
+	typedef cna::RawSampleSet<rvalue> SampleSetType;
+	FilesDiff diff;
+	const string fn_in = "raw1.in";
+	const string fn_a = "raw1.shared_a", fn_b = "raw1.shared_b";
+
+	SampleSetType* a = new SampleSetType();
+	a->read(fn_in);
+	a->write(fn_a);
+	SampleSetType b;
+	b.read(fn_in);
+	BOOST_CHECK(a->marker_set() == b.marker_set());
+
+	SampleSetType other;
+	other.read("segment_cli_case1_input.raw");
+	BOOST_CHECK(other.marker_set() != b.marker_set());
+
+	// filtering one set by the other removes every marker from its own copy
+	// and leaves the shared markers intact
+	a->filter(b);
+	BOOST_CHECK(a->marker_set() != b.marker_set());
+	BOOST_CHECK(a->marker_set()->empty());
+	b.write(fn_b);
+	BOOST_CHECK_EQUAL(diff.different(fn_a, fn_b), 0);
+	delete a;
+
+	// a later read shares the remaining set
+	SampleSetType c;
+	c.read(fn_in);
+	BOOST_CHECK(c.marker_set() == b.marker_set());
+}
+
+BOOST_AUTO_TEST_CASE(RawSampleSet_Sort_Permutes_Samples_In_Place)
+{
+	// enough values to sort samples on several threads
+	const size_t nmarkers = 40000, nsamples = 16;
+	const string fn = "raw_sort_shuffled.cn";
+	{
+		vector<size_t> rows(nmarkers);
+		for (size_t i = 0; i < nmarkers; ++i) rows[i] = i;
+		std::mt19937 rng(7);
+		std::shuffle(rows.begin(), rows.end(), rng);
+		ofstream out(fn.c_str());
+		out << "marker\tchromosome\tposition";
+		for (size_t s = 0; s < nsamples; ++s) out << "\ts" << s;
+		out << '\n';
+		for (size_t r = 0; r < nmarkers; ++r) {
+			// markers 2k and 2k + 1 share a position, on chromosome 2 for odd k
+			const size_t i = rows[r], k = i / 2;
+			out << 'm' << i << '\t' << (k % 2 ? "2" : "1") << '\t' << 1000 - k % 1000 + 1000 * (k / 1000);
+			for (size_t s = 0; s < nsamples; ++s) out << '\t' << i * nsamples + s;
+			out << '\n';
+		}
+	}
+
+	cna::RawSampleSet<rvalue> set;
+	set.read(fn);
+	const cna::marker::Set& markers = *set.marker_set();
+	size_t mismatches = 0, unsorted = 0;
+	for (chromid c = 0; c < 2; ++c) {
+		const cna::marker::Set::ChromosomeMarkers& chrom = const_cast<cna::marker::Set&>(markers).at(c);
+		for (size_t j = 0; j < chrom.size(); ++j) {
+			if (j > 0 && chrom[j-1]->pos > chrom[j]->pos) ++unsorted;
+			const size_t i = std::stoul(chrom[j]->name.substr(1));
+			for (size_t s = 0; s < nsamples; ++s) {
+				if ((*set.getSamples()[s])[c][j] != static_cast<rvalue>(i * nsamples + s)) ++mismatches;
+			}
+		}
+	}
+	BOOST_CHECK_EQUAL(unsorted, 0u);
+	BOOST_CHECK_EQUAL(mismatches, 0u);
+
+	// sorting a sorted set changes nothing
+	const string once = "raw_sort_once.cn", twice = "raw_sort_twice.cn";
+	set.write(once);
+	set.sort();
+	set.write(twice);
+	FilesDiff diff;
+	BOOST_CHECK_EQUAL(diff.different(once, twice), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MarkerSet_PositionIndex_Matches_Linear_Search)
+{
+	cna::RawSampleSet<rvalue> set;
+	set.read("segment_cli_case1_input.raw");
+	const cna::marker::Set& markers = *set.marker_set();
+	const cna::marker::PositionIndex index = markers.positionIndex();
+	BOOST_REQUIRE_EQUAL(index.size(), markers.size());
+
+	std::mt19937 rng(11);
+	size_t mismatches = 0, chromosomes = 0;
+	for (chromid c = 0; c <= index.size(); ++c) {
+		const vector<position>& pos = index.at(c);
+		if (c < markers.size()) {
+			BOOST_REQUIRE_EQUAL(pos.size(), markers.at(c).size());
+			if (!pos.empty()) ++chromosomes;
+		} else {
+			BOOST_CHECK(pos.empty());
+		}
+		// queries at, between and beyond the markers, at two densities
+		const position hi = pos.empty() ? 100 : pos.back() + 10;
+		for (size_t n = 5; n <= 5000; n *= 1000) {
+			vector<position> queries(n);
+			std::uniform_int_distribution<position> draw(0, hi);
+			for (size_t k = 0; k < n; ++k) queries[k] = (k % 3 == 0 && !pos.empty()) ? pos[draw(rng) % pos.size()] : draw(rng);
+			std::sort(queries.begin(), queries.end());
+			// an out-of-order query is searched on its own
+			queries.push_back(queries.front());
+			const vector<size_t> found = index.covering(c, queries);
+			for (size_t k = 0; k < queries.size(); ++k) {
+				const position q = queries[k];
+				const size_t lower = std::lower_bound(pos.begin(), pos.end(), q) - pos.begin();
+				const size_t upper = std::upper_bound(pos.begin(), pos.end(), q) - pos.begin();
+				if (index.lowerBound(c, q) != lower) ++mismatches;
+				if (index.upperBound(c, q) != upper) ++mismatches;
+				const size_t expected = upper > 0 ? upper - 1 : cna::marker::PositionIndex::npos;
+				if (index.covering(c, q) != expected || found[k] != expected) ++mismatches;
+			}
+		}
+	}
+	BOOST_CHECK(chromosomes > 0);
+	BOOST_CHECK_EQUAL(mismatches, 0u);
+}
+
 BOOST_AUTO_TEST_CASE(SegmentedSampleSet_CopyConstructor)
 {
 	BOOST_TEST_MESSAGE("SegmentedSampleSet copy constructor");
@@ -269,6 +449,525 @@ BOOST_AUTO_TEST_CASE(CLI_Segment_Matches_DNAcopy_Expected_Output)
 	BOOST_CHECK_EQUAL(diff.different(output, expected), 0);
 }
 
+BOOST_AUTO_TEST_CASE(CLI_Segment_Threads_MatchesDNAcopy_Expected_Output)
+{
+	FilesDiff diff;
+	const std::string input = "segment_cli_case1_input.cn";
+	const std::string output = "segment_cli_case1_threads_output.seg";
+	const std::string expected = "segment_cli_case1_expected.seg";
+
+	const std::string cmd = std::string("../cna segment --threads 3 -i ") + shell_quote(input) +
+		" -o " + shell_quote(output);
+	const int rc = std::system(cmd.c_str());
+	BOOST_REQUIRE_EQUAL(rc, 0);
+	BOOST_CHECK_EQUAL(diff.different(output, expected), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MarkerImage_Round_Trip)
+{
+	typedef cna::RawSampleSet<rvalue> SampleSetType;
+	SampleSetType set;
+	set.read("raw1.in");
+	const cna::marker::Set& markers = *set.marker_set();
+
+	std::vector<char> image(cna::marker::Image::size(markers));
+	cna::marker::Image::write(markers, image.data());
+	cna::marker::Set copy("copy");
+	BOOST_REQUIRE(cna::marker::Image::read(image.data(), image.size(), copy));
+
+	BOOST_REQUIRE_EQUAL(copy.size(), markers.size());
+	for (size_t c = 0; c < markers.size(); ++c) {
+		const cna::marker::Set::ChromosomeMarkers& a = copy.at(c);
+		const cna::marker::Set::ChromosomeMarkers& b = set.marker_set()->at(c);
+		BOOST_REQUIRE_EQUAL(a.size(), b.size());
+		for (size_t i = 0; i < a.size(); ++i) {
+			BOOST_CHECK_EQUAL(a[i]->name, b[i]->name);
+			BOOST_CHECK_EQUAL(a[i]->chromosome, b[i]->chromosome);
+			BOOST_CHECK_EQUAL(a[i]->pos, b[i]->pos);
+		}
+	}
+
+	// a truncated or corrupted image is rejected
+	BOOST_CHECK(!cna::marker::Image::read(image.data(), image.size() - 8, copy));
+	image[image.size() / 2] ^= 1;
+	BOOST_CHECK(!cna::marker::Image::read(image.data(), image.size(), copy));
+}
+
+BOOST_AUTO_TEST_CASE(MarkerSet_Read_Uses_Cache_Until_File_Changes)
+{
+	const string fn = "markers_cache_test.tsv";
+	const string cache = fn + ".cnamrk";
+	std::remove(cache.c_str());
+	auto write_markers = [&](const string& last) {
+		ofstream out(fn.c_str());
+		out << "marker\tchromosome\tposition\n" << "m3\t2\t300\nm1\t1\t200\nm2\t1\t100\n" << last;
+	};
+	auto dump = [](cna::marker::Set& set) {
+		ostringstream out;
+		for (size_t c = 0; c < set.size(); ++c) {
+			for (size_t i = 0; i < set.at(c).size(); ++i) {
+				out << set.at(c)[i]->name << ':' << set.at(c)[i]->chromosome << ':' << set.at(c)[i]->pos << ' ';
+			}
+			out << '|';
+		}
+		return out.str();
+	};
+
+	write_markers("m4\t1\t50\n");
+	cna::marker::Set parsed("parsed");
+	parsed.read(fn, "parsed", true, true);
+	BOOST_CHECK_EQUAL(parsed.at(0)[0]->name, "m4");
+	BOOST_CHECK(ifstream(cache.c_str()).good());
+	cna::marker::Set cached("cached");
+	cached.read(fn, "cached", true, true);
+	BOOST_CHECK_EQUAL(dump(cached), dump(parsed));
+
+	// a change of the same size, possibly within the same mtime tick
+	write_markers("m4\t1\t60\n");
+	cna::marker::Set changed("changed");
+	changed.read(fn, "changed", true, true);
+	BOOST_CHECK_EQUAL(changed.at(0)[0]->pos, 60u);
+
+	// a damaged cache is ignored
+	{
+		fstream f(cache.c_str(), ios::in | ios::out | ios::binary);
+		f.seekp(-1, ios::end);
+		f.put('x');
+	}
+	cna::marker::Set damaged("damaged");
+	damaged.read(fn, "damaged", true, true);
+	BOOST_CHECK_EQUAL(dump(damaged), dump(changed));
+	std::remove(cache.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Sort_External_Matches_In_Memory)
+{
+	const string input = "sort_external_input.tsv";
+	{
+		std::mt19937 rng(11);
+		const char* chroms[] = {"1", "2", "chr2", "10", "X", "chrY", "Un"};
+		ofstream out(input.c_str());
+		out << "marker\tchromosome\tposition\n";
+		for (int i = 0; i < 20000; ++i) {
+			// few distinct positions, so that many markers tie
+			out << "marker_with_a_long_name_" << i << '\t' << chroms[rng() % 7] << '\t' << rng() % 5000 << '\n';
+		}
+	}
+	const string memory = "sort_external_memory.tsv", external = "sort_external_runs.tsv";
+	BOOST_REQUIRE_EQUAL(std::system(("../cna sort " + input + " " + memory).c_str()), 0);
+	// a budget this small gives hundreds of runs, merged in several passes
+	BOOST_REQUIRE_EQUAL(std::system(("../cna sort --memory 0.01 --threads 3 --temp_dir . " + input + " " + external).c_str()), 0);
+	FilesDiff diff;
+	BOOST_CHECK_EQUAL(diff.different(memory, external), 0);
+	size_t leftover = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(".")) {
+		if (entry.path().extension() == ".run") ++leftover;
+	}
+	BOOST_CHECK_EQUAL(leftover, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Segment_Pelt_And_Binseg_Agree_On_Clear_Steps)
+{
+	FilesDiff diff;
+	const std::string input = "segment_cli_case1_input.cn";
+	const std::string pelt = "segment_cli_case1_pelt_output.seg";
+	const std::string binseg = "segment_cli_case1_binseg_output.seg";
+
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment --method pelt -i ") + shell_quote(input) + " -o " + shell_quote(pelt)).c_str()), 0);
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment --method binseg -i ") + shell_quote(input) + " -o " + shell_quote(binseg)).c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(pelt, binseg), 0);
+
+	const std::string cmd = std::string("../cna segment --method unknown -i ") + shell_quote(input) +
+		" -o segment_cli_case1_unknown_output.seg > /dev/null 2>&1";
+	BOOST_CHECK_NE(std::system(cmd.c_str()), 0);
+
+	// coarse-to-fine options that would be ignored are rejected
+	const char* ignored[] = {"--method pelt --coarse_bin 4", "--method binseg --refine_window 3", "--refine_window 3"};
+	for (const char* opts : ignored) {
+		const std::string rejected = std::string("../cna segment ") + opts + " -i " + shell_quote(input) +
+			" -o segment_cli_case1_ignored_output.seg > /dev/null 2>&1";
+		BOOST_CHECK_NE(std::system(rejected.c_str()), 0);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Segment_Joint_Shares_Breakpoints_Across_Samples)
+{
+	// sample1 steps after the third marker and sample2 after the sixth;
+	// every sample is cut at both
+	const std::string input = "segment_cli_case1_input.cn";
+	const std::string output = "segment_cli_case1_joint_output.seg";
+	for (int threads : {1, 3}) {
+		const std::string cmd = std::string("../cna segment --method joint --threads ") + std::to_string(threads) +
+			" -i " + shell_quote(input) + " -o " + shell_quote(output);
+		BOOST_REQUIRE_EQUAL(std::system(cmd.c_str()), 0);
+
+		ifstream in(output.c_str());
+		string line;
+		getline(in, line);
+		BOOST_CHECK_EQUAL(line, "sample\tchromosome\tstart\tend\tcount\tstate");
+		const char* expected[] = {
+			"sample1\t1\t10\t30\t3\t-0.1",
+			"sample1\t1\t40\t60\t3\t1.1",
+			"sample1\t1\t70\t80\t2\t0",
+			"sample1\t2\t10\t30\t3\t-0.166667",
+			"sample1\t2\t40\t60\t3\t1",
+			"sample1\t2\t70\t80\t2\t0",
+			"sample2\t1\t10\t30\t3\t-0.3",
+			"sample2\t1\t40\t60\t3\t0.1",
+			"sample2\t1\t70\t80\t2\t1.45",
+			"sample2\t2\t10\t30\t3\t-0.366667",
+			"sample2\t2\t40\t60\t3\t0.1",
+			"sample2\t2\t70\t80\t2\t1.35",
+		};
+		for (const char* e : expected) {
+			BOOST_REQUIRE(getline(in, line));
+			BOOST_CHECK_EQUAL(line, e);
+		}
+		BOOST_CHECK(!getline(in, line));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Segment_Cache_Reuses_Results_Across_Cohorts)
+{
+	FilesDiff diff;
+	const std::string input = "segment_cli_case1_input.cn";
+	const std::string subset = "segment_cli_case1_sample2_input.cn";
+	const std::string cache = "segment_cli_cache";
+	const std::string cold = "segment_cli_case1_cold_output.seg";
+	const std::string output = "segment_cli_case1_cached_output.seg";
+	const std::string subset_output = "segment_cli_case1_sample2_cached_output.seg";
+	const std::string subset_expected = "segment_cli_case1_sample2_expected.seg";
+	const std::string report = "segment_cli_case1_cache_report.txt";
+	BOOST_REQUIRE_EQUAL(std::system((std::string("rm -rf ") + shell_quote(cache)).c_str()), 0);
+	const std::string base = std::string("../cna segment --cache_dir ") + shell_quote(cache);
+	auto run = [&](const std::string& options, const std::string& in, const std::string& out) {
+		const std::string cmd = base + options + " -i " + shell_quote(in) + " -o " + shell_quote(out) + " 2> " + shell_quote(report);
+		BOOST_REQUIRE_EQUAL(std::system(cmd.c_str()), 0);
+		ifstream rin(report.c_str());
+		string line;
+		getline(rin, line);
+		return line;
+	};
+
+	// two samples of two chromosomes: all misses, then all hits with the
+	// same output, then all misses again once an option changes
+	BOOST_CHECK_EQUAL(run("", input, cold), "segmentation cache: 0 hits, 4 misses");
+	BOOST_CHECK_EQUAL(run("", input, output), "segmentation cache: 4 hits, 0 misses");
+	BOOST_CHECK_EQUAL(diff.different(output, cold), 0);
+	BOOST_CHECK_EQUAL(run(" --nperm 100", input, output), "segmentation cache: 0 hits, 4 misses");
+
+	// a cohort of the second sample alone hits on both of its chromosomes and
+	// reproduces its segments from the two-sample run
+	{
+		ifstream in(input.c_str());
+		ofstream out(subset.c_str());
+		string line;
+		// drop the sample1 column, the fourth of five
+		while (getline(in, line)) {
+			const std::size_t drop = line.find('\t', line.find('\t', line.find('\t') + 1) + 1);
+			out << line.substr(0, drop) << line.substr(line.rfind('\t')) << '\n';
+		}
+	}
+	{
+		ifstream in(cold.c_str());
+		ofstream out(subset_expected.c_str());
+		string line;
+		getline(in, line);
+		out << line << '\n';
+		while (getline(in, line)) if (line.compare(0, 8, "sample2\t") == 0) out << line << '\n';
+	}
+	BOOST_CHECK_EQUAL(run("", subset, subset_output), "segmentation cache: 2 hits, 0 misses");
+	BOOST_CHECK_EQUAL(diff.different(subset_output, subset_expected), 0);
+
+	// on noisy data, where permutation p-values lie near alpha, a cold and a
+	// warm cached run both write the uncached output
+	const std::string noisy = "segment_cache_noisy_input.cn";
+	const std::string uncached = "segment_cache_noisy_uncached.seg";
+	const std::string noisy_output = "segment_cache_noisy_cached.seg";
+	{
+		ofstream out(noisy.c_str());
+		out << "marker\tchromosome\tposition";
+		for (int j = 0; j < 6; ++j) out << "\tS" << j;
+		out << "\n";
+		unsigned long state = 4242;
+		for (int i = 0; i < 1200; ++i) {
+			const int k = i % 600;
+			out << "m" << i << "\tchr" << (1 + i / 600) << "\t" << (1000 + 100 * k);
+			for (int j = 0; j < 6; ++j) {
+				state = state * 6364136223846793005UL + 1442695040888963407UL;
+				const double noise = static_cast<double>((state >> 33) % 1000) / 1000.0 - 0.5;
+				out << "\t" << ((k > 170 && k < 270) ? 0.2 : 0.0) + 1.5 * noise;
+			}
+			out << "\n";
+		}
+	}
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment -i ") + shell_quote(noisy) + " -o " + shell_quote(uncached)).c_str()), 0);
+	BOOST_CHECK_EQUAL(run("", noisy, noisy_output), "segmentation cache: 0 hits, 12 misses");
+	BOOST_CHECK_EQUAL(diff.different(noisy_output, uncached), 0);
+	BOOST_CHECK_EQUAL(run("", noisy, noisy_output), "segmentation cache: 12 hits, 0 misses");
+	BOOST_CHECK_EQUAL(diff.different(noisy_output, uncached), 0);
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Segment_Split_Pieces_Independent_Of_Threads)
+{
+	FilesDiff diff;
+	const std::string input = "segment_split_input.cn";
+	const std::string arms = "segment_split_arms.tsv";
+	const std::string output = "segment_split_output.seg";
+	const std::string threaded = "segment_split_threaded_output.seg";
+	const std::string armed = "segment_split_arms_output.seg";
+	{
+		// chr1 has a 5 Mb gap after its 300th marker; every sample is gained
+		// across the gap
+		ofstream out(input.c_str());
+		out << "marker\tchromosome\tposition";
+		for (int j = 0; j < 4; ++j) out << "\ts" << j;
+		out << "\n";
+		unsigned long state = 777;
+		for (int i = 0; i < 800; ++i) {
+			const int chr = 1 + i / 600;
+			const int k = i % 600;
+			const long pos = 1000 + 100L * k + (chr == 1 && k >= 300 ? 5000000L : 0L);
+			out << "m" << i << "\tchr" << chr << "\t" << pos;
+			for (int j = 0; j < 4; ++j) {
+				state = state * 6364136223846793005UL + 1442695040888963407UL;
+				const double noise = static_cast<double>((state >> 33) % 1000) / 1000.0 - 0.5;
+				const double level = (chr == 1 && k >= 200 && k < 400) ? 1.0 : 0.0;
+				out << "\t" << level + 0.3 * noise;
+			}
+			out << "\n";
+		}
+		ofstream(arms.c_str()) << "chromosome\tposition\nchr1\t5031000\n";
+	}
+	const std::string base = std::string("../cna segment -i ") + shell_quote(input);
+	BOOST_REQUIRE_EQUAL(std::system((base + " --split_gap 1000000 -o " + shell_quote(output)).c_str()), 0);
+	BOOST_REQUIRE_EQUAL(std::system((base + " --split_gap 1000000 --threads 3 -o " + shell_quote(threaded)).c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(output, threaded), 0);
+	// cutting at the same place through an arm table gives the same result
+	BOOST_REQUIRE_EQUAL(std::system((base + " --arm_table " + shell_quote(arms) + " -o " + shell_quote(armed)).c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(output, armed), 0);
+
+	// the gain is cut at the gap unless the pieces are reconciled
+	auto gained_rows = [](const std::string& path) {
+		ifstream in(path.c_str());
+		string line;
+		int rows = 0;
+		getline(in, line);
+		while (getline(in, line)) {
+			istringstream fields(line);
+			string sample, chr;
+			long start, end;
+			int count;
+			double state;
+			fields >> sample >> chr >> start >> end >> count >> state;
+			if (state > 0.5) ++rows;
+		}
+		return rows;
+	};
+	BOOST_CHECK_EQUAL(gained_rows(output), 8);
+	BOOST_REQUIRE_EQUAL(std::system((base + " --split_gap 1000000 --reconcile true --threads 2 -o " + shell_quote(output)).c_str()), 0);
+	BOOST_CHECK_EQUAL(gained_rows(output), 4);
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Segment_Statistics_Extend_Segments)
+{
+	FilesDiff diff;
+	const std::string input = "segment_cli_case1_input.cn";
+	const std::string expected = "segment_cli_case1_expected.seg";
+	const std::string output = "segment_cli_case1_stats_output.seg";
+	const std::string stats = "segment_cli_case1_stats.tsv";
+	const std::string threaded = "segment_cli_case1_stats_threaded.tsv";
+	const std::string base = std::string("../cna segment -i ") + shell_quote(input) + " -o " + shell_quote(output);
+	BOOST_REQUIRE_EQUAL(std::system((base + " --stats_output " + shell_quote(stats)).c_str()), 0);
+	// the segmentation itself is unchanged
+	BOOST_CHECK_EQUAL(diff.different(output, expected), 0);
+	BOOST_REQUIRE_EQUAL(std::system((base + " --threads 3 --stats_output " + shell_quote(threaded)).c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(stats, threaded), 0);
+
+	// each statistics row starts with its segment row, and the last segment
+	// of a chromosome has no change point after it
+	ifstream seg(expected.c_str()), in(stats.c_str());
+	string line, segline;
+	getline(in, line);
+	BOOST_CHECK_EQUAL(line, "sample\tchromosome\tstart\tend\tcount\tstate\tsd\tmedian\tbstat\tpval\tlcl\tucl");
+	getline(seg, segline);
+	int rows = 0;
+	while (getline(seg, segline)) {
+		BOOST_REQUIRE(getline(in, line));
+		BOOST_CHECK_EQUAL(line.substr(0, segline.size() + 1), segline + "\t");
+		++rows;
+	}
+	BOOST_CHECK(!getline(in, line));
+	BOOST_CHECK_GT(rows, 0);
+	ifstream again(stats.c_str());
+	string last;
+	while (getline(again, line)) last = line;
+	const std::string none = "\tNA\tNA\tNA\tNA";
+	BOOST_CHECK(last.size() > none.size() && last.substr(last.size() - none.size()) == none);
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Summarize_Long_And_Matrix)
+{
+	const std::string input = "summarize_cli_input.seg";
+	const std::string output = "summarize_cli_output.tsv";
+	{
+		ofstream out(input.c_str());
+		out << "sample\tchromosome\tstart\tend\tcount\tstate\n"
+			<< "s1\t1\t10\t50\t5\t1\n"
+			<< "s1\t1\t60\t100\t5\t-1\n"
+			<< "s2\t1\t10\t30\t3\t0\n"
+			<< "s2\t1\t40\t100\t7\t0.8\n";
+	}
+	auto check = [&output](const std::vector<std::string>& expected) {
+		ifstream in(output.c_str());
+		string line;
+		for (const auto& e : expected) {
+			BOOST_REQUIRE(getline(in, line));
+			BOOST_CHECK_EQUAL(line, e);
+		}
+		BOOST_CHECK(!getline(in, line));
+	};
+
+	for (int threads : {1, 3}) {
+		const std::string base = std::string("../cna summarize --threads ") + std::to_string(threads) + " -i " + shell_quote(input) + " -o " + shell_quote(output);
+		BOOST_REQUIRE_EQUAL(std::system(base.c_str()), 0);
+		check({
+			"sample\tchromosome\tposition\tamp\tdel",
+			"s1\t1\t10\t2.71828\t0",
+			"s1\t1\t50\t2.71828\t0",
+			"s1\t1\t60\t0\t2.71828",
+			"s1\t1\t100\t0\t2.71828",
+			"s2\t1\t10\t0\t0",
+			"s2\t1\t30\t0\t0",
+			"s2\t1\t40\t2.22554\t0",
+			"s2\t1\t100\t2.22554\t0",
+		});
+
+		// samples line up on the union of their segment ends
+		BOOST_REQUIRE_EQUAL(std::system((base + " --layout matrix").c_str()), 0);
+		check({
+			"chromosome\tposition\ts1.amp\ts2.amp\ts1.del\ts2.del",
+			"1\t10\t2.71828\t0\t0\t0",
+			"1\t30\t2.71828\t0\t0\t0",
+			"1\t40\t2.71828\t2.22554\t0\t0",
+			"1\t50\t2.71828\t2.22554\t0\t0",
+			"1\t60\t0\t2.22554\t2.71828\t0",
+			"1\t100\t0\t2.22554\t2.71828\t0",
+		});
+	}
+
+	// sex chromosomes are written by name
+	const std::string sex = "summarize_cli_sex_input.seg";
+	ofstream(sex.c_str()) << "sample\tchromosome\tstart\tend\tcount\tstate\ns1\tX\t10\t50\t5\t1\n";
+	const std::string sex_base = std::string("../cna summarize --direction amp -i ") + shell_quote(sex) + " -o " + shell_quote(output);
+	BOOST_REQUIRE_EQUAL(std::system(sex_base.c_str()), 0);
+	check({
+		"sample\tchromosome\tposition\tamp",
+		"s1\tX\t10\t2.71828",
+		"s1\tX\t50\t2.71828",
+	});
+	BOOST_REQUIRE_EQUAL(std::system((sex_base + " --layout matrix").c_str()), 0);
+	check({
+		"chromosome\tposition\ts1",
+		"X\t10\t2.71828",
+		"X\t50\t2.71828",
+	});
+
+	const std::string positions = "summarize_cli_positions.tsv";
+	ofstream(positions.c_str()) << "chromosome\tposition\nchr1\t55\nchr1\t45\n";
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna summarize --direction amp --positions ") + shell_quote(positions) + " -i " + shell_quote(input) + " -o " + shell_quote(output)).c_str()), 0);
+	check({
+		"sample\tchromosome\tposition\tamp",
+		"s1\t1\t45\t2.71828",
+		"s1\t1\t55\t0",
+		"s2\t1\t45\t2.22554",
+		"s2\t1\t55\t2.22554",
+	});
+}
+
+BOOST_AUTO_TEST_CASE(CLI_Segment_Checkpoint_Resumes_To_Identical_Output)
+{
+	FilesDiff diff;
+	const std::string input = "segment_checkpoint_input.cn";
+	const std::string expected = "segment_checkpoint_expected.seg";
+	const std::string output = "segment_checkpoint_output.seg";
+	const std::string journal = output + ".journal";
+	{
+		ofstream out(input.c_str());
+		out << "marker\tchromosome\tposition";
+		for (int j = 0; j < 60; ++j) out << "\ts" << j;
+		out << "\n";
+		unsigned long state = 12345;
+		for (int i = 0; i < 1200; ++i) {
+			out << "m" << i << "\tchr" << (1 + i / 600) << "\t" << (1000 + 10 * (i % 600));
+			for (int j = 0; j < 60; ++j) {
+				state = state * 6364136223846793005UL + 1442695040888963407UL;
+				const double noise = static_cast<double>((state >> 33) % 1000) / 1000.0 - 0.5;
+				const double level = ((i / 150 + j) % 4 == 0) ? 0.8 : (((i / 200 + j) % 5 == 0) ? -0.6 : 0.0);
+				out << "\t" << level + 0.4 * noise;
+			}
+			out << "\n";
+		}
+	}
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment -i ") + shell_quote(input) + " -o " + shell_quote(expected)).c_str()), 0);
+
+	// a finished checkpointed run leaves no journal
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment --checkpoint true -i ") + shell_quote(input) + " -o " + shell_quote(output)).c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(output, expected), 0);
+	BOOST_CHECK(!ifstream(journal.c_str()).good());
+
+	// kill a run after a few samples, then simulate a crash while writing
+	// the next one: rows past the journal and a partial journal line
+	std::remove(output.c_str());
+	const std::string killer =
+		std::string("../cna segment --checkpoint true -i ") + shell_quote(input) + " -o " + shell_quote(output) + " & pid=$!; "
+		"while kill -0 $pid 2>/dev/null && [ \"$(wc -l < " + shell_quote(journal) + " 2>/dev/null || echo 0)\" -lt 8 ]; do sleep 0.01; done; "
+		"kill -9 $pid 2>/dev/null; wait $pid 2>/dev/null; true";
+	BOOST_REQUIRE_EQUAL(std::system(killer.c_str()), 0);
+	if (ifstream(journal.c_str()).good()) {
+		ofstream(output.c_str(), ios::app) << "s59\t1\t1000\t2000\t5\t0.1\n";
+		ofstream(journal.c_str(), ios::app) << "s59\t12";
+	} else {
+		BOOST_TEST_MESSAGE("run finished before it could be interrupted");
+	}
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment --checkpoint true -i ") + shell_quote(input) + " -o " + shell_quote(output)).c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(output, expected), 0);
+	BOOST_CHECK(!ifstream(journal.c_str()).good());
+
+	// an input edited in place without changing its size starts over: a
+	// journal of the old input, with the header it was written under,
+	// must not be resumed
+	const std::string edited = "segment_checkpoint_edited_input.cn";
+	const std::string edited_expected = "segment_checkpoint_edited_expected.seg";
+	const std::string edited_output = "segment_checkpoint_edited_output.seg";
+	const std::string edited_journal = edited_output + ".journal";
+	BOOST_REQUIRE_EQUAL(std::system((std::string("cp -p ") + shell_quote(input) + " " + shell_quote(edited)).c_str()), 0);
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment --checkpoint true -i ") + shell_quote(edited) + " -o " + shell_quote(edited_output) + " & pid=$!; "
+		"while kill -0 $pid 2>/dev/null && [ \"$(wc -l < " + shell_quote(edited_journal) + " 2>/dev/null || echo 0)\" -lt 8 ]; do sleep 0.01; done; "
+		"kill -9 $pid 2>/dev/null; wait $pid 2>/dev/null; true").c_str()), 0);
+	{
+		// swap two digits of the first value, keeping the size and the mtime
+		std::fstream f(edited.c_str(), ios::in | ios::out | ios::binary);
+		string header, row;
+		getline(f, header);
+		const std::streampos start = f.tellg();
+		getline(f, row);
+		const std::size_t v = row.find('\t', row.find('\t', row.find('\t') + 1) + 1) + 1;
+		std::size_t a = v;
+		while (a < row.size() && !isdigit(static_cast<unsigned char>(row[a]))) ++a;
+		std::size_t b = a + 1;
+		while (b < row.size() && (!isdigit(static_cast<unsigned char>(row[b])) || row[b] == row[a])) ++b;
+		BOOST_REQUIRE(b < row.size() && row[b] != '\t');
+		std::swap(row[a], row[b]);
+		f.seekp(start);
+		f << row;
+	}
+	BOOST_REQUIRE_EQUAL(std::system((std::string("touch -r ") + shell_quote(input) + " " + shell_quote(edited)).c_str()), 0);
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment -i ") + shell_quote(edited) + " -o " + shell_quote(edited_expected)).c_str()), 0);
+	BOOST_REQUIRE_EQUAL(std::system((std::string("../cna segment --checkpoint true -i ") + shell_quote(edited) + " -o " + shell_quote(edited_output) + " 2> /dev/null").c_str()), 0);
+	BOOST_CHECK_EQUAL(diff.different(edited_output, edited_expected), 0);
+}
+
 BOOST_AUTO_TEST_CASE(CLI_Segment_Rejects_NonLogScale_Input)
 {
 	const std::string input = "segment_cli_not_logscale_input.cn";
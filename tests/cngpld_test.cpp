@@ -81,3 +81,85 @@ BOOST_AUTO_TEST_CASE(SummarizeCN_Explicit_Positions_And_Empty_Overlap_Match_R)
 	positions.push_back(250);
 	check_summary(cngpld::summarize_cn(seg, "s1", 0, 1, 0.5, &positions), read_expected("cngpld_case4_amp_expected.tsv"));
 }
+
+BOOST_AUTO_TEST_CASE(SummarizeCN_Sweep_Matches_Per_Position_Scan)
+{
+	// overlapping, nested and unsorted segments, and unsorted positions with
+	// duplicates
+	const std::string path = "cngpld_sweep_input.seg";
+	{
+		std::ofstream out(path.c_str());
+		out << "sample\tchromosome\tstart\tend\tcount\tstate\n";
+		unsigned long state = 99;
+		for (int i = 0; i < 200; ++i) {
+			state = state * 6364136223846793005UL + 1442695040888963407UL;
+			const long start = static_cast<long>((state >> 33) % 10000);
+			const long len = static_cast<long>((state >> 20) % 700);
+			const double value = static_cast<double>((state >> 40) % 400) / 100.0 - 2.0;
+			out << "s1\t1\t" << start << "\t" << start + len << "\t10\t" << value << "\n";
+		}
+	}
+	cna::SegmentedSampleSet<rvalue> seg;
+	seg.read(path.c_str());
+
+	std::vector<position> positions;
+	for (int i = 0; i < 500; ++i) positions.push_back(static_cast<position>((i * 7919) % 11000));
+	positions.push_back(positions[3]);
+
+	for (int direction = -1; direction <= 1; direction += 2) {
+		const cngpld::CNSummary sweep = cngpld::summarize_cn(seg, "s1", 0, direction, 0.5, &positions);
+		BOOST_REQUIRE_EQUAL(sweep.size(), positions.size());
+		for (std::size_t i = 0; i < positions.size(); ++i) {
+			BOOST_CHECK_EQUAL(sweep[i].pos, positions[i]);
+			BOOST_CHECK_EQUAL(sweep[i].value, cngpld::summarize_cn_at_position(seg, "s1", 0, positions[i], direction, 0.5));
+		}
+		const cngpld::CNSummary all = cngpld::summarize_cn(seg, "s1", 0, direction, 0.5);
+		for (std::size_t i = 0; i < all.size(); ++i) {
+			BOOST_CHECK_EQUAL(all[i].value, cngpld::summarize_cn_at_position(seg, "s1", 0, all[i].pos, direction, 0.5));
+		}
+	}
+	BOOST_CHECK_THROW(cngpld::summarize_cn(seg, "s1", 0, 0, 0.5), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(SummarizeCohort_Matches_Per_Sample_Summaries)
+{
+	const std::string path = "cngpld_cohort_input.seg";
+	{
+		std::ofstream out(path.c_str());
+		out << "sample\tchromosome\tstart\tend\tcount\tstate\n";
+		unsigned long state = 7;
+		for (int s = 0; s < 5; ++s) {
+			for (int chr = 1; chr <= 3; ++chr) {
+				for (int i = 0; i < 30; ++i) {
+					state = state * 6364136223846793005UL + 1442695040888963407UL;
+					const long start = static_cast<long>((state >> 33) % 5000);
+					const double value = static_cast<double>((state >> 40) % 400) / 100.0 - 2.0;
+					out << "s" << s << "\t" << chr << "\t" << start << "\t" << start + static_cast<long>((state >> 20) % 500) << "\t10\t" << value << "\n";
+				}
+			}
+		}
+	}
+	cna::SegmentedSampleSet<rvalue> seg;
+	seg.read(path.c_str());
+
+	const std::vector< std::vector<cngpld::CNSummary> > own = cngpld::summarize_cohort(seg, -1, 0.5, NULL, 3);
+	const std::vector< std::vector<position> > grid = cngpld::shared_positions(seg);
+	const std::vector< std::vector<cngpld::CNSummary> > shared = cngpld::summarize_cohort(seg, -1, 0.5, &grid, 3);
+	std::size_t i = 0;
+	for (cna::SegmentedSampleSet<rvalue>::Samples::const_iterator it = seg.begin(); it != seg.end(); ++it, ++i) {
+		BOOST_REQUIRE_EQUAL(own[i].size(), (*it)->size());
+		for (std::size_t c = 0; c < own[i].size(); ++c) {
+			const cngpld::CNSummary expected = cngpld::summarize_cn(seg, (*it)->name, c, -1, 0.5);
+			BOOST_REQUIRE_EQUAL(own[i][c].size(), expected.size());
+			for (std::size_t k = 0; k < expected.size(); ++k) BOOST_CHECK_EQUAL(own[i][c][k].value, expected[k].value);
+			// on the shared grid every sample has the same positions
+			const cngpld::CNSummary on_grid = cngpld::summarize_cn(seg, (*it)->name, c, -1, 0.5, &grid[c]);
+			BOOST_REQUIRE_EQUAL(shared[i][c].size(), grid[c].size());
+			for (std::size_t k = 0; k < grid[c].size(); ++k) {
+				BOOST_CHECK_EQUAL(shared[i][c][k].pos, grid[c][k]);
+				BOOST_CHECK_EQUAL(shared[i][c][k].value, on_grid[k].value);
+			}
+		}
+	}
+	BOOST_CHECK_THROW(cngpld::summarize_cohort(seg, 2, 0.5), std::invalid_argument);
+}
@@ -2,10 +2,12 @@
 #define BOOST_TEST_MODULE "Smooth CNA Tests"
 #include <boost/test/unit_test.hpp>
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <limits>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -137,4 +139,137 @@ BOOST_AUTO_TEST_CASE(MatrixSmoothing_Matches_DNAcopy)
 	}
 }
 
+BOOST_AUTO_TEST_CASE(ConsecutiveOutliers_SnapToWindowMedian)
+{
+	// a gently oscillating profile with outliers close enough together that
+	// the sliding window median is updated incrementally between them
+	vector<double> x;
+	vector<int> chrom;
+	for (int i = 0; i < 2000; ++i) {
+		x.push_back(0.1 * ((i * 7) % 5) + (i >= 500 ? 1.0 : 0.0));
+		chrom.push_back(i < 1000 ? 1 : 2);
+	}
+	const vector<size_t> outliers{20, 22, 24, 26, 60, 63, 996, 998, 1000, 1002};
+	for (size_t j = 0; j < outliers.size(); ++j) x[outliers[j]] += (j % 2 == 0) ? 25.0 : -25.0;
+
+	const int k = 3;
+	const auto observed = cbs::smooth(x, chrom, k);
+	double offset = -1.0;
+	for (size_t i : outliers) {
+		const size_t cilo = i < 1000 ? 0 : 1000;
+		const size_t cihi = i < 1000 ? 999 : 1999;
+		vector<double> w(x.begin() + max(cilo, i - k), x.begin() + min(cihi, i + k) + 1);
+		sort(w.begin(), w.end());
+		const double med = (w.size() % 2 == 0) ? (w[w.size() / 2 - 1] + w[w.size() / 2]) / 2.0 : w[w.size() / 2];
+		BOOST_TEST_CONTEXT("i=" << i) {
+			BOOST_CHECK_NE(observed[i], x[i]);
+			const double d = std::abs(observed[i] - med);
+			if (offset < 0.0) offset = d;
+			BOOST_CHECK_SMALL(d - offset, 1e-12);
+		}
+	}
+	BOOST_CHECK_GT(offset, 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(MatrixSmoothing_Threaded_MatchesPerSampleSmoothing)
+{
+	vector<int> chrom;
+	for (int i = 0; i < 600; ++i) chrom.push_back(1 + i / 250);
+	vector<vector<double>> samples;
+	for (int j = 0; j < 7; ++j) {
+		vector<double> x;
+		for (int i = 0; i < 600; ++i) {
+			double v = 0.05 * (((i + 3 * j) * 13) % 7) + ((i / 100 + j) % 3 == 0 ? 0.8 : 0.0);
+			if ((i + j) % 97 == 0) v += 6.0;
+			x.push_back(v);
+		}
+		// some samples have missing values, which take the compaction path
+		if (j % 2 == 1) x[static_cast<size_t>(40 * j)] = numeric_limits<double>::quiet_NaN();
+		samples.push_back(x);
+	}
+
+	const auto serial = cbs::smooth_matrix(samples, chrom, 4);
+	const auto threaded = cbs::smooth_matrix(samples, chrom, 4, 4.0, 2.0, 0.025, 3);
+	BOOST_REQUIRE_EQUAL(serial.size(), samples.size());
+	BOOST_REQUIRE_EQUAL(threaded.size(), samples.size());
+	for (size_t j = 0; j < samples.size(); ++j) {
+		const auto single = cbs::smooth(samples[j], chrom, 4);
+		for (size_t i = 0; i < single.size(); ++i) {
+			BOOST_TEST_CONTEXT("sample=" << j << " i=" << i) {
+				if (std::isfinite(single[i])) {
+					BOOST_CHECK_EQUAL(serial[j][i], single[i]);
+					BOOST_CHECK_EQUAL(threaded[j][i], single[i]);
+				} else {
+					BOOST_CHECK(!std::isfinite(serial[j][i]));
+					BOOST_CHECK(!std::isfinite(threaded[j][i]));
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ChromosomeBuffers_Float_MatchConcatenatedProfile)
+{
+	// float chromosomes read in place must smooth exactly as their
+	// concatenation converted to double
+	const vector<int> lengths{300, 0, 180, 120};
+	vector<vector<vector<float>>> chroms(5);
+	vector<vector<double>> concatenated(5);
+	vector<int> chrom;
+	for (size_t c = 0; c < lengths.size(); ++c) chrom.insert(chrom.end(), lengths[c], static_cast<int>(c + 1));
+	for (int j = 0; j < 5; ++j) {
+		for (size_t c = 0; c < lengths.size(); ++c) {
+			vector<float> v;
+			for (int i = 0; i < lengths[c]; ++i) {
+				float x = 0.07f * (((i + 5 * j) * 11) % 9) + ((i / 60 + j + static_cast<int>(c)) % 3 == 0 ? 0.7f : 0.0f);
+				if ((i + j) % 53 == 0) x -= 5.0f;
+				v.push_back(x);
+			}
+			if (j == 3 && lengths[c] > 0) v[10] = numeric_limits<float>::quiet_NaN();
+			concatenated[j].insert(concatenated[j].end(), v.begin(), v.end());
+			chroms[j].push_back(v);
+		}
+	}
+	vector<vector<const float*>> buffers(5);
+	for (int j = 0; j < 5; ++j) {
+		for (const auto& v : chroms[j]) buffers[j].push_back(v.data());
+	}
+
+	const auto expected = cbs::smooth_matrix(concatenated, chrom, 4);
+	for (int nthreads : {1, 3}) {
+		const auto observed = cbs::smooth_chromosomes(buffers, lengths, 4, 4.0, 2.0, 0.025, nthreads);
+		BOOST_REQUIRE_EQUAL(observed.size(), expected.size());
+		for (size_t j = 0; j < expected.size(); ++j) {
+			BOOST_REQUIRE_EQUAL(observed[j].size(), expected[j].size());
+			for (size_t i = 0; i < expected[j].size(); ++i) {
+				BOOST_TEST_CONTEXT("sample=" << j << " i=" << i) {
+					if (std::isfinite(expected[j][i])) BOOST_CHECK_EQUAL(observed[j][i], expected[j][i]);
+					else BOOST_CHECK(!std::isfinite(observed[j][i]));
+				}
+			}
+		}
+	}
+	BOOST_CHECK_THROW(cbs::smooth_chromosomes(buffers, vector<int>{300, 0, 180}), std::invalid_argument);
+
+	// one chromosome at a time, given the scales of the whole profiles
+	const auto scales = cbs::smooth_scales(buffers, lengths, 0.025, 2);
+	size_t offset = 0;
+	for (size_t c = 0; c < lengths.size(); ++c) {
+		const auto observed = cbs::smooth_chromosome(buffers, lengths, c, scales, 4, 4.0, 2.0, 3);
+		BOOST_REQUIRE_EQUAL(observed.size(), expected.size());
+		for (size_t j = 0; j < expected.size(); ++j) {
+			BOOST_REQUIRE_EQUAL(observed[j].size(), static_cast<size_t>(lengths[c]));
+			for (int i = 0; i < lengths[c]; ++i) {
+				BOOST_TEST_CONTEXT("chromosome=" << c << " sample=" << j << " i=" << i) {
+					const double e = expected[j][offset + i];
+					if (std::isfinite(e)) BOOST_CHECK_EQUAL(observed[j][i], e);
+					else BOOST_CHECK(!std::isfinite(observed[j][i]));
+				}
+			}
+		}
+		offset += lengths[c];
+	}
+	BOOST_CHECK_THROW(cbs::smooth_chromosome(buffers, lengths, lengths.size(), scales), std::invalid_argument);
+}
+
 BOOST_AUTO_TEST_SUITE_END()